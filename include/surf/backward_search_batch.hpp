@@ -0,0 +1,111 @@
+#pragma once
+
+#include <algorithm>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+#include "sdsl/suffix_array_algorithm.hpp"
+#include "surf/csa_qgram.hpp"
+#include "surf/topk_interface.hpp"
+
+namespace surf {
+
+using range_type = sdsl::range_type;
+
+//! SA interval of the pattern [begin, end), {1, 0} if it does not occur.
+template<typename t_csa, typename t_pat_iter>
+range_type sa_range(const t_csa& csa, t_pat_iter begin, t_pat_iter end) {
+    typename t_csa::size_type sp = 0, ep = 0;
+    if (backward_search(csa, 0, csa.size() - 1, begin, end, sp, ep) == 0)
+        return {1, 0};
+    return {sp, ep};
+}
+
+//! sa_range() which starts with the q-gram table of the CSA.
+template<typename t_csa, uint8_t t_q, uint64_t t_min_occ, typename t_pat_iter>
+range_type sa_range(const csa_qgram<t_csa, t_q, t_min_occ>& csa,
+                    t_pat_iter begin, t_pat_iter end) {
+    typename t_csa::size_type sp = 0, ep = 0;
+    if (csa.backward_search(begin, end, sp, ep) == 0)
+        return {1, 0};
+    return {sp, ep};
+}
+
+//! SA intervals of a batch of patterns.
+/*!
+ * The patterns are processed in the order of their reversed strings, so
+ * patterns sharing a suffix are adjacent. The intervals computed for the
+ * longest common suffix with the previous pattern are reused, and only
+ * the remaining characters are matched with LF steps.
+ *
+ * \param csa      The CSA to search in.
+ * \param patterns Pairs of (begin, end) pattern iterators.
+ * \return The SA interval of each pattern, {1, 0} if it does not occur.
+ */
+template<typename t_csa, typename t_pat_iter>
+std::vector<range_type>
+backward_search_batch(const t_csa& csa,
+                      const std::vector<std::pair<t_pat_iter, t_pat_iter>>& patterns) {
+    using size_type = typename t_csa::size_type;
+    using char_type = typename t_csa::char_type;
+    std::vector<range_type> res(patterns.size(), range_type{1, 0});
+
+    std::vector<size_t> order(patterns.size());
+    std::iota(order.begin(), order.end(), 0);
+    auto rbegin = [&](size_t i) { return std::make_reverse_iterator(patterns[i].second); };
+    auto rend = [&](size_t i) { return std::make_reverse_iterator(patterns[i].first); };
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return std::lexicographical_compare(rbegin(a), rend(a), rbegin(b), rend(b));
+    });
+
+    // ranges[j] is the interval of the last j characters of the previous
+    // pattern. It stops early if the interval became empty.
+    std::vector<range_type> ranges{{0, csa.size() - 1}};
+    size_t prev = patterns.size();
+    for (size_t i : order) {
+        size_t len = patterns[i].second - patterns[i].first;
+        size_t shared = 0;
+        if (prev != patterns.size()) {
+            auto m = std::mismatch(rbegin(i), rend(i), rbegin(prev), rend(prev));
+            shared = m.first - rbegin(i);
+        }
+        ranges.resize(std::min(ranges.size(), shared + 1));
+        bool found = true;
+        for (auto it = rbegin(i) + (ranges.size() - 1); it != rend(i); ++it) {
+            size_type sp, ep;
+            if (backward_search(csa, ranges.back()[0], ranges.back()[1],
+                                (char_type)*it, sp, ep) == 0) {
+                found = false;
+                break;
+            }
+            ranges.push_back({sp, ep});
+        }
+        if (found and ranges.size() == len + 1)
+            res[i] = ranges.back();
+        prev = i;
+    }
+    return res;
+}
+
+//! Batch top-k for indexes which answer a pattern from its SA interval.
+/*!
+ * The index has to provide topk(k, sa_range, depth, multi_occ, only_match),
+ * which runs the grid/treap phase of topk() for an interval computed by
+ * backward_search_batch.
+ */
+template<typename t_idx, typename t_csa, typename t_batch_query>
+std::vector<topk_result_set>
+topk_batch(t_idx& idx, const t_csa& csa, size_t k,
+           const t_batch_query& patterns, bool multi_occ, bool only_match) {
+    auto ranges = backward_search_batch(csa, patterns);
+    std::vector<topk_result_set> res;
+    for (size_t i = 0; i < patterns.size(); ++i) {
+        auto it = idx.topk(k, ranges[i], patterns[i].second - patterns[i].first,
+                           multi_occ, only_match);
+        res.push_back(t_idx::topk_interface::take(*it, k));
+    }
+    return res;
+}
+
+} // end namespace surf
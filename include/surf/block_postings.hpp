@@ -0,0 +1,316 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "sdsl/int_vector.hpp"
+
+namespace surf {
+
+//! Postings of one term while the inverted index is built: its documents
+//! in increasing order with their frequencies.
+/*!
+ * Built by construct_postings_lists() from the documents of the SA
+ * interval of the term, see block_postings for the compressed form.
+ */
+struct postings_builder {
+    std::vector<uint64_t> docs;
+    std::vector<uint64_t> freqs;
+
+    postings_builder() = default;
+
+    template<typename t_rank, typename t_vec>
+    postings_builder(const t_rank&, const t_vec& D, size_t sp, size_t ep) {
+        std::vector<uint64_t> occ(D.begin() + sp, D.begin() + ep + 1);
+        std::sort(occ.begin(), occ.end());
+        for (auto doc : occ) {
+            if (docs.empty() or docs.back() != doc) {
+                docs.push_back(doc);
+                freqs.push_back(0);
+            }
+            ++freqs.back();
+        }
+    }
+};
+
+//! The postings lists of all terms of a collection, in blocks of
+//! t_block_size postings.
+/*!
+ * A block packs the d-gaps of its documents and their frequencies, each
+ * with as few bits as the largest value of the block needs (binary
+ * packing). The last document of each block is stored separately, so a
+ * cursor skips blocks without decoding them, and so are the largest
+ * frequency and the shortest document of each block, from which the
+ * ranker bounds the scores of the block (block-max). The same bounds are
+ * kept per term.
+ *
+ * The terms share one bit vector and one array per block attribute, so a
+ * term costs a few integers no matter how short its list is.
+ *
+ * \tparam t_block_size Number of postings of a block.
+ */
+template<uint64_t t_block_size = 128>
+class block_postings {
+    static_assert(t_block_size > 0, "Blocks have to be non-empty.");
+public:
+    typedef uint64_t size_type;
+    static constexpr uint64_t block_size = t_block_size;
+    static constexpr uint64_t end_doc = std::numeric_limits<uint64_t>::max();
+
+private:
+    sdsl::int_vector<>  m_term_block;     // per term + 1, index of the first block
+    sdsl::int_vector<>  m_df;             // per term, number of documents
+    sdsl::int_vector<>  m_F_t;            // per term, number of occurrences
+    sdsl::int_vector<>  m_term_max_freq;  // per term
+    sdsl::int_vector<>  m_term_min_len;   // per term
+    sdsl::bit_vector    m_codes;
+    sdsl::int_vector<>  m_block_start;    // per block + 1, bit offset in m_codes
+    sdsl::int_vector<>  m_block_last;     // per block, last document
+    sdsl::int_vector<8> m_doc_width;      // per block, bits of a d-gap
+    sdsl::int_vector<8> m_freq_width;     // per block, bits of a frequency
+    sdsl::int_vector<>  m_block_max_freq; // per block
+    sdsl::int_vector<>  m_block_min_len;  // per block
+
+public:
+    //! Position in the list of one term.
+    /*!
+     * The block of the current document is decoded into a buffer. The
+     * shallow block may run ahead of it: skip_blocks() moves it to the
+     * block of a document without decoding, to bound the score of the
+     * document by the block-max.
+     */
+    class cursor {
+        const block_postings* m_pl = nullptr;
+        uint64_t m_first_block = 0, m_block = 0, m_end_block = 0;
+        uint64_t m_df = 0;
+        uint64_t m_shallow = 0;
+        uint64_t m_pos = 0, m_cnt = 0;
+        uint64_t m_doc = end_doc;
+        std::array<uint64_t, t_block_size> m_docs;
+        std::array<uint64_t, t_block_size> m_freqs;
+
+        void decode() {
+            uint64_t i = (m_block - m_first_block) * t_block_size;
+            m_cnt = std::min<uint64_t>(m_df - i, t_block_size);
+            uint64_t prev = m_block > m_first_block ? m_pl->m_block_last[m_block - 1] + 1 : 0;
+            m_pl->decode(m_block, m_cnt, prev, m_docs.data(), m_freqs.data());
+            m_pos = 0;
+        }
+
+        void seek_block(uint64_t block) {
+            m_block = block;
+            m_shallow = block;
+            if (m_block == m_end_block) {
+                m_doc = end_doc;
+                return;
+            }
+            decode();
+            m_doc = m_docs[0];
+        }
+
+    public:
+        cursor() = default;
+        cursor(const block_postings& pl, uint64_t term) : m_pl(&pl) {
+            if (term < pl.terms()) {
+                m_first_block = m_block = pl.m_term_block[term];
+                m_end_block = pl.m_term_block[term + 1];
+                m_df = pl.m_df[term];
+            }
+            seek_block(m_block);
+        }
+
+        uint64_t doc() const { return m_doc; }
+        uint64_t freq() const { return m_freqs[m_pos]; }
+        bool done() const { return m_doc == end_doc; }
+
+        void next() {
+            if (++m_pos < m_cnt)
+                m_doc = m_docs[m_pos];
+            else
+                seek_block(m_block + 1);
+        }
+
+        //! Moves to the first document not smaller than doc.
+        void next_geq(uint64_t doc) {
+            if (m_doc >= doc)
+                return;
+            if (m_pl->m_block_last[m_block] < doc) {
+                uint64_t b = std::max(m_block + 1, m_shallow);
+                while (b < m_end_block and m_pl->m_block_last[b] < doc)
+                    ++b;
+                seek_block(b);
+                if (done())
+                    return;
+            }
+            while (m_docs[m_pos] < doc)
+                ++m_pos;
+            m_doc = m_docs[m_pos];
+        }
+
+        //! Moves the shallow block to the block which may hold doc.
+        //! Returns false if no block follows.
+        bool skip_blocks(uint64_t doc) {
+            if (m_shallow < m_block)
+                m_shallow = m_block;
+            while (m_shallow < m_end_block and m_pl->m_block_last[m_shallow] < doc)
+                ++m_shallow;
+            return m_shallow < m_end_block;
+        }
+
+        uint64_t block_last() const { return m_pl->m_block_last[m_shallow]; }
+        uint64_t block_max_freq() const { return m_pl->m_block_max_freq[m_shallow]; }
+        uint64_t block_min_len() const { return m_pl->m_block_min_len[m_shallow]; }
+        uint64_t shallow_block() const { return m_shallow; }
+    };
+
+    block_postings() = default;
+
+    //! Packs the lists, indexed by term. doc_len(d) is the length of the
+    //! document d the ranker uses for the score bounds.
+    template<typename t_doc_len>
+    block_postings(const std::vector<postings_builder>& lists, t_doc_len doc_len) {
+        size_type blocks = 0;
+        m_term_block = sdsl::int_vector<>(lists.size() + 1, 0);
+        m_df = sdsl::int_vector<>(lists.size(), 0);
+        m_F_t = sdsl::int_vector<>(lists.size(), 0);
+        m_term_max_freq = sdsl::int_vector<>(lists.size(), 0);
+        m_term_min_len = sdsl::int_vector<>(lists.size(), 0);
+        for (size_type t = 0; t < lists.size(); ++t) {
+            m_term_block[t] = blocks;
+            m_df[t] = lists[t].docs.size();
+            blocks += (lists[t].docs.size() + t_block_size - 1) / t_block_size;
+        }
+        m_term_block[lists.size()] = blocks;
+
+        m_block_start = sdsl::int_vector<>(blocks + 1, 0);
+        m_block_last = sdsl::int_vector<>(blocks, 0);
+        m_doc_width = sdsl::int_vector<8>(blocks, 0);
+        m_freq_width = sdsl::int_vector<8>(blocks, 0);
+        m_block_max_freq = sdsl::int_vector<>(blocks, 0);
+        m_block_min_len = sdsl::int_vector<>(blocks, 0);
+        auto width = [](uint64_t x) -> uint8_t { return x ? sdsl::bits::hi(x) + 1 : 0; };
+        for (size_type t = 0; t < lists.size(); ++t) {
+            const auto& l = lists[t];
+            uint64_t max_freq = 0, min_len = std::numeric_limits<uint64_t>::max();
+            for (size_type i = 0, b = m_term_block[t]; i < l.docs.size(); i += t_block_size, ++b) {
+                size_type end = std::min<size_type>(i + t_block_size, l.docs.size());
+                uint64_t prev = i ? l.docs[i - 1] + 1 : 0;
+                uint64_t max_gap = 0, block_freq = 0;
+                uint64_t block_len = std::numeric_limits<uint64_t>::max();
+                for (size_type j = i; j < end; ++j) {
+                    max_gap = std::max(max_gap, l.docs[j] - prev);
+                    prev = l.docs[j] + 1;
+                    block_freq = std::max(block_freq, l.freqs[j]);
+                    block_len = std::min<uint64_t>(block_len, doc_len(l.docs[j]));
+                    m_F_t[t] = m_F_t[t] + l.freqs[j];
+                }
+                m_block_last[b] = l.docs[end - 1];
+                m_doc_width[b] = width(max_gap);
+                m_freq_width[b] = width(block_freq - 1);
+                m_block_max_freq[b] = block_freq;
+                m_block_min_len[b] = block_len;
+                m_block_start[b + 1] = m_block_start[b] + (end - i) * (m_doc_width[b] + m_freq_width[b]);
+                max_freq = std::max(max_freq, block_freq);
+                min_len = std::min(min_len, block_len);
+            }
+            m_term_max_freq[t] = max_freq;
+            m_term_min_len[t] = l.docs.empty() ? 0 : min_len;
+        }
+
+        m_codes = sdsl::bit_vector(m_block_start[blocks], 0);
+        for (size_type t = 0; t < lists.size(); ++t) {
+            const auto& l = lists[t];
+            for (size_type i = 0, b = m_term_block[t]; i < l.docs.size(); i += t_block_size, ++b) {
+                size_type end = std::min<size_type>(i + t_block_size, l.docs.size());
+                uint64_t prev = i ? l.docs[i - 1] + 1 : 0;
+                uint64_t offset = m_block_start[b];
+                uint8_t dw = m_doc_width[b], fw = m_freq_width[b];
+                for (size_type j = i; j < end; ++j, offset += dw) {
+                    if (dw)
+                        m_codes.set_int(offset, l.docs[j] - prev, dw);
+                    prev = l.docs[j] + 1;
+                }
+                for (size_type j = i; j < end and fw; ++j, offset += fw)
+                    m_codes.set_int(offset, l.freqs[j] - 1, fw);
+            }
+        }
+        sdsl::util::bit_compress(m_term_block);
+        sdsl::util::bit_compress(m_df);
+        sdsl::util::bit_compress(m_F_t);
+        sdsl::util::bit_compress(m_term_max_freq);
+        sdsl::util::bit_compress(m_term_min_len);
+        sdsl::util::bit_compress(m_block_start);
+        sdsl::util::bit_compress(m_block_last);
+        sdsl::util::bit_compress(m_block_max_freq);
+        sdsl::util::bit_compress(m_block_min_len);
+    }
+
+    //! Number of term ids, the largest id plus one.
+    size_type terms() const { return m_df.size(); }
+
+    uint64_t df(uint64_t term) const { return term < terms() ? m_df[term] : 0; }
+    uint64_t F_t(uint64_t term) const { return term < terms() ? m_F_t[term] : 0; }
+    uint64_t max_freq(uint64_t term) const { return term < terms() ? m_term_max_freq[term] : 0; }
+    uint64_t min_len(uint64_t term) const { return term < terms() ? m_term_min_len[term] : 0; }
+
+    cursor open(uint64_t term) const {
+        return cursor(*this, term);
+    }
+
+    //! Decodes the cnt postings of block b into docs and freqs. prev is
+    //! one more than the last document of the previous block of the term,
+    //! 0 for its first block.
+    void decode(size_type b, size_type cnt, uint64_t prev, uint64_t* docs, uint64_t* freqs) const {
+        uint64_t offset = m_block_start[b];
+        uint8_t dw = m_doc_width[b], fw = m_freq_width[b];
+        for (size_type j = 0; j < cnt; ++j, offset += dw) {
+            prev += dw ? m_codes.get_int(offset, dw) : 0;
+            docs[j] = prev++;
+        }
+        for (size_type j = 0; j < cnt; ++j, offset += fw)
+            freqs[j] = (fw ? m_codes.get_int(offset, fw) : 0) + 1;
+    }
+
+    size_type serialize(std::ostream& out,
+                        sdsl::structure_tree_node* v = nullptr,
+                        std::string name = "") const {
+        using namespace sdsl;
+        structure_tree_node* child = structure_tree::add_child(
+                                         v, name, util::class_name(*this));
+        size_type written_bytes = 0;
+        written_bytes += m_term_block.serialize(out, child, "term_block");
+        written_bytes += m_df.serialize(out, child, "df");
+        written_bytes += m_F_t.serialize(out, child, "F_t");
+        written_bytes += m_term_max_freq.serialize(out, child, "term_max_freq");
+        written_bytes += m_term_min_len.serialize(out, child, "term_min_len");
+        written_bytes += m_codes.serialize(out, child, "codes");
+        written_bytes += m_block_start.serialize(out, child, "block_start");
+        written_bytes += m_block_last.serialize(out, child, "block_last");
+        written_bytes += m_doc_width.serialize(out, child, "doc_width");
+        written_bytes += m_freq_width.serialize(out, child, "freq_width");
+        written_bytes += m_block_max_freq.serialize(out, child, "block_max_freq");
+        written_bytes += m_block_min_len.serialize(out, child, "block_min_len");
+        structure_tree::add_size(child, written_bytes);
+        return written_bytes;
+    }
+
+    void load(std::istream& in) {
+        m_term_block.load(in);
+        m_df.load(in);
+        m_F_t.load(in);
+        m_term_max_freq.load(in);
+        m_term_min_len.load(in);
+        m_codes.load(in);
+        m_block_start.load(in);
+        m_block_last.load(in);
+        m_doc_width.load(in);
+        m_freq_width.load(in);
+        m_block_max_freq.load(in);
+        m_block_min_len.load(in);
+    }
+};
+
+} // end namespace surf
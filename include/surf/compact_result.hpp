@@ -0,0 +1,113 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+#include "surf/topk_interface.hpp"
+
+namespace surf {
+
+//! A top-k result in 8 instead of the 16 bytes of a topk_result.
+/*!
+ * Doc ids take 32 bits, weights are 32 bit frequencies (t_weight =
+ * uint32_t) or scores (t_weight = float), chosen per index with
+ * compact_weight. Sorting and copying compact results moves half the
+ * memory, and a buffer of them can be sent as it is.
+ */
+template<typename t_weight>
+struct compact_result {
+    static_assert(sizeof(t_weight) == 4, "compact weights take 32 bits.");
+    using weight_type = t_weight;
+
+    uint32_t doc;
+    t_weight weight;
+
+    compact_result() = default;
+    compact_result(uint32_t doc, t_weight weight) : doc(doc), weight(weight) {}
+    explicit compact_result(const topk_result& res)
+        : doc((uint32_t)res.first), weight(to_weight(res.second)) {}
+
+    explicit operator topk_result() const {
+        return topk_result(doc, weight);
+    }
+
+private:
+    static t_weight to_weight(double w) {
+        return std::is_integral<t_weight>::value ? (t_weight)std::llround(w) : (t_weight)w;
+    }
+};
+
+template<typename t_weight>
+using compact_result_set = std::vector<compact_result<t_weight>>;
+
+//! Weight type of the compact results of t_idx.
+/*!
+ * t_idx::compact_weight_type if the index declares it, else uint32_t:
+ * all indexes rank by frequencies, except idx_d with a scoring ranker.
+ */
+template<typename t_idx, typename = void>
+struct compact_weight {
+    using type = uint32_t;
+};
+
+template<typename t_idx>
+struct compact_weight<t_idx, typename std::conditional<
+           true, void, typename t_idx::compact_weight_type>::type> {
+    using type = typename t_idx::compact_weight_type;
+};
+
+//! Non-owning view of compact results in a buffer of the caller.
+template<typename t_weight>
+class compact_result_span {
+    const compact_result<t_weight>* m_first = nullptr;
+    const compact_result<t_weight>* m_last = nullptr;
+
+public:
+    compact_result_span() = default;
+    compact_result_span(const compact_result<t_weight>* first,
+                        const compact_result<t_weight>* last)
+        : m_first(first), m_last(last) {}
+
+    size_t size() const { return m_last - m_first; }
+    const compact_result<t_weight>& operator[](size_t i) const { return m_first[i]; }
+    const compact_result<t_weight>* begin() const { return m_first; }
+    const compact_result<t_weight>* end() const { return m_last; }
+};
+
+//! Iterator over compact results in a buffer of the caller, which has to
+//! outlive it. The results are not copied; snippets are extracted by idx
+//! like those of a vector_topk_iterator.
+template<typename t_token, typename t_weight>
+using compact_topk_view = results_topk_iterator<t_token, compact_result_span<t_weight>>;
+
+//! Sorts the results by decreasing weight and increasing doc id, like
+//! sort_topk_results().
+template<typename t_weight>
+void sort_compact_results(compact_result<t_weight>* first, compact_result<t_weight>* last) {
+    std::sort(first, last, [](const compact_result<t_weight>& a,
+                              const compact_result<t_weight>& b) {
+        return a.weight > b.weight or (a.weight == b.weight and a.doc < b.doc);
+    });
+}
+
+//! Appends the first k results of it to buf.
+/*!
+ * buf is owned by the caller, who can reuse it for the next query so
+ * its memory is allocated once.
+ * \return The number of results appended.
+ */
+template<typename t_token, typename t_weight>
+size_t take_compact(topk_iterator<t_token>& it, size_t k, compact_result_set<t_weight>& buf) {
+    size_t cnt = 0;
+    while (cnt < k and !it.done()) {
+        buf.emplace_back(it.get());
+        if (++cnt < k)
+            it.next();
+    }
+    return cnt;
+}
+
+} // end namespace surf
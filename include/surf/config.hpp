@@ -32,6 +32,7 @@ const std::string KEY_WTDUP  = "wtdup";
 const std::string KEY_WTDP  = "wtdp";
 const std::string KEY_DOC_OFFSET  = "doc_offset";
 const std::string KEY_DOC_OFFSET_SELECT  = "doc_offset_select";
+const std::string KEY_DOC_SAMPLE  = "doc_sample";
 const std::string KEY_DUP  = "dup";
 const std::string KEY_DUP_G  = "dup_g";
 const std::string KEY_DOCUMENTS  = "documents";
@@ -51,6 +52,7 @@ const std::string KEY_INVFILE_PLISTS = "invfile_postings_lists";
 const std::string KEY_INVFILE_DOCPERM = "invfile_docperm";
 const std::string KEY_INVFILE_IDOCPERM = "invfile_inv_docperm";
 const std::string KEY_F_T = "Ft";
+const std::string KEY_IMPACT_LISTS = "impact_lists";
 
 const std::string KEY_H = "H";
 const std::string KEY_H_SELECT  = "H_select";
@@ -67,6 +69,10 @@ const std::string KEY_CSA = "csa";
 const std::string KEY_MAXTF = "maxtf";
 const std::string KEY_MAXDOCLEN = "maxdoclen";
 const std::string KEY_QUANTILE_FILTER = "quantile_filter";
+const std::string KEY_PLANNER_MODEL = "planner_model";
+const std::string KEY_SHARD_DOC_BASE = "shard_doc_base";
+const std::string KEY_DELTA_MANIFEST = "delta_manifest";
+const std::string KEY_TOMBSTONES = "tombstones";
 
 const std::string KEY_FILTERED_QUANTILE_FILTER = "filtered_qfilter";
 const std::string KEY_FILTERED_QUANTILE_FILTER_RANK = "filtered_qfilter_rank";
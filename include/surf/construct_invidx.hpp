@@ -44,6 +44,24 @@ void construct_term_ranges(sdsl::int_vector<>& ids, sdsl::int_vector<>& sp,
     }
 }
 
+// Term ranges of construct_term_ranges(), stored in the cache on first use.
+void load_term_ranges(sdsl::int_vector<>& ids, sdsl::int_vector<>& sp,
+                      sdsl::int_vector<>& ep,sdsl::cache_config& cconfig)
+{
+    if( cache_file_exists(surf::KEY_INVFILE_TERM_RANGES,cconfig) ) {
+        std::ifstream ifs(cache_file_name(surf::KEY_INVFILE_TERM_RANGES,cconfig));
+        ids.load(ifs);
+        sp.load(ifs);
+        ep.load(ifs);
+    } else {
+        construct_term_ranges(ids,sp,ep,cconfig);
+        std::ofstream ofs(cache_file_name(surf::KEY_INVFILE_TERM_RANGES,cconfig));
+        serialize(ids,ofs);
+        serialize(sp,ofs);
+        serialize(ep,ofs);
+    }
+}
+
 void construct_invidx_doc_permuations(sdsl::int_vector<>& id_mapping,sdsl::cache_config& cconfig)
 {
     surf::construct_doc_cnt<sdsl::int_alphabet_tag::WIDTH>(cconfig);
@@ -96,18 +114,7 @@ void construct_F_t(sdsl::int_vector<>& F_t,sdsl::cache_config& cconfig)
 {
     // load term ranges 
     sdsl::int_vector<> ids; sdsl::int_vector<> sp; sdsl::int_vector<> ep;
-    if( cache_file_exists(surf::KEY_INVFILE_TERM_RANGES,cconfig) ) {
-        std::ifstream ifs(cache_file_name(surf::KEY_INVFILE_TERM_RANGES,cconfig));
-        ids.load(ifs);
-        sp.load(ifs);
-        ep.load(ifs);
-    } else {
-        construct_term_ranges(ids,sp,ep,cconfig);
-        std::ofstream ofs(cache_file_name(surf::KEY_INVFILE_TERM_RANGES,cconfig));
-        serialize(ids,ofs);
-        serialize(sp,ofs);
-        serialize(ep,ofs);
-    }
+    load_term_ranges(ids,sp,ep,cconfig);
 
     F_t.resize(ids.size());
     for(size_t i=0;i<ids.size();i++) {
@@ -123,30 +130,20 @@ void construct_postings_lists(std::vector<t_pl>& postings_lists,sdsl::cache_conf
 
     // load term ranges 
     sdsl::int_vector<> ids; sdsl::int_vector<> sp; sdsl::int_vector<> ep;
-    if( cache_file_exists(surf::KEY_INVFILE_TERM_RANGES,cconfig) ) {
-        std::ifstream ifs(cache_file_name(surf::KEY_INVFILE_TERM_RANGES,cconfig));
-        ids.load(ifs);
-        sp.load(ifs);
-        ep.load(ifs);
-    } else {
-        construct_term_ranges(ids,sp,ep,cconfig);
-        std::ofstream ofs(cache_file_name(surf::KEY_INVFILE_TERM_RANGES,cconfig));
-        serialize(ids,ofs);
-        serialize(sp,ofs);
-        serialize(ep,ofs);
-    }
+    load_term_ranges(ids,sp,ep,cconfig);
 
 
     if (!cache_file_exists(surf::KEY_DOCBORDER, cconfig)){
         construct_doc_border<sdsl::int_alphabet_tag::WIDTH>(cconfig);
     }
-    if (!cache_file_exists(surf::KEY_DARRAY, cconfig)){
-        construct_darray<sdsl::int_alphabet_tag::WIDTH>(cconfig);
-    }
 
-    // load or construct D array
-    std::cout << "stream D"<< std::endl;
-    int_vector_buffer<> D(cache_file_name(surf::KEY_DARRAY,cconfig));
+    // The documents are taken from the SA, as the D array may be stored
+    // with or without the length permutation of the doc ids.
+    std::cout << "stream SA"<< std::endl;
+    int_vector_buffer<> sa(cache_file_name(conf::KEY_SA,cconfig));
+    bit_vector doc_border;
+    load_from_cache(doc_border, surf::KEY_DOCBORDER, cconfig);
+    rank_support_v<> doc_border_rank(&doc_border);
 
     // load or construct rank function
     std::cout << "load rank"<< std::endl;
@@ -155,8 +152,6 @@ void construct_postings_lists(std::vector<t_pl>& postings_lists,sdsl::cache_conf
     // load mapping if it exists
     std::cout << "load docid mapping" << std::endl;
     sdsl::int_vector<> doc_mapping;
-    doc_perm dp;
-    load_from_cache(dp, KEY_DOCPERM, cconfig);
     load_from_cache(doc_mapping, KEY_INVFILE_DOCPERM, cconfig);
 
     // construct plist for each range
@@ -166,7 +161,7 @@ void construct_postings_lists(std::vector<t_pl>& postings_lists,sdsl::cache_conf
     for(size_t i=2;i<ids.size();i++) { // skip \0 and \1
         size_t range_size = ep[i] - sp[i] + 1;
         int_vector<> tmpD(range_size);
-        for(size_t j=sp[i];j<=ep[i];j++) tmpD[j-sp[i]] = doc_mapping[dp.len2id[D[j]]];
+        for(size_t j=sp[i];j<=ep[i];j++) tmpD[j-sp[i]] = doc_mapping[doc_border_rank(sa[j])];
         if(range_size>1000) std::cout << "(" << i << ") |<" << sp[i] << "," << ep[i] << ">| = " << range_size << std::endl;
         postings_lists[ids[i]] = t_pl(ranker,tmpD,0,range_size-1);
     }
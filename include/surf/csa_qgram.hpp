@@ -0,0 +1,223 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#include "sdsl/suffix_arrays.hpp"
+
+namespace surf {
+
+// CSAs over a wavelet tree of the BWT, e.g. csa_wt, expose it as
+// wavelet_tree.
+template<typename t_csa, typename = void>
+struct csa_has_wavelet_tree : std::false_type {};
+
+template<typename t_csa>
+struct csa_has_wavelet_tree<t_csa,
+        decltype(void(std::declval<const t_csa&>().wavelet_tree))>
+    : std::true_type {};
+
+//! CSA which additionally stores the SA intervals of its q-grams.
+/*!
+ * The first steps of a backward search work on the widest intervals, so
+ * the rank queries on the BWT are the most expensive ones there. For every
+ * l-gram with 2 <= l <= t_q which occurs at least t_min_occ times the
+ * table stores its SA interval. A search looks up the interval of the
+ * last min(m, t_q) characters of the pattern and only does LF steps for
+ * the remaining ones.
+ *
+ * The l-grams of a level are stored as sorted keys of l * w bits, where w
+ * is the width of the compact alphabet. Levels with l * w > 64 are not
+ * stored.
+ *
+ * The table is built level by level: every interval is extended by the
+ * symbols which occur in its BWT range, enumerated with interval_symbols
+ * on the wavelet tree. CSAs without a wavelet tree try every symbol.
+ *
+ * Usage in a config:
+ *   QGRAM_CSA_TYPE=surf::csa_qgram<CSA_TYPE, 3>
+ *   INDEX_TYPE=surf::idx_nn<QGRAM_CSA_TYPE, KTWOTREAP_TYPE>
+ * DF_TYPE keeps the plain CSA_TYPE.
+ *
+ * \tparam t_csa     The underlying CSA.
+ * \tparam t_q       Maximal length of the q-grams.
+ * \tparam t_min_occ Only q-grams occurring at least that often are stored.
+ */
+template<typename t_csa, uint8_t t_q = 3, uint64_t t_min_occ = 1>
+class csa_qgram : public t_csa {
+    static_assert(t_q >= 2, "q-grams need at least two characters.");
+    static_assert(t_min_occ >= 1, "t_min_occ has to be positive.");
+public:
+    typedef typename t_csa::size_type size_type;
+    typedef typename t_csa::char_type char_type;
+
+private:
+    uint8_t                         m_width = 0; // bits per character of a key
+    std::vector<sdsl::int_vector<>> m_keys;      // per level, sorted
+    std::vector<sdsl::int_vector<>> m_sp;
+    std::vector<sdsl::int_vector<>> m_ep;
+
+    uint8_t max_level() const {
+        return std::min<uint64_t>(t_q, m_width ? 64 / m_width : 0);
+    }
+
+    // Finds the interval of the l-gram with the given key.
+    bool find(uint8_t l, uint64_t key, size_type& sp, size_type& ep) const {
+        const auto& keys = m_keys[l];
+        size_type lo = 0, hi = keys.size();
+        while (lo < hi) {
+            size_type mid = lo + (hi - lo) / 2;
+            if (keys[mid] < key)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (lo == keys.size() or keys[lo] != key)
+            return false;
+        sp = m_sp[l][lo];
+        ep = m_ep[l][lo];
+        return true;
+    }
+
+    using node_type = std::tuple<uint64_t, size_type, size_type>; // key, sp, ep
+
+    // The left extensions of the l-1-grams of level which occur at least
+    // t_min_occ times.
+    std::vector<node_type> extend(const std::vector<node_type>& level, uint8_t l,
+                                  std::true_type) const {
+        const auto& wt = this->wavelet_tree;
+        using wt_type = typename std::decay<decltype(wt)>::type;
+        std::vector<typename wt_type::value_type> cs(this->sigma);
+        std::vector<typename wt_type::size_type> rank_sp(this->sigma), rank_ep(this->sigma);
+        std::vector<node_type> next;
+        for (const auto& v : level) {
+            typename wt_type::size_type k = 0;
+            sdsl::interval_symbols(wt, std::get<1>(v), std::get<2>(v) + 1, k,
+                                   cs, rank_sp, rank_ep);
+            for (size_type p = 0; p < k; ++p) {
+                uint64_t c = this->char2comp[cs[p]];
+                if (c == 0 or rank_ep[p] - rank_sp[p] < t_min_occ)
+                    continue;
+                next.emplace_back((c << (m_width * (l - 1))) | std::get<0>(v),
+                                  this->C[c] + rank_sp[p], this->C[c] + rank_ep[p] - 1);
+            }
+        }
+        return next;
+    }
+
+    std::vector<node_type> extend(const std::vector<node_type>& level, uint8_t l,
+                                  std::false_type) const {
+        std::vector<node_type> next;
+        for (const auto& v : level) {
+            for (size_type c = 1; c < this->sigma; ++c) {
+                size_type sp, ep;
+                auto cnt = sdsl::backward_search(*this, std::get<1>(v), std::get<2>(v),
+                                                 this->comp2char[c], sp, ep);
+                if (cnt >= t_min_occ)
+                    next.emplace_back((c << (m_width * (l - 1))) | std::get<0>(v), sp, ep);
+            }
+        }
+        return next;
+    }
+
+public:
+    csa_qgram() = default;
+
+    //! Computes the table for the underlying CSA.
+    void build_table() {
+        m_width = sdsl::bits::hi(std::max<uint64_t>(1, this->sigma - 1)) + 1;
+        m_keys = std::vector<sdsl::int_vector<>>(t_q + 1);
+        m_sp = std::vector<sdsl::int_vector<>>(t_q + 1);
+        m_ep = std::vector<sdsl::int_vector<>>(t_q + 1);
+        uint8_t pos_width = sdsl::bits::hi(std::max<uint64_t>(1, this->size())) + 1;
+
+        // Extend the l-grams to the left, level by level.
+        std::vector<node_type> level{node_type(0, 0, this->size() - 1)};
+        for (uint8_t l = 1; l <= max_level(); ++l) {
+            level = extend(level, l, csa_has_wavelet_tree<t_csa>());
+            if (l < 2)
+                continue;
+            std::sort(level.begin(), level.end());
+            m_keys[l] = sdsl::int_vector<>(level.size(), 0, m_width * l);
+            m_sp[l] = sdsl::int_vector<>(level.size(), 0, pos_width);
+            m_ep[l] = sdsl::int_vector<>(level.size(), 0, pos_width);
+            for (size_type i = 0; i < level.size(); ++i) {
+                m_keys[l][i] = std::get<0>(level[i]);
+                m_sp[l][i] = std::get<1>(level[i]);
+                m_ep[l][i] = std::get<2>(level[i]);
+            }
+        }
+    }
+
+    //! Backward search for [begin, end) which starts with the table.
+    /*!
+     * \return The size of the SA interval [sp..ep] of the pattern.
+     */
+    template<typename t_pat_iter>
+    size_type backward_search(t_pat_iter begin, t_pat_iter end,
+                              size_type& sp, size_type& ep) const {
+        uint8_t l = std::min<uint64_t>(end - begin, max_level());
+        uint64_t key = 0;
+        bool found = false;
+        if (l >= 2) {
+            for (auto it = end - l; it != end; ++it) {
+                char_type c = (char_type)*it;
+                auto cc = this->char2comp[c];
+                if (cc == 0 and c > 0) { // does not occur in the text
+                    sp = 1; ep = 0;
+                    return 0;
+                }
+                key = (key << m_width) | cc;
+            }
+            found = find(l, key, sp, ep);
+            if (!found and t_min_occ == 1) {
+                sp = 1; ep = 0;
+                return 0;
+            }
+        }
+        if (!found) {
+            sp = 0; ep = this->size() - 1;
+            l = 0;
+        }
+        return sdsl::backward_search(*this, sp, ep, begin, end - l, sp, ep);
+    }
+
+    size_type serialize(std::ostream& out,
+                        sdsl::structure_tree_node* v = nullptr,
+                        std::string name = "") const {
+        using namespace sdsl;
+        structure_tree_node* child = structure_tree::add_child(
+                                         v, name, util::class_name(*this));
+        size_type written_bytes = 0;
+        written_bytes += t_csa::serialize(out, child, "csa");
+        written_bytes += write_member(m_width, out, child, "width");
+        written_bytes += serialize_vector(m_keys, out, child, "keys");
+        written_bytes += serialize_vector(m_sp, out, child, "sp");
+        written_bytes += serialize_vector(m_ep, out, child, "ep");
+        structure_tree::add_size(child, written_bytes);
+        return written_bytes;
+    }
+
+    void load(std::istream& in) {
+        t_csa::load(in);
+        sdsl::read_member(m_width, in);
+        m_keys.resize(t_q + 1);
+        m_sp.resize(t_q + 1);
+        m_ep.resize(t_q + 1);
+        sdsl::load_vector(m_keys, in);
+        sdsl::load_vector(m_sp, in);
+        sdsl::load_vector(m_ep, in);
+    }
+};
+
+template<typename t_csa, uint8_t t_q, uint64_t t_min_occ>
+void construct(csa_qgram<t_csa, t_q, t_min_occ>& idx, const std::string& file,
+               sdsl::cache_config& cc, uint8_t num_bytes = 0) {
+    sdsl::construct(static_cast<t_csa&>(idx), file, cc, num_bytes);
+    idx.build_table();
+}
+
+} // end namespace surf
@@ -0,0 +1,273 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "sdsl/suffix_arrays.hpp"
+
+namespace surf {
+
+//! Uncompressed copy of the text.
+/*!
+ * \tparam t_width Width of a symbol, 8 for byte alphabets and 0 for a
+ *                 bit-compressed copy of an integer text. Extracting from
+ *                 a byte copy is a memcpy.
+ */
+template<uint8_t t_width = 8>
+class text_plain {
+public:
+    typedef uint64_t size_type;
+
+private:
+    sdsl::int_vector<t_width> m_text;
+
+public:
+    text_plain() = default;
+
+    template<typename t_text>
+    explicit text_plain(const t_text& text) {
+        m_text = sdsl::int_vector<t_width>(text.size(), 0);
+        for (size_type i = 0; i < text.size(); ++i)
+            m_text[i] = text[i];
+        if (t_width == 0)
+            sdsl::util::bit_compress(m_text);
+    }
+
+    size_type size() const { return m_text.size(); }
+
+    uint64_t operator[](size_type i) const { return m_text[i]; }
+
+    //! Writes T[begin, end) to out.
+    template<typename t_out_iter>
+    void extract(size_type begin, size_type end, t_out_iter out) const {
+        extract(begin, end, out, std::integral_constant<bool, t_width == 8>());
+    }
+
+    size_type serialize(std::ostream& out,
+                        sdsl::structure_tree_node* v = nullptr,
+                        std::string name = "") const {
+        using namespace sdsl;
+        structure_tree_node* child = structure_tree::add_child(
+                                         v, name, util::class_name(*this));
+        size_type written_bytes = m_text.serialize(out, child, "text");
+        structure_tree::add_size(child, written_bytes);
+        return written_bytes;
+    }
+
+    void load(std::istream& in) {
+        m_text.load(in);
+    }
+
+private:
+    template<typename t_out_iter>
+    void extract(size_type begin, size_type end, t_out_iter out, std::true_type) const {
+        const uint8_t* text = (const uint8_t*)m_text.data();
+        std::copy(text + begin, text + end, out);
+    }
+
+    template<typename t_out_iter>
+    void extract(size_type begin, size_type end, t_out_iter out, std::false_type) const {
+        for (size_type i = begin; i < end; ++i, ++out)
+            *out = m_text[i];
+    }
+};
+
+//! Copy of the text in blocks with a local alphabet each.
+/*!
+ * The distinct symbols of a block are stored sorted in a dictionary and
+ * the block stores for each symbol its rank in the dictionary with as
+ * few bits as the dictionary needs. A block of natural language text
+ * uses some dozen distinct symbols, i.e. about 6 instead of 8 bits per
+ * symbol. Every symbol is addressable in constant time.
+ *
+ * \tparam t_block_size Number of symbols of a block.
+ */
+template<uint64_t t_block_size = 512>
+class text_blocks {
+    static_assert(t_block_size > 0, "Blocks have to be non-empty.");
+public:
+    typedef uint64_t size_type;
+
+private:
+    size_type             m_size = 0;
+    sdsl::bit_vector      m_codes;
+    sdsl::int_vector<>    m_code_start; // per block, bit offset in m_codes
+    sdsl::int_vector<8>   m_code_width; // per block
+    sdsl::int_vector<>    m_dict;       // sorted distinct symbols of each block
+    sdsl::int_vector<>    m_dict_start; // per block, offset in m_dict
+
+public:
+    text_blocks() = default;
+
+    template<typename t_text>
+    explicit text_blocks(const t_text& text) : m_size(text.size()) {
+        size_type blocks = (m_size + t_block_size - 1) / t_block_size;
+        std::vector<std::vector<uint64_t>> dicts(blocks);
+        m_code_start = sdsl::int_vector<>(blocks + 1, 0);
+        m_code_width = sdsl::int_vector<8>(blocks, 0);
+        m_dict_start = sdsl::int_vector<>(blocks + 1, 0);
+        for (size_type b = 0; b < blocks; ++b) {
+            auto& dict = dicts[b];
+            for (size_type i = b * t_block_size; i < std::min(m_size, (b + 1) * t_block_size); ++i)
+                dict.push_back(text[i]);
+            std::sort(dict.begin(), dict.end());
+            dict.erase(std::unique(dict.begin(), dict.end()), dict.end());
+            m_code_width[b] = dict.size() > 1 ? sdsl::bits::hi(dict.size() - 1) + 1 : 0;
+            m_code_start[b + 1] = m_code_start[b] + m_code_width[b] * t_block_size;
+            m_dict_start[b + 1] = m_dict_start[b] + dict.size();
+        }
+        m_codes = sdsl::bit_vector(m_code_start[blocks], 0);
+        m_dict = sdsl::int_vector<>(m_dict_start[blocks], 0);
+        for (size_type b = 0; b < blocks; ++b) {
+            const auto& dict = dicts[b];
+            std::copy(dict.begin(), dict.end(), m_dict.begin() + m_dict_start[b]);
+            uint8_t width = m_code_width[b];
+            if (width == 0)
+                continue;
+            for (size_type i = b * t_block_size; i < std::min(m_size, (b + 1) * t_block_size); ++i) {
+                uint64_t code = std::lower_bound(dict.begin(), dict.end(), (uint64_t)text[i])
+                                - dict.begin();
+                m_codes.set_int(m_code_start[b] + (i - b * t_block_size) * width, code, width);
+            }
+        }
+        sdsl::util::bit_compress(m_code_start);
+        sdsl::util::bit_compress(m_dict);
+        sdsl::util::bit_compress(m_dict_start);
+    }
+
+    size_type size() const { return m_size; }
+
+    uint64_t operator[](size_type i) const {
+        size_type b = i / t_block_size;
+        uint8_t width = m_code_width[b];
+        uint64_t code = width ? m_codes.get_int(m_code_start[b] + (i % t_block_size) * width,
+                                                width) : 0;
+        return m_dict[m_dict_start[b] + code];
+    }
+
+    //! Writes T[begin, end) to out, decoding block by block.
+    template<typename t_out_iter>
+    void extract(size_type begin, size_type end, t_out_iter out) const {
+        size_type i = begin;
+        while (i < end) {
+            size_type b = i / t_block_size;
+            size_type block_end = std::min(end, (b + 1) * t_block_size);
+            uint8_t width = m_code_width[b];
+            size_type dict = m_dict_start[b];
+            if (width == 0) {
+                uint64_t c = m_dict[dict];
+                for (; i < block_end; ++i, ++out)
+                    *out = c;
+                continue;
+            }
+            size_type bit = m_code_start[b] + (i % t_block_size) * width;
+            for (; i < block_end; ++i, ++out, bit += width)
+                *out = m_dict[dict + m_codes.get_int(bit, width)];
+        }
+    }
+
+    size_type serialize(std::ostream& out,
+                        sdsl::structure_tree_node* v = nullptr,
+                        std::string name = "") const {
+        using namespace sdsl;
+        structure_tree_node* child = structure_tree::add_child(
+                                         v, name, util::class_name(*this));
+        size_type written_bytes = 0;
+        written_bytes += write_member(m_size, out, child, "size");
+        written_bytes += m_codes.serialize(out, child, "codes");
+        written_bytes += m_code_start.serialize(out, child, "code_start");
+        written_bytes += m_code_width.serialize(out, child, "code_width");
+        written_bytes += m_dict.serialize(out, child, "dict");
+        written_bytes += m_dict_start.serialize(out, child, "dict_start");
+        structure_tree::add_size(child, written_bytes);
+        return written_bytes;
+    }
+
+    void load(std::istream& in) {
+        sdsl::read_member(m_size, in);
+        m_codes.load(in);
+        m_code_start.load(in);
+        m_code_width.load(in);
+        m_dict.load(in);
+        m_dict_start.load(in);
+    }
+};
+
+//! CSA which additionally stores a directly addressable copy of the text.
+/*!
+ * Extracting from the CSA costs one LF or psi step per symbol after an
+ * ISA lookup. doc() and the snippets of the indexes extract from the copy
+ * instead, which for a text_plain<8> is as fast as a memcpy. The copy
+ * costs additional space, text_blocks trades some of the speed for less.
+ *
+ * Usage in a config:
+ *   TEXT_CSA_TYPE=surf::csa_text<CSA_TYPE, surf::text_plain<8>>
+ *   INDEX_TYPE=surf::idx_nn<TEXT_CSA_TYPE, KTWOTREAP_TYPE>
+ * DF_TYPE keeps the plain CSA_TYPE.
+ *
+ * \tparam t_csa  The underlying CSA.
+ * \tparam t_text The copy of the text, text_plain or text_blocks.
+ */
+template<typename t_csa, typename t_text = text_plain<8>>
+class csa_text : public t_csa {
+public:
+    typedef typename t_csa::size_type size_type;
+    typedef t_text                    text_type;
+
+private:
+    text_type m_text;
+
+public:
+    csa_text() = default;
+
+    const text_type& text() const { return m_text; }
+
+    //! Copies the text, which has to be the one the CSA was built from.
+    template<typename t_vec>
+    void build_text(const t_vec& text) {
+        m_text = text_type(text);
+    }
+
+    size_type serialize(std::ostream& out,
+                        sdsl::structure_tree_node* v = nullptr,
+                        std::string name = "") const {
+        using namespace sdsl;
+        structure_tree_node* child = structure_tree::add_child(
+                                         v, name, util::class_name(*this));
+        size_type written_bytes = 0;
+        written_bytes += t_csa::serialize(out, child, "csa");
+        written_bytes += m_text.serialize(out, child, "text");
+        structure_tree::add_size(child, written_bytes);
+        return written_bytes;
+    }
+
+    void load(std::istream& in) {
+        t_csa::load(in);
+        m_text.load(in);
+    }
+};
+
+template<typename t_csa, typename t_text>
+void construct(csa_text<t_csa, t_text>& idx, const std::string& file,
+               sdsl::cache_config& cc, uint8_t num_bytes = 0) {
+    using namespace sdsl;
+    construct(static_cast<t_csa&>(idx), file, cc, num_bytes);
+    const uint8_t width = t_csa::alphabet_type::int_width;
+    int_vector<width> text;
+    load_from_cache(text, key_text_trait<width>::KEY_TEXT, cc);
+    idx.build_text(text);
+}
+
+//! T[begin..end], both inclusive, taken from the copy of the text.
+template<typename t_csa, typename t_text>
+typename t_csa::string_type extract(const csa_text<t_csa, t_text>& csa,
+                                    typename t_csa::size_type begin,
+                                    typename t_csa::size_type end) {
+    typedef typename t_csa::string_type string_type;
+    string_type res(end - begin + 1, (typename string_type::value_type)0);
+    csa.text().extract(begin, end + 1, res.begin());
+    return res;
+}
+
+} // end namespace surf
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "sdsl/int_vector.hpp"
+
+namespace surf {
+
+//! Documents of the arrows of a grid in x order, in blocks with a frame
+//! of reference each.
+/*!
+ * A block stores its smallest document and, for every arrow, the
+ * difference to it with as few bits as the largest difference needs.
+ * A block is never wider than the plain int_vector<> of the documents,
+ * and narrower where close doc ids are close in x order, e.g. after
+ * reordering the documents. Every document is addressable in constant
+ * time: the header record of its block and one read from the codes.
+ *
+ * This sits between the plain documents (offset_encoding=false with an
+ * int_vector<>) and the offset encoding, which is smaller but needs an
+ * SA access per document.
+ *
+ * \tparam t_block_size Number of documents of a block.
+ */
+template<uint64_t t_block_size = 64>
+class doc_blocks {
+    static_assert(t_block_size > 0, "Blocks have to be non-empty.");
+public:
+    typedef uint64_t size_type;
+    typedef uint64_t value_type;
+
+private:
+    size_type        m_size = 0;
+    sdsl::bit_vector m_codes;
+    // Per block one record of the bit offset of its codes in m_codes, its
+    // smallest document and the width of its codes, so a lookup reads
+    // one record and then the codes.
+    sdsl::bit_vector m_header;
+    uint8_t          m_start_width = 0;
+    uint8_t          m_base_width = 0;
+
+    static constexpr uint8_t code_width_bits = 7;
+
+    uint64_t record_width() const {
+        return (uint64_t)m_start_width + m_base_width + code_width_bits;
+    }
+
+public:
+    doc_blocks() = default;
+
+    template<typename t_vec>
+    explicit doc_blocks(const t_vec& docs) : m_size(docs.size()) {
+        size_type blocks = (m_size + t_block_size - 1) / t_block_size;
+        std::vector<uint64_t> start(blocks + 1, 0), base(blocks, 0);
+        std::vector<uint8_t> width(blocks, 0);
+        for (size_type b = 0; b < blocks; ++b) {
+            uint64_t lo = docs[b * t_block_size], hi = lo;
+            for (size_type i = b * t_block_size; i < std::min(m_size, (b + 1) * t_block_size); ++i) {
+                lo = std::min<uint64_t>(lo, docs[i]);
+                hi = std::max<uint64_t>(hi, docs[i]);
+            }
+            base[b] = lo;
+            width[b] = hi > lo ? sdsl::bits::hi(hi - lo) + 1 : 0;
+            start[b + 1] = start[b] + width[b] * t_block_size;
+        }
+        m_codes = sdsl::bit_vector(start[blocks], 0);
+        for (size_type b = 0; b < blocks; ++b) {
+            if (width[b] == 0)
+                continue;
+            for (size_type i = b * t_block_size; i < std::min(m_size, (b + 1) * t_block_size); ++i)
+                m_codes.set_int(start[b] + (i - b * t_block_size) * width[b],
+                                docs[i] - base[b], width[b]);
+        }
+        uint64_t max_base = blocks ? *std::max_element(base.begin(), base.end()) : 0;
+        m_start_width = sdsl::bits::hi(std::max<uint64_t>(1, start[blocks])) + 1;
+        m_base_width = sdsl::bits::hi(std::max<uint64_t>(1, max_base)) + 1;
+        m_header = sdsl::bit_vector(blocks * record_width(), 0);
+        for (size_type b = 0; b < blocks; ++b) {
+            uint64_t pos = b * record_width();
+            m_header.set_int(pos, start[b], m_start_width);
+            m_header.set_int(pos + m_start_width, base[b], m_base_width);
+            m_header.set_int(pos + m_start_width + m_base_width, width[b], code_width_bits);
+        }
+    }
+
+    size_type size() const { return m_size; }
+
+    bool empty() const { return m_size == 0; }
+
+    value_type operator[](size_type i) const {
+        size_type b = i / t_block_size;
+        uint64_t pos = b * record_width();
+        uint64_t base = m_header.get_int(pos + m_start_width, m_base_width);
+        uint8_t width = m_header.get_int(pos + m_start_width + m_base_width, code_width_bits);
+        if (width == 0)
+            return base;
+        uint64_t start = m_header.get_int(pos, m_start_width);
+        return base + m_codes.get_int(start + (i % t_block_size) * width, width);
+    }
+
+    size_type serialize(std::ostream& out,
+                        sdsl::structure_tree_node* v = nullptr,
+                        std::string name = "") const {
+        using namespace sdsl;
+        structure_tree_node* child = structure_tree::add_child(
+                                         v, name, util::class_name(*this));
+        size_type written_bytes = 0;
+        written_bytes += write_member(m_size, out, child, "size");
+        written_bytes += m_codes.serialize(out, child, "codes");
+        written_bytes += m_header.serialize(out, child, "header");
+        written_bytes += write_member(m_start_width, out, child, "start_width");
+        written_bytes += write_member(m_base_width, out, child, "base_width");
+        structure_tree::add_size(child, written_bytes);
+        return written_bytes;
+    }
+
+    void load(std::istream& in) {
+        sdsl::read_member(m_size, in);
+        m_codes.load(in);
+        m_header.load(in);
+        sdsl::read_member(m_start_width, in);
+        sdsl::read_member(m_base_width, in);
+    }
+};
+
+//! True if t_doc is the plain int_vector<> of the documents, which is
+//! stored in the cache without a type hash.
+template<typename t_doc>
+struct is_plain_doc_array : std::is_same<t_doc, sdsl::int_vector<>> {};
+
+} // end namespace surf
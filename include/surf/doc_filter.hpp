@@ -0,0 +1,121 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+#include "sdsl/int_vector.hpp"
+#include "sdsl/sd_vector.hpp"
+
+namespace surf {
+
+//! Restricts the documents a query may return.
+/*!
+ * A filter allows the documents of an id range [lo, hi] and, optionally,
+ * only those of them marked in a compressed bitvector, e.g. the documents
+ * of one source, and not those marked in an exclusion bitvector, e.g. the
+ * deleted documents of idx_delta. Indexes whose structures are ordered by document id
+ * (the WT over D of idx_d, the y-axis of idx_nn_k2_daat) skip whole
+ * subtrees outside the range; all indexes drop documents which are not
+ * allowed before they enter the top-k heap.
+ *
+ * Like a query_budget, a filter is attached to the current thread with a
+ * filter_scope. Iterators which compute their results lazily check the
+ * filter in next(), so they have to be consumed inside the scope.
+ */
+class doc_filter {
+    uint64_t m_lo = 0;
+    uint64_t m_hi = std::numeric_limits<uint64_t>::max();
+    uint64_t m_offset = 0; // added to the doc ids before they are checked
+    const sdsl::sd_vector<>* m_allowed = nullptr;
+    const sdsl::bit_vector*  m_excluded = nullptr;
+
+public:
+    doc_filter() = default;
+
+    //! Allows the documents lo to hi, both inclusive.
+    doc_filter(uint64_t lo, uint64_t hi) : m_lo(lo), m_hi(hi) {}
+
+    //! Allows the documents marked in allowed, which must outlive the filter.
+    explicit doc_filter(const sdsl::sd_vector<>& allowed)
+        : m_hi(allowed.size() ? allowed.size() - 1 : 0), m_allowed(&allowed) {
+        if (allowed.size() == 0)
+            m_lo = 1; // allows nothing
+    }
+
+    //! Allows the documents of [lo, hi] marked in allowed.
+    doc_filter(const sdsl::sd_vector<>& allowed, uint64_t lo, uint64_t hi)
+        : doc_filter(allowed) {
+        m_lo = std::max(m_lo, lo);
+        m_hi = std::min(m_hi, hi);
+    }
+
+    bool allows(uint64_t doc) const {
+        doc += m_offset;
+        return m_lo <= doc and doc <= m_hi and (m_allowed == nullptr or (*m_allowed)[doc])
+               and !(m_excluded and doc < m_excluded->size() and (*m_excluded)[doc]);
+    }
+
+    //! Smallest allowed local doc id, see shifted().
+    uint64_t lo() const {
+        return m_lo > m_offset ? m_lo - m_offset : 0;
+    }
+
+    //! Largest allowed local doc id. Check excludes_all() first.
+    uint64_t hi() const {
+        return m_hi < m_offset ? 0 : m_hi - m_offset;
+    }
+
+    //! True if none of the local doc ids 0 to docs-1 is allowed.
+    bool excludes_all(uint64_t docs) const {
+        return m_lo > m_hi or m_hi < m_offset or docs == 0 or lo() >= docs;
+    }
+
+    //! The filter for a part of the collection whose doc 0 is doc offset.
+    doc_filter shifted(uint64_t offset) const {
+        doc_filter f = *this;
+        f.m_offset += offset;
+        return f;
+    }
+
+    //! The filter without the documents marked in excluded, which must
+    //! outlive the filter. Ids beyond its end are not excluded. Replaces
+    //! the exclusions of this filter.
+    doc_filter excluding(const sdsl::bit_vector* excluded) const {
+        doc_filter f = *this;
+        f.m_excluded = excluded;
+        return f;
+    }
+
+    //! Filter of the query the current thread is answering, if any.
+    static const doc_filter*& current() {
+        static thread_local const doc_filter* filter = nullptr;
+        return filter;
+    }
+};
+
+//! Attaches a filter to the current thread for the lifetime of the scope.
+class filter_scope {
+    const doc_filter* m_prev;
+public:
+    explicit filter_scope(const doc_filter& filter) : m_prev(doc_filter::current()) {
+        doc_filter::current() = &filter;
+    }
+    ~filter_scope() {
+        doc_filter::current() = m_prev;
+    }
+    filter_scope(const filter_scope&) = delete;
+    filter_scope& operator=(const filter_scope&) = delete;
+};
+
+//! True if filter is null or allows doc.
+inline bool doc_allowed(const doc_filter* filter, uint64_t doc) {
+    return filter == nullptr or filter->allows(doc);
+}
+
+//! True if the filter of the current query allows doc.
+inline bool doc_allowed(uint64_t doc) {
+    return doc_allowed(doc_filter::current(), doc);
+}
+
+} // end namespace surf
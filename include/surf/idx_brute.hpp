@@ -2,12 +2,14 @@
 
 #include <algorithm>
 #include <limits>
+#include <memory>
 #include <queue>
 #include <set>
 
 #include "sdsl/int_vector.hpp"
 #include "sdsl/sdsl_concepts.hpp"
 #include "sdsl/suffix_trees.hpp"
+#include "surf/snippets.hpp"
 #include "surf/util.hpp"
 #include "surf/topk_interface.hpp"
 
@@ -28,23 +30,37 @@ public:
 private:
     using token_type = typename topk_interface::token_type;
 
-    csa_type m_csa;
+    std::shared_ptr<const csa_type> m_csa = std::make_shared<csa_type>(); // may be shared, see load()
     sdsl::rrr_vector<> m_doc_splitters;
     sdsl::rrr_vector<>::rank_1_type m_doc_splitters_rank;
-    topk_result_set m_results;
+    sdsl::rrr_vector<>::select_1_type m_doc_splitters_select;
 
 public:
+    const csa_type& csa() const {
+        return *m_csa;
+    }
+
     void load(sdsl::cache_config& cc) {
-        load_from_cache(m_csa, surf::KEY_CSA, cc, true);
+        auto csa = std::make_shared<csa_type>();
+        load_from_cache(*csa, surf::KEY_CSA, cc, true);
+        load(cc, std::move(csa));
+    }
+
+    //! Loads the index with a CSA of the collection which is loaded
+    //! already, e.g. the one idx_planner shares between its indexes.
+    void load(sdsl::cache_config& cc, std::shared_ptr<const csa_type> csa) {
+        m_csa = std::move(csa);
         load_from_cache(m_doc_splitters, surf::KEY_DOCBORDER, cc, true);
         load_from_cache(m_doc_splitters_rank, surf::KEY_DOCBORDER_RANK, cc, true);
         m_doc_splitters_rank.set_vector(&m_doc_splitters);
+        // The select structure of an rrr_vector has no state of its own.
+        m_doc_splitters_select.set_vector(&m_doc_splitters);
     }
 
     std::unique_ptr<typename topk_interface::iter> topk(
         size_t k, const token_type* begin, const token_type* end,
         bool multi_occ = false, bool only_match = false) override {
-        auto occs = locate(m_csa, begin, end);
+        auto occs = locate(*m_csa, begin, end);
 
         std::map<uint64_t, double> occs_by_doc;
         for (auto pos : occs) {
@@ -53,11 +69,11 @@ public:
             occs_by_doc[doc] += 1;
         }
 
-        m_results.clear();
+        topk_result_set results;
         for (auto it : occs_by_doc)
-            if (!multi_occ || it.second > 1)
-                m_results.emplace_back(it.first, it.second);
-        return sort_topk_results<token_type>(&m_results);
+            if ((!multi_occ || it.second > 1) && !this->is_excluded(it.first))
+                results.emplace_back(it.first, it.second);
+        return sort_topk_results<token_type>(std::move(results), this, {begin, end});
     }
 
     std::unique_ptr<typename topk_interface::iter> topk_intersect(
@@ -67,11 +83,11 @@ public:
 
         bool first = true;
         for (const auto& q : query) {
-            auto occs = locate(m_csa, q.first, q.second);
+            auto occs = locate(*m_csa, q.first, q.second);
             std::map<uint64_t, double> by_doc_new;
             for (auto pos : occs) {
                 auto doc = m_doc_splitters_rank(pos);
-                if (first || by_doc.count(doc))
+                if ((first && !this->is_excluded(doc)) || by_doc.count(doc))
                     by_doc_new[doc] += 1;
             }
             std::vector<uint64_t> erase_docs;
@@ -88,27 +104,70 @@ public:
             first = false;
         }
 
-        m_results = topk_result_set(by_doc.begin(), by_doc.end());
-        return sort_topk_results<token_type>(&m_results);
+        return sort_topk_results<token_type>(
+                topk_result_set(by_doc.begin(), by_doc.end()), this, this->first_term(query));
+    }
+
+    std::unique_ptr<typename topk_interface::iter> topk_union(
+        size_t k, const typename topk_interface::intersect_query& query,
+        bool multi_occ = false, bool only_match = false) override {
+        std::map<uint64_t, double> by_doc;
+
+        for (const auto& q : query) {
+            auto occs = locate(*m_csa, q.first, q.second);
+            std::map<uint64_t, double> by_doc_term;
+            for (auto pos : occs)
+                by_doc_term[m_doc_splitters_rank(pos)] += 1;
+            for (const auto& it : by_doc_term)
+                if ((!multi_occ || it.second > 1) && !this->is_excluded(it.first))
+                    by_doc[it.first] += it.second;
+        }
+
+        return sort_topk_results<token_type>(
+                topk_result_set(by_doc.begin(), by_doc.end()), this, this->first_term(query));
+    }
+
+    bool supports_intersect() const override {
+        return true;
+    }
+
+    bool supports_union() const override {
+        return true;
+    }
+
+    std::vector<typename topk_interface::snippet_type>
+    extract_docs(const std::vector<uint64_t>& docs, size_t k,
+                 const typename topk_interface::pattern_type& pattern) const override {
+        return extract_snippets(*m_csa, m_doc_splitters_rank, m_doc_splitters_select,
+                                docs, k, pattern);
+    }
+
+    std::vector<std::vector<uint64_t>>
+    locate_docs(const std::vector<uint64_t>& docs, size_t max_positions,
+                const typename topk_interface::pattern_type& pattern) const override {
+        return doc_positions(*m_csa, m_doc_splitters_rank, m_doc_splitters_select, docs, max_positions, pattern);
     }
 
     void mem_info() const { }
 
     uint64_t doc_cnt() const {
-        return m_doc_splitters_rank(m_csa.size());
+        return m_doc_splitters_rank(m_csa->size());
     }
 
     uint64_t word_cnt() const {
-        return m_csa.size() - doc_cnt();
+        return m_csa->size() - doc_cnt();
     }
 
+    // write_csa is false if the CSA is shared and written once by the
+    // owner, see idx_planner.
     size_type serialize(std::ostream& out,
                         structure_tree_node* v = nullptr,
-                        std::string name = "") const {
+                        std::string name = "", bool write_csa = true) const {
         sdsl::structure_tree_node* child =
             sdsl::structure_tree::add_child(v, name, util::class_name(*this));
         size_type written_bytes = 0;
-        written_bytes += m_csa.serialize(out, child, "CSA");
+        if (write_csa)
+            written_bytes += m_csa->serialize(out, child, "CSA");
         written_bytes += m_doc_splitters.serialize(out, child, "DOCBORDER");
         written_bytes += m_doc_splitters_rank.serialize(out, child,
                          "DOCBORDER_RANK");
@@ -4,9 +4,12 @@
 #include "surf/df_sada.hpp"
 #include "surf/rank_functions.hpp"
 #include "surf/construct_col_len.hpp"
+#include "surf/construct_doc_border.hpp"
+#include "surf/snippets.hpp"
 #include <algorithm>
 #include <limits>
 #include <queue>
+#include <type_traits>
 
 namespace surf{
 
@@ -72,6 +75,7 @@ struct s_state_t{
  *   - CSA over the collection concatenation
  *   - document frequency structure
  *   - a WT over the D array
+ *   - the document borders, to extract snippets
  */
 template<typename t_csa,
          typename t_wtd,
@@ -86,6 +90,8 @@ public:
     typedef typename wtd_type::node_type node_type;
     typedef t_df     df_type;
     typedef t_ranker ranker_type;
+    typedef sdsl::sd_vector<>               border_type;
+    typedef border_type::select_1_type      border_select_type;
     typedef typename t_csa::alphabet_category          alphabet_category;
     using topk_interface = typename topk_index_by_alphabet<alphabet_category>::type;
 public:
@@ -94,16 +100,45 @@ public:
     df_type     m_df;
     doc_perm    m_docperm;
     ranker_type m_ranker;
-    topk_result_set m_results;
+    border_type m_border;
+    border_select_type m_border_select;
 
     using token_type = typename topk_interface::token_type;
     using state_type = s_state_t<typename t_wtd::node_type, token_type>;
+    // Only rank_freq ranks by frequencies, the other rankers score.
+    using compact_weight_type = typename std::conditional<
+        std::is_same<t_ranker, rank_freq>::value, uint32_t, float>::type;
 public:
 
     //result search(const std::vector<query_token>& qry,size_t k,bool ranked_and = false,bool profile = false) const {
     std::unique_ptr<typename topk_interface::iter> topk_intersect(
             size_t k, const typename topk_interface::intersect_query& qry,
             bool multi_occ = false, bool only_match = false) override
+    {
+        return search(k, qry, multi_occ, true);
+    }
+
+    std::unique_ptr<typename topk_interface::iter> topk_union(
+            size_t k, const typename topk_interface::intersect_query& qry,
+            bool multi_occ = false, bool only_match = false) override
+    {
+        return search(k, qry, multi_occ, false);
+    }
+
+    bool supports_intersect() const override {
+        return true;
+    }
+
+    bool supports_union() const override {
+        return true;
+    }
+
+    // Traverses the WT over D and scores each node by the query terms
+    // which occur below it. With ranked_and, nodes missing a term are
+    // dropped; otherwise they are scored by the terms they contain.
+    std::unique_ptr<typename topk_interface::iter> search(
+            size_t k, const typename topk_interface::intersect_query& qry,
+            bool multi_occ, bool ranked_and)
     {
         /*
         if (multi_occ) {
@@ -117,7 +152,7 @@ public:
         std::vector<term_info<token_type>*> term_ptrs;
         std::vector<range_type> ranges;
 
-        m_results.clear();
+        topk_result_set results;
 
         for (size_t i=0; i<qry.size(); ++i){
             size_type sp=1, ep=0;
@@ -138,14 +173,19 @@ public:
         }
         double initial_term_num = terms.size();
 
-        bool ranked_and = true;
+        // The WT over D is ordered by document, so subtrees outside the
+        // doc range of the filter are skipped.
+        const doc_filter* filter = doc_filter::current();
         auto push_node =
-            [this,&multi_occ,&initial_term_num,&ranked_and]
+            [this,&multi_occ,&initial_term_num,&ranked_and,filter]
                 (pq_type& pq,
                 const std::vector<term_info<token_type>*>& t_ptrs,node_type& v,
                 std::vector<range_type>& r,
                 pq_min_type& pq_min, const size_t& k) {
             auto min_idx = m_wtd.sym(v) << (m_wtd.max_level - v.level);
+            auto max_idx = min_idx + (1ULL << (m_wtd.max_level - v.level)) - 1;
+            if (filter and (max_idx < filter->lo() or min_idx > filter->hi()))
+                return;
             auto min_doc_len = m_ranker.doc_length(m_docperm.len2id[min_idx]);
             state_type t; // new state
             t.v = v;
@@ -154,9 +194,10 @@ public:
 
             bool eval = false;
             bool is_leaf = m_wtd.is_leaf(v);
+            if (is_leaf and this->is_excluded(m_wtd.sym(v)))
+                return;
             for (size_t i = 0; i < r.size(); ++i){
                 if ( !empty(r[i]) ){
-                    eval = true;
                     t.r.push_back(r[i]);
                     t.t_ptrs.push_back(t_ptrs[i]);
 
@@ -169,8 +210,15 @@ public:
                                  is_leaf
                                );
                     if (multi_occ && score > 0.9 && score < 1.1) {
-                        t.score += -1e9;
+                        if ( ranked_and ){
+                            eval = true;
+                            t.score += -1e9;
+                        } else { // single occurrences do not count
+                            t.r.pop_back();
+                            t.t_ptrs.pop_back();
+                        }
                     } else {
+                        eval = true;
                         t.score += score;
                     }
                 } else if ( ranked_and ){
@@ -199,15 +247,17 @@ public:
 
         pq_min_type pq_min;
         pq_type pq;
+        if (filter and filter->excludes_all(1ULL << m_wtd.max_level))
+            return sort_topk_results<token_type>(std::move(results), this, this->first_term(qry));
         pq.emplace(max_score, m_wtd.root(), term_ptrs, ranges);
 
-        while ( !pq.empty() and m_results.size() < k ) {
+        while ( !pq.empty() and results.size() < k ) {
             state_type s = pq.top();
             pq.pop();
             if ( m_wtd.is_leaf(s.v) ){
                 // TODO(niklasb) why don't we need this?
-                //m_results.emplace_back(m_docperm.len2id[m_wtd.sym(s.v)], s.score);
-                m_results.emplace_back(m_wtd.sym(s.v), s.score);
+                //results.emplace_back(m_docperm.len2id[m_wtd.sym(s.v)], s.score);
+                results.emplace_back(m_wtd.sym(s.v), s.score);
             } else {
 //fast_expand:
                 auto exp_v = m_wtd.expand(s.v);
@@ -230,7 +280,7 @@ public:
                 }
             }
         }
-        return sort_topk_results<token_type>(&m_results);
+        return sort_topk_results<token_type>(std::move(results), this, this->first_term(qry));
     }
 
     std::unique_ptr<typename topk_interface::iter> topk(
@@ -246,6 +296,9 @@ public:
         load_from_cache(m_wtd, KEY_WTD, cc, true);
         load_from_cache(m_df, KEY_SADADF, cc, true);
         load_from_cache(m_docperm, KEY_DOCPERM, cc);
+        load_from_cache(m_border, KEY_DOCBORDER, cc, true);
+        load_from_cache(m_border_select, KEY_DOCBORDER_SELECT, cc, true);
+        m_border_select.set_vector(&m_border);
         //std::cout << "loading ranker" << std::endl;
         m_ranker = ranker_type(cc);
         //std::cout << "done loading ranker" << std::endl;
@@ -258,10 +311,46 @@ public:
         written_bytes += m_wtd.serialize(out, child, "WTD");
         written_bytes += m_df.serialize(out, child, "DF");
         written_bytes += m_docperm.serialize(out, child, "DOCPERM");
+        written_bytes += m_border.serialize(out, child, "BORDER");
+        written_bytes += m_border_select.serialize(out, child, "BORDER_SELECT");
         structure_tree::add_size(child, written_bytes);
         return written_bytes;
     }
 
+    // The WT over D locates the first occurrence of the pattern in each
+    // document exactly, with one rank, one select and one SA lookup.
+    std::vector<typename topk_interface::snippet_type>
+    extract_docs(const std::vector<uint64_t>& docs, size_t k,
+                 const typename topk_interface::pattern_type& pattern) const override {
+        auto sa = snippet_range(m_csa, pattern);
+        std::vector<uint64_t> occs(docs.size(), no_occurrence);
+        for (size_t i = 0; i < docs.size() and !empty(sa); ++i) {
+            auto before = m_wtd.rank(sa[0], docs[i]);
+            if (before < m_wtd.rank(sa[1] + 1, docs[i]))
+                occs[i] = m_csa[m_wtd.select(before + 1, docs[i])];
+        }
+        return extract_windows<token_type>(m_csa, m_border_select, docs, occs, pattern.len, k);
+    }
+
+    // The WT over D selects the SA entries of each document in the
+    // interval, so only the returned occurrences are located.
+    std::vector<std::vector<uint64_t>>
+    locate_docs(const std::vector<uint64_t>& docs, size_t max_positions,
+                const typename topk_interface::pattern_type& pattern) const override {
+        auto sa = snippet_range(m_csa, pattern);
+        std::vector<std::vector<uint64_t>> res(docs.size());
+        for (size_t i = 0; i < docs.size() and !empty(sa); ++i) {
+            auto before = m_wtd.rank(sa[0], docs[i]);
+            auto cnt = std::min<uint64_t>(m_wtd.rank(sa[1] + 1, docs[i]) - before,
+                                          max_positions);
+            uint64_t doc_begin = doc_span(m_border_select, docs[i]).first;
+            for (uint64_t j = 1; j <= cnt; ++j)
+                res[i].push_back(m_csa[m_wtd.select(before + j, docs[i])] - doc_begin);
+            std::sort(res[i].begin(), res[i].end());
+        }
+        return res;
+    }
+
     void mem_info(){
         std::cout << sdsl::size_in_bytes(m_csa) << ";"; // CSA
         std::cout << sdsl::size_in_bytes(m_wtd) << ";"; // WTD^\ell
@@ -313,6 +402,20 @@ void construct(idx_d<t_csa,t_wtd,t_df,t_ranker>& idx,
         construct(df, "", cc, 0);
         store_to_cache(df, KEY_SADADF, cc, true);
     }
+    cout<<"...DOC_BORDER"<<endl;
+    typedef typename idx_d<t_csa,t_wtd,t_df,t_ranker>::border_type border_type;
+    typedef typename idx_d<t_csa,t_wtd,t_df,t_ranker>::border_select_type border_select_type;
+    if (!cache_file_exists<border_type>(KEY_DOCBORDER, cc) or
+        !cache_file_exists<border_select_type>(KEY_DOCBORDER_SELECT, cc))
+    {
+        construct_doc_border<t_csa::alphabet_type::int_width>(cc);
+        bit_vector doc_border;
+        load_from_cache(doc_border, KEY_DOCBORDER, cc);
+        border_type sd_doc_border(doc_border);
+        store_to_cache(sd_doc_border, KEY_DOCBORDER, cc, true);
+        border_select_type doc_border_select(&sd_doc_border);
+        store_to_cache(doc_border_select, KEY_DOCBORDER_SELECT, cc, true);
+    }
 }
 
 } // end namespace surf
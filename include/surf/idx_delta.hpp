@@ -0,0 +1,554 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "sdsl/int_vector.hpp"
+#include "surf/compact_result.hpp"
+#include "surf/config.hpp"
+#include "surf/topk_interface.hpp"
+#include "surf/util.hpp"
+
+namespace surf {
+
+//! Index which accepts new and deleted documents without a rebuild.
+/*!
+ * New documents go into a small delta index of type t_delta which is
+ * rebuilt from the added documents only. Queries ask the base and the
+ * delta index and merge their top-k results. Deleted documents are marked
+ * in a tombstone bitvector. They and the documents of set_excluded_docs()
+ * are passed to the base and the delta with the doc_filter of each query,
+ * so both skip them while they search and return exactly k results.
+ *
+ * merge() builds a new base index from the text of the base and of the
+ * delta, while queries continue on the old one, and swaps it in. The
+ * documents of the delta keep their ids, and so do deleted documents,
+ * of which the new base only keeps the first token. Each state of the
+ * index is an immutable snapshot; queries and updates may run
+ * concurrently, updates are serialized.
+ *
+ * The index of the collection itself is generation 0. The base of
+ * generation g > 0 and the deltas are collections of their own in
+ * index/delta/base_<g> and index/delta/delta_<g>_<number of docs>. A
+ * directory is removed once a newer snapshot replaced it and the last
+ * query on an older one is done. The tombstones and then the manifest
+ * are replaced atomically, so the manifest never refers to documents or
+ * directories which are not stored yet.
+ *
+ * \tparam t_base  Index type of the base.
+ * \tparam t_delta Index type of the delta, e.g. idx_brute.
+ */
+template<typename t_base, typename t_delta = t_base>
+class idx_delta : public t_base::topk_interface {
+    static_assert(std::is_same<typename t_base::topk_interface,
+                               typename t_delta::topk_interface>::value,
+                  "base and delta index have to use the same alphabet.");
+public:
+    using base_type = t_base;
+    using delta_type = t_delta;
+    using alphabet_category = typename t_base::alphabet_category;
+    using topk_interface = typename t_base::topk_interface;
+    using token_type = typename topk_interface::token_type;
+    using size_type = sdsl::int_vector<>::size_type;
+    using compact_weight_type = typename std::common_type<
+        typename compact_weight<t_base>::type, typename compact_weight<t_delta>::type>::type;
+    static constexpr bool int_alphabet = std::is_same<alphabet_category, sdsl::int_alphabet_tag>::value;
+    using text_type = typename std::conditional<int_alphabet, sdsl::int_vector<>, sdsl::int_vector<8>>::type;
+
+private:
+    // Directory of a base or delta index, removed with the last snapshot
+    // referring to it once it is obsolete.
+    struct index_dir {
+        std::string       path;
+        std::atomic<bool> obsolete{false};
+        explicit index_dir(std::string p) : path(std::move(p)) {}
+        ~index_dir() {
+            if (obsolete)
+                remove_directory(path);
+        }
+    };
+
+    struct snapshot {
+        uint64_t                 generation = 0;
+        uint64_t                 base_docs = 0;
+        uint64_t                 delta_docs = 0;
+        sdsl::cache_config       base_cc;
+        sdsl::cache_config       delta_cc;
+        std::shared_ptr<t_base>  base;
+        std::shared_ptr<t_delta> delta; // null if there are no new documents
+        std::shared_ptr<index_dir> base_files;  // null for generation 0
+        std::shared_ptr<index_dir> delta_files; // null if there is no delta
+        std::shared_ptr<const sdsl::bit_vector> deleted;
+        std::shared_ptr<const sdsl::bit_vector> excluded; // of set_excluded_docs()
+        std::shared_ptr<const sdsl::bit_vector> skipped;  // deleted or excluded, null if none
+    };
+
+    sdsl::cache_config              m_cc;
+    std::shared_ptr<const snapshot> m_state;
+    std::mutex                      m_update_mutex; // serializes updates
+    bool                            m_merging = false;
+
+    std::shared_ptr<const snapshot> state() const {
+        return std::atomic_load(&m_state);
+    }
+
+    // Computes the documents the queries on s skip. The indexes of a
+    // snapshot are shared, so the skipped documents are passed with each
+    // query instead of being set on them.
+    static void skip(snapshot& s) {
+        uint64_t docs = s.base_docs + s.delta_docs;
+        auto skipped = std::make_shared<sdsl::bit_vector>(docs, 0);
+        auto add = [&](const sdsl::bit_vector& marked) {
+            uint64_t n = std::min<uint64_t>(docs, marked.size());
+            for (uint64_t i = 0; i < n; i += 64) {
+                uint8_t len = std::min<uint64_t>(64, n - i);
+                skipped->set_int(i, skipped->get_int(i, len) | marked.get_int(i, len), len);
+            }
+        };
+        add(*s.deleted);
+        if (s.excluded)
+            add(*s.excluded);
+        if (sdsl::util::cnt_one_bits(*skipped) == 0)
+            s.skipped.reset();
+        else
+            s.skipped = skipped;
+    }
+
+    // Stores x under key in a temporary file and renames it, so a crash
+    // leaves either the old or the new version.
+    template<typename t_obj>
+    static void store_atomically(const t_obj& x, const std::string& key, sdsl::cache_config& cc) {
+        std::string file = sdsl::cache_file_name(key, cc);
+        std::string tmp = file + ".tmp";
+        if (!sdsl::store_to_file(x, tmp) or std::rename(tmp.c_str(), file.c_str()) != 0) {
+            perror("could not store the state of the delta index");
+            exit(EXIT_FAILURE);
+        }
+        cc.file_map[key] = file;
+    }
+
+    // Stores and swaps in s. The directories s does not use anymore are
+    // removed when the queries on the current snapshot are done.
+    void publish(std::shared_ptr<const snapshot> s) {
+        store_atomically(*s->deleted, KEY_TOMBSTONES, m_cc);
+        store_manifest(s->generation, s->base_docs, s->delta_docs, m_cc);
+        auto cur = state();
+        if (cur->base_files and cur->base_files != s->base_files)
+            cur->base_files->obsolete = true;
+        if (cur->delta_files and cur->delta_files != s->delta_files)
+            cur->delta_files->obsolete = true;
+        std::atomic_store(&m_state, std::move(s));
+    }
+
+    // Appends the first k results of it with doc_offset added to the ids.
+    static void collect(typename topk_interface::iter& it, size_t k, uint64_t doc_offset,
+                        topk_result_set& res) {
+        for (size_t n = 0; n < k and !it.done(); ++n) {
+            auto r = it.get();
+            r.first += doc_offset;
+            res.push_back(r);
+            if (n + 1 < k)
+                it.next();
+        }
+    }
+
+    template<typename t_query>
+    std::unique_ptr<typename topk_interface::iter> merge_results(
+        size_t k, t_query query, typename topk_interface::pattern_type pattern) {
+        auto s = state();
+        topk_result_set res;
+        const doc_filter* filter = doc_filter::current();
+        doc_filter base_filter = (filter ? *filter : doc_filter()).excluding(s->skipped.get());
+        {
+            std::unique_ptr<filter_scope> scope;
+            if (filter or s->skipped)
+                scope.reset(new filter_scope(base_filter));
+            collect(*query(*s->base, k), k, 0, res);
+        }
+        if (s->delta) {
+            // The delta sees the filter of the query in its own doc ids.
+            doc_filter delta_filter = base_filter.shifted(s->base_docs);
+            filter_scope scope(delta_filter);
+            if (!delta_filter.excludes_all(s->delta_docs))
+                collect(*query(*s->delta, k), k, s->base_docs, res);
+        }
+        auto it = sort_topk_results<token_type>(std::move(res));
+        return std::make_unique<vector_topk_iterator<token_type>>(topk_index<token_type>::take(*it, k),
+                                                                  this, std::move(pattern));
+    }
+
+    // Calls f(index, local doc ids) for the base and the delta part of
+    // docs of the current snapshot and returns the results in the order
+    // of docs. Documents beyond the snapshot get empty results.
+    template<typename t_res, typename t_fun>
+    std::vector<t_res> per_part(const std::vector<uint64_t>& docs, t_fun f) const {
+        auto s = state();
+        std::vector<t_res> res(docs.size());
+        std::vector<uint64_t> base_docs, delta_docs;
+        std::vector<size_t> base_pos, delta_pos;
+        for (size_t i = 0; i < docs.size(); ++i) {
+            if (docs[i] < s->base_docs) {
+                base_docs.push_back(docs[i]);
+                base_pos.push_back(i);
+            } else if (s->delta and docs[i] < s->base_docs + s->delta_docs) {
+                delta_docs.push_back(docs[i] - s->base_docs);
+                delta_pos.push_back(i);
+            }
+        }
+        auto base_res = f(*s->base, base_docs);
+        for (size_t j = 0; j < base_pos.size(); ++j)
+            res[base_pos[j]] = std::move(base_res[j]);
+        if (!delta_docs.empty()) {
+            auto delta_res = f(*s->delta, delta_docs);
+            for (size_t j = 0; j < delta_pos.size(); ++j)
+                res[delta_pos[j]] = std::move(delta_res[j]);
+        }
+        return res;
+    }
+
+    static std::string update_dir(const sdsl::cache_config& cc) {
+        return cc.dir + "/delta";
+    }
+
+    std::string base_dir(uint64_t generation) const {
+        return update_dir(m_cc) + "/base_" + std::to_string(generation);
+    }
+
+    std::string delta_dir(uint64_t generation, uint64_t docs) const {
+        return update_dir(m_cc) + "/delta_" + std::to_string(generation) + "_" + std::to_string(docs);
+    }
+
+    std::string dict_file() const {
+        return m_cc.dir + "/../" + DICT_FILENAME;
+    }
+
+    static text_type load_text(sdsl::cache_config& cc) {
+        text_type text;
+        sdsl::load_from_cache(text, int_alphabet ? sdsl::conf::KEY_TEXT_INT : sdsl::conf::KEY_TEXT, cc);
+        return text;
+    }
+
+    // Concatenates the documents of a and b. Both end with a 0.
+    static text_type concat(const text_type& a, const text_type& b) {
+        size_t a_len = a.empty() ? 0 : a.size() - 1;
+        text_type text(a_len + b.size(), 0, std::max(a.width(), b.width()));
+        std::copy(a.begin(), a.begin() + a_len, text.begin());
+        std::copy(b.begin(), b.end(), text.begin() + a_len);
+        return text;
+    }
+
+    // Keeps the first token of each deleted document, so the documents
+    // keep their ids while the text of deleted ones is dropped.
+    static text_type purge(const text_type& text, const sdsl::bit_vector& deleted) {
+        text_type res(text.size(), 0, text.width());
+        size_t len = 0;
+        uint64_t doc = 0;
+        bool first = true; // at the first token of a document
+        for (size_t i = 0; i < text.size(); ++i) {
+            bool is_deleted = doc < deleted.size() and deleted[doc];
+            if (!is_deleted or first or text[i] <= 1)
+                res[len++] = text[i];
+            first = text[i] == 1;
+            doc += text[i] == 1;
+        }
+        res.resize(len);
+        return res;
+    }
+
+    // Creates and loads a collection of the given text in dir. Files
+    // left in dir, e.g. by a crash during a build, are removed first.
+    template<typename t_idx>
+    static std::shared_ptr<t_idx> build(const std::string& dir, const text_type& text,
+                                        const std::string& dict, sdsl::cache_config& cc) {
+        remove_directory(dir);
+        create_collection<alphabet_category>(dir, text, dict);
+        cc = parse_collection<alphabet_category>(dir);
+        auto idx = std::make_shared<t_idx>();
+        construct(*idx, "", cc, int_alphabet ? 0 : 1);
+        idx->load(cc);
+        return idx;
+    }
+
+public:
+    static void store_manifest(uint64_t generation, uint64_t base_docs, uint64_t delta_docs,
+                               sdsl::cache_config& cc) {
+        sdsl::int_vector<64> manifest(3);
+        manifest[0] = generation;
+        manifest[1] = base_docs;
+        manifest[2] = delta_docs;
+        store_atomically(manifest, KEY_DELTA_MANIFEST, cc);
+    }
+
+    //! Number of documents in the base index and the delta.
+    uint64_t num_docs() const {
+        auto s = state();
+        return s->base_docs + s->delta_docs;
+    }
+
+    uint64_t generation() const {
+        return state()->generation;
+    }
+
+    bool is_deleted(uint64_t doc) const {
+        auto s = state();
+        return doc < s->deleted->size() and (*s->deleted)[doc];
+    }
+
+    // The exclusions become part of a new snapshot; queries running on
+    // an older one keep theirs. get_excluded_docs() is not set.
+    void set_excluded_docs(std::shared_ptr<const sdsl::bit_vector> excluded) override {
+        std::lock_guard<std::mutex> lock(m_update_mutex);
+        auto s = std::make_shared<snapshot>(*state());
+        s->excluded = std::move(excluded);
+        skip(*s);
+        std::atomic_store(&m_state, std::shared_ptr<const snapshot>(s));
+    }
+
+    // Merges keep the doc ids, so the snippets of results of an older
+    // snapshot are taken from the current one.
+    std::vector<typename topk_interface::snippet_type>
+    extract_docs(const std::vector<uint64_t>& docs, size_t k,
+                 const typename topk_interface::pattern_type& pattern) const override {
+        return per_part<typename topk_interface::snippet_type>(docs,
+        [&](const topk_interface& idx, const std::vector<uint64_t>& local_docs) {
+            return idx.extract_docs(local_docs, k, pattern);
+        });
+    }
+
+    std::vector<std::vector<uint64_t>>
+    locate_docs(const std::vector<uint64_t>& docs, size_t max_positions,
+                const typename topk_interface::pattern_type& pattern) const override {
+        return per_part<std::vector<uint64_t>>(docs,
+        [&](const topk_interface& idx, const std::vector<uint64_t>& local_docs) {
+            return idx.locate_docs(local_docs, max_positions, pattern);
+        });
+    }
+
+    std::unique_ptr<typename topk_interface::iter> topk(
+        size_t k, const token_type* begin, const token_type* end,
+        bool multi_occ = false, bool only_match = false) override {
+        return merge_results(k, [&](topk_interface& idx, size_t k_query) {
+            return idx.topk(k_query, begin, end, multi_occ, only_match);
+        }, {begin, end});
+    }
+
+    std::unique_ptr<typename topk_interface::iter> topk_intersect(
+        size_t k, const typename topk_interface::intersect_query& query,
+        bool multi_occ = false, bool only_match = false) override {
+        return merge_results(k, [&](topk_interface& idx, size_t k_query) {
+            return idx.topk_intersect(k_query, query, multi_occ, only_match);
+        }, topk_interface::first_term(query));
+    }
+
+    std::unique_ptr<typename topk_interface::iter> topk_union(
+        size_t k, const typename topk_interface::intersect_query& query,
+        bool multi_occ = false, bool only_match = false) override {
+        return merge_results(k, [&](topk_interface& idx, size_t k_query) {
+            return idx.topk_union(k_query, query, multi_occ, only_match);
+        }, topk_interface::first_term(query));
+    }
+
+    // The delta of the snapshot has to answer the query as well.
+    bool supports_intersect() const override {
+        auto s = state();
+        return s->base->supports_intersect() and (!s->delta or s->delta->supports_intersect());
+    }
+
+    bool supports_union() const override {
+        auto s = state();
+        return s->base->supports_union() and (!s->delta or s->delta->supports_union());
+    }
+
+    bool supports_singletons() const override {
+        auto s = state();
+        return s->base->supports_singletons() and (!s->delta or s->delta->supports_singletons());
+    }
+
+    //! Adds the documents of text to the delta index.
+    /*!
+     * \param text Documents in the format of a collection, each ending
+     *             with a 1 and the text with a 0. Integer texts have to use
+     *             the dictionary of the collection.
+     * \returns The id of the first added document.
+     */
+    uint64_t add_documents(const text_type& text) {
+        std::lock_guard<std::mutex> lock(m_update_mutex);
+        auto cur = state();
+        uint64_t docs = std::count(text.begin(), text.end(), 1);
+        if (docs == 0)
+            return num_docs();
+        auto s = std::make_shared<snapshot>(*cur);
+        text_type delta_text = cur->delta ? concat(load_text(s->delta_cc), text) : text;
+        s->delta_docs += docs;
+        s->delta_files = std::make_shared<index_dir>(delta_dir(s->generation, s->delta_docs));
+        s->delta = build<t_delta>(s->delta_files->path, delta_text, dict_file(), s->delta_cc);
+        auto deleted = std::make_shared<sdsl::bit_vector>(*cur->deleted);
+        deleted->resize(s->base_docs + s->delta_docs);
+        for (size_t i = cur->base_docs + cur->delta_docs; i < deleted->size(); ++i)
+            (*deleted)[i] = 0;
+        s->deleted = deleted;
+        skip(*s);
+        publish(s);
+        return cur->base_docs + cur->delta_docs;
+    }
+
+    //! Marks a document as deleted. Returns false if there is no such document.
+    bool remove_document(uint64_t doc) {
+        std::lock_guard<std::mutex> lock(m_update_mutex);
+        auto cur = state();
+        if (doc >= cur->base_docs + cur->delta_docs)
+            return false;
+        auto s = std::make_shared<snapshot>(*cur);
+        auto deleted = std::make_shared<sdsl::bit_vector>(*cur->deleted);
+        (*deleted)[doc] = 1;
+        s->deleted = deleted;
+        skip(*s);
+        publish(s);
+        return true;
+    }
+
+    //! Rebuilds the base index from the base and the delta and swaps it in.
+    /*!
+     * Queries and updates continue while the new base is built. Documents
+     * added in the meantime form the delta of the new generation.
+     * \returns false if there was nothing to merge or a merge is running.
+     */
+    bool merge() {
+        std::shared_ptr<const snapshot> old;
+        {
+            std::lock_guard<std::mutex> lock(m_update_mutex);
+            old = state();
+            if (m_merging or old->delta_docs == 0)
+                return false;
+            m_merging = true;
+        }
+        // Ends the merge however merge() returns, e.g. if a build throws.
+        struct merge_guard {
+            idx_delta* idx;
+            ~merge_guard() {
+                std::lock_guard<std::mutex> lock(idx->m_update_mutex);
+                idx->m_merging = false;
+            }
+        } guard{this};
+        auto base_cc = old->base_cc, delta_cc = old->delta_cc;
+        auto text = purge(concat(load_text(base_cc), load_text(delta_cc)), *old->deleted);
+        sdsl::cache_config new_base_cc;
+        auto base_files = std::make_shared<index_dir>(base_dir(old->generation + 1));
+        auto base = build<t_base>(base_files->path, text, dict_file(), new_base_cc);
+
+        std::lock_guard<std::mutex> lock(m_update_mutex);
+        auto cur = state();
+        auto s = std::make_shared<snapshot>(*cur);
+        s->generation = old->generation + 1;
+        s->base_docs = old->base_docs + old->delta_docs;
+        s->delta_docs = cur->delta_docs - old->delta_docs;
+        s->base_cc = new_base_cc;
+        s->base = base;
+        s->base_files = base_files;
+        s->delta.reset();
+        s->delta_files.reset();
+        if (s->delta_docs > 0) { // documents added during the merge
+            text_type delta_text = load_text(s->delta_cc);
+            size_t skip = 0;
+            for (size_t docs = 0; docs < old->delta_docs; ++skip)
+                docs += delta_text[skip] == 1;
+            text_type rest(delta_text.size() - skip, 0, delta_text.width());
+            std::copy(delta_text.begin() + skip, delta_text.end(), rest.begin());
+            s->delta_files = std::make_shared<index_dir>(delta_dir(s->generation, s->delta_docs));
+            s->delta = build<t_delta>(s->delta_files->path, rest, dict_file(), s->delta_cc);
+        }
+        skip(*s);
+        publish(s);
+        return true;
+    }
+
+    //! Runs merge() in a background thread.
+    std::future<bool> merge_async() {
+        return std::async(std::launch::async, [this]() { return merge(); });
+    }
+
+    void load(sdsl::cache_config& cc) {
+        m_cc = cc;
+        auto s = std::make_shared<snapshot>();
+        sdsl::int_vector<64> manifest;
+        sdsl::load_from_cache(manifest, KEY_DELTA_MANIFEST, cc);
+        s->generation = manifest[0];
+        s->base_docs = manifest[1];
+        s->delta_docs = manifest[2];
+        s->base_cc = cc;
+        if (s->generation > 0) {
+            s->base_files = std::make_shared<index_dir>(base_dir(s->generation));
+            s->base_cc = parse_collection<alphabet_category>(s->base_files->path);
+        }
+        s->base = std::make_shared<t_base>();
+        s->base->load(s->base_cc);
+        if (s->delta_docs > 0) {
+            s->delta_files = std::make_shared<index_dir>(delta_dir(s->generation, s->delta_docs));
+            s->delta_cc = parse_collection<alphabet_category>(s->delta_files->path);
+            s->delta = std::make_shared<t_delta>();
+            s->delta->load(s->delta_cc);
+        }
+        auto deleted = std::make_shared<sdsl::bit_vector>();
+        sdsl::load_from_cache(*deleted, KEY_TOMBSTONES, cc);
+        // The tombstones are stored first, they may cover documents the
+        // manifest does not count yet.
+        uint64_t stored = deleted->size();
+        deleted->resize(s->base_docs + s->delta_docs);
+        for (uint64_t i = stored; i < deleted->size(); ++i)
+            (*deleted)[i] = 0;
+        s->deleted = deleted;
+        skip(*s);
+        std::atomic_store(&m_state, std::shared_ptr<const snapshot>(s));
+    }
+
+    size_type serialize(std::ostream& out, sdsl::structure_tree_node* v = nullptr,
+                        std::string name = "") const {
+        using namespace sdsl;
+        auto s = state();
+        structure_tree_node* child = structure_tree::add_child(
+                                         v, name, util::class_name(*this));
+        size_type written_bytes = 0;
+        written_bytes += s->base->serialize(out, child, "BASE");
+        if (s->delta)
+            written_bytes += s->delta->serialize(out, child, "DELTA");
+        written_bytes += s->deleted->serialize(out, child, "TOMBSTONES");
+        structure_tree::add_size(child, written_bytes);
+        return written_bytes;
+    }
+
+    void mem_info() const {
+        auto s = state();
+        s->base->mem_info();
+        if (s->delta)
+            s->delta->mem_info();
+    }
+};
+
+template<typename t_base, typename t_delta>
+void construct(idx_delta<t_base, t_delta>& idx, const std::string& file,
+               sdsl::cache_config& cc, uint8_t num_bytes) {
+    using namespace sdsl;
+    using namespace std;
+    using idx_type = idx_delta<t_base, t_delta>;
+
+    t_base base;
+    construct(base, file, cc, num_bytes);
+    cout << "...DELTA" << endl;
+    create_directory(cc.dir + "/delta");
+    if (!cache_file_exists(KEY_DELTA_MANIFEST, cc)) {
+        typename idx_type::text_type text;
+        load_from_cache(text, idx_type::int_alphabet ? conf::KEY_TEXT_INT : conf::KEY_TEXT, cc);
+        uint64_t docs = std::count(text.begin(), text.end(), 1);
+        bit_vector deleted(docs, 0);
+        store_to_cache(deleted, KEY_TOMBSTONES, cc);
+        idx_type::store_manifest(0, docs, 0, cc);
+    }
+}
+
+} // end namespace surf
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "sdsl/int_vector.hpp"
+#include "sdsl/rank_support.hpp"
+#include "surf/compact_result.hpp"
+#include "surf/config.hpp"
+#include "surf/construct_doc_border.hpp"
+#include "surf/construct_invidx.hpp"
+#include "surf/impact_lists.hpp"
+#include "surf/topk_interface.hpp"
+
+namespace surf {
+
+//! Index of an integer collection which answers single-term queries from
+//! impact lists and all other queries with t_phrase_idx.
+/*!
+ * Most queries of word collections are single dictionary terms. The
+ * top-k documents of a term are a prefix of its impact list, which is
+ * read without touching the self-index. Patterns of several tokens,
+ * intersections and unions go to t_phrase_idx, e.g. an idx_nn_quantile,
+ * which also extracts the snippets and locates the occurrences of all
+ * results.
+ *
+ * \tparam t_phrase_idx Index of the phrase queries, over the same
+ *                      collection.
+ */
+template<typename t_phrase_idx>
+class idx_hybrid : public t_phrase_idx::topk_interface {
+    static_assert(std::is_same<typename t_phrase_idx::alphabet_category,
+                               sdsl::int_alphabet_tag>::value,
+                  "impact lists are built for integer collections.");
+public:
+    using phrase_index_type = t_phrase_idx;
+    using alphabet_category = typename t_phrase_idx::alphabet_category;
+    using topk_interface = typename t_phrase_idx::topk_interface;
+    using token_type = typename topk_interface::token_type;
+    using size_type = sdsl::int_vector<>::size_type;
+    using compact_weight_type = typename compact_weight<t_phrase_idx>::type;
+
+private:
+    t_phrase_idx m_phrase_idx;
+    impact_lists m_lists;
+
+public:
+    std::unique_ptr<typename topk_interface::iter> topk(
+        size_t k, const token_type* begin, const token_type* end,
+        bool multi_occ = false, bool only_match = false) override {
+        if (end - begin != 1)
+            return m_phrase_idx.topk(k, begin, end, multi_occ, only_match);
+        // The frequencies decrease along the list, so with multi_occ
+        // the results end at the first singleton.
+        topk_result_set res;
+        auto list = m_lists.list(*begin);
+        for (auto i = list.first; i < list.second and res.size() < k and budget_step(); ++i) {
+            uint64_t freq = m_lists.freq(i);
+            if (multi_occ and freq <= 1)
+                break;
+            if (!this->is_excluded(m_lists.doc(i)))
+                res.emplace_back(m_lists.doc(i), freq);
+        }
+        return std::make_unique<vector_topk_iterator<token_type>>(
+                   std::move(res), this, typename topk_interface::pattern_type(begin, end));
+    }
+
+    std::unique_ptr<typename topk_interface::iter> topk_intersect(
+        size_t k, const typename topk_interface::intersect_query& query,
+        bool multi_occ = false, bool only_match = false) override {
+        return m_phrase_idx.topk_intersect(k, query, multi_occ, only_match);
+    }
+
+    std::unique_ptr<typename topk_interface::iter> topk_union(
+        size_t k, const typename topk_interface::intersect_query& query,
+        bool multi_occ = false, bool only_match = false) override {
+        return m_phrase_idx.topk_union(k, query, multi_occ, only_match);
+    }
+
+    bool supports_intersect() const override {
+        return m_phrase_idx.supports_intersect();
+    }
+
+    bool supports_union() const override {
+        return m_phrase_idx.supports_union();
+    }
+
+    bool supports_singletons() const override {
+        return m_phrase_idx.supports_singletons();
+    }
+
+    void set_excluded_docs(std::shared_ptr<const sdsl::bit_vector> excluded) override {
+        topk_interface::set_excluded_docs(excluded);
+        m_phrase_idx.set_excluded_docs(excluded);
+    }
+
+    // Only the phrase index searches the CSA.
+    void set_interval_cache(std::shared_ptr<sa_interval_cache<token_type>> cache) override {
+        topk_interface::set_interval_cache(cache);
+        m_phrase_idx.set_interval_cache(std::move(cache));
+    }
+
+    // The results of the impact lists carry the tokens of the term,
+    // which the phrase index looks up in its CSA.
+    std::vector<typename topk_interface::snippet_type>
+    extract_docs(const std::vector<uint64_t>& docs, size_t k,
+                 const typename topk_interface::pattern_type& pattern) const override {
+        return m_phrase_idx.extract_docs(docs, k, pattern);
+    }
+
+    std::vector<std::vector<uint64_t>>
+    locate_docs(const std::vector<uint64_t>& docs, size_t max_positions,
+                const typename topk_interface::pattern_type& pattern) const override {
+        return m_phrase_idx.locate_docs(docs, max_positions, pattern);
+    }
+
+    const t_phrase_idx& phrase_index() const {
+        return m_phrase_idx;
+    }
+
+    const impact_lists& lists() const {
+        return m_lists;
+    }
+
+    void load(sdsl::cache_config& cc) {
+        m_phrase_idx.load(cc);
+        load_from_cache(m_lists, KEY_IMPACT_LISTS, cc, true);
+    }
+
+    size_type serialize(std::ostream& out, sdsl::structure_tree_node* v = nullptr,
+                        std::string name = "") const {
+        using namespace sdsl;
+        structure_tree_node* child = structure_tree::add_child(
+                                         v, name, util::class_name(*this));
+        size_type written_bytes = 0;
+        written_bytes += m_phrase_idx.serialize(out, child, "PHRASE_INDEX");
+        written_bytes += m_lists.serialize(out, child, "IMPACT_LISTS");
+        structure_tree::add_size(child, written_bytes);
+        return written_bytes;
+    }
+
+    void mem_info() const {
+        m_phrase_idx.mem_info();
+        std::cout << sdsl::size_in_bytes(m_lists) << std::endl; // IMPACT_LISTS
+    }
+};
+
+template<typename t_phrase_idx>
+void construct(idx_hybrid<t_phrase_idx>& idx, const std::string& file,
+               sdsl::cache_config& cc, uint8_t num_bytes) {
+    using namespace sdsl;
+    using namespace std;
+
+    construct(*make_unique<t_phrase_idx>(), file, cc, num_bytes);
+
+    cout << "...IMPACT_LISTS" << endl;
+    if (!cache_file_exists<impact_lists>(KEY_IMPACT_LISTS, cc)) {
+        int_vector<> ids, sp, ep;
+        load_term_ranges(ids, sp, ep, cc);
+        construct_doc_border<int_alphabet_tag::WIDTH>(cc);
+        bit_vector doc_border;
+        load_from_cache(doc_border, KEY_DOCBORDER, cc);
+        rank_support_v<> doc_border_rank(&doc_border);
+        int_vector_buffer<> sa(cache_file_name(conf::KEY_SA, cc));
+        impact_lists lists(ids, sp, ep, sa, doc_border_rank);
+        store_to_cache(lists, KEY_IMPACT_LISTS, cc, true);
+    }
+}
+
+} // end namespace surf
@@ -0,0 +1,340 @@
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "sdsl/int_vector.hpp"
+#include "surf/block_postings.hpp"
+#include "surf/config.hpp"
+#include "surf/construct_col_len.hpp"
+#include "surf/construct_invidx.hpp"
+#include "surf/rank_functions.hpp"
+#include "surf/topk_interface.hpp"
+
+namespace surf {
+
+//! Inverted index over the terms of an integer collection.
+/*!
+ * Every term has a list of its documents and frequencies in blocks with
+ * block-max metadata, see block_postings. Unions are answered with
+ * Block-Max WAND: the documents are visited in increasing order and a
+ * document is only scored if the block-max bounds of the lists it may
+ * occur in exceed the k-th score found so far; the other lists skip
+ * whole blocks without decoding them. Intersections are evaluated
+ * document at a time over all lists, shortest first, and skip the blocks
+ * whose bounds can not beat the k-th score.
+ *
+ * Only single terms are indexed: a pattern of more than one token
+ * matches no document. Snippets and occurrences are not available.
+ *
+ * Documents with the same score are ranked by increasing id. Documents
+ * whose score bound only ties the k-th score are skipped, so ties are
+ * resolved in the order of the index, which is the order of the
+ * collection unless url2id.txt reorders the documents.
+ *
+ * \tparam t_ranker     Scoring function, rank_freq ranks by frequency.
+ * \tparam t_block_size Number of postings of a block.
+ */
+template<typename t_ranker = rank_freq, uint64_t t_block_size = 128>
+class idx_invidx : public topk_index_by_alphabet<sdsl::int_alphabet_tag>::type {
+public:
+    using alphabet_category = sdsl::int_alphabet_tag;
+    using topk_interface = typename topk_index_by_alphabet<alphabet_category>::type;
+    using token_type = typename topk_interface::token_type;
+    using size_type = sdsl::int_vector<>::size_type;
+    using ranker_type = t_ranker;
+    using postings_type = block_postings<t_block_size>;
+    // Only rank_freq ranks by frequencies, the other rankers score.
+    using compact_weight_type = typename std::conditional<
+        std::is_same<t_ranker, rank_freq>::value, uint32_t, float>::type;
+
+private:
+    postings_type      m_postings;
+    sdsl::int_vector<> m_doc_map; // doc id of the index to doc id of the collection
+    ranker_type        m_ranker;
+
+    static constexpr uint64_t end_doc = postings_type::end_doc;
+
+    // The cursor of a query term with the statistics of its score.
+    struct term_cursor {
+        typename postings_type::cursor c;
+        double   df = 0, F_t = 0;
+        double   max_score = 0;
+        uint64_t bound_block = end_doc; // block of bound_score
+        double   bound_score = 0;
+    };
+
+    // The best k results of a query, in a min-heap.
+    class result_heap {
+        size_t          m_k;
+        topk_result_set m_heap;
+
+        static bool better(const topk_result& a, const topk_result& b) {
+            return std::make_pair(-a.second, a.first) < std::make_pair(-b.second, b.first);
+        }
+
+    public:
+        explicit result_heap(size_t k) : m_k(k) {}
+
+        //! Score a document has to exceed to enter the results.
+        double threshold() const {
+            return m_heap.size() < m_k ? 0 : m_heap.front().second;
+        }
+
+        void add(const topk_result& res) {
+            if (m_k == 0 or res.second <= 0)
+                return;
+            if (m_heap.size() == m_k) {
+                if (!better(res, m_heap.front()))
+                    return;
+                std::pop_heap(m_heap.begin(), m_heap.end(), better);
+                m_heap.pop_back();
+            }
+            m_heap.push_back(res);
+            std::push_heap(m_heap.begin(), m_heap.end(), better);
+        }
+
+        topk_result_set result() {
+            return std::move(m_heap);
+        }
+    };
+
+    // Term id of a pattern; patterns of several tokens have no postings.
+    uint64_t term_id(const token_type* begin, const token_type* end) const {
+        return end - begin == 1 ? *begin : m_postings.terms();
+    }
+
+    std::vector<term_cursor> open(const typename topk_interface::intersect_query& query) const {
+        std::vector<term_cursor> terms(query.size());
+        for (size_t i = 0; i < query.size(); ++i) {
+            uint64_t t = term_id(query[i].first, query[i].second);
+            terms[i].c = m_postings.open(t);
+            terms[i].df = m_postings.df(t);
+            terms[i].F_t = m_postings.F_t(t);
+            terms[i].max_score = bound(terms[i], m_postings.max_freq(t), m_postings.min_len(t));
+        }
+        return terms;
+    }
+
+    double bound(const term_cursor& t, uint64_t freq, uint64_t doc_len) const {
+        return m_ranker.calculate_docscore(1, freq, t.df, t.F_t, doc_len, true);
+    }
+
+    // Bound of the scores in the shallow block of t.
+    double block_bound(term_cursor& t) const {
+        if (t.bound_block != t.c.shallow_block()) {
+            t.bound_block = t.c.shallow_block();
+            t.bound_score = bound(t, t.c.block_max_freq(), t.c.block_min_len());
+        }
+        return t.bound_score;
+    }
+
+    // Score of the current document of t, zero if it does not count.
+    double score(const term_cursor& t, bool multi_occ) const {
+        if (multi_occ and t.c.freq() <= 1)
+            return 0;
+        return m_ranker.calculate_docscore(1, t.c.freq(), t.df, t.F_t,
+                                           m_ranker.doc_length(m_doc_map[t.c.doc()]), true);
+    }
+
+    std::unique_ptr<typename topk_interface::iter> results(
+            result_heap& heap, const typename topk_interface::intersect_query& query) {
+        auto res = heap.result();
+        for (auto& r : res)
+            r.first = m_doc_map[r.first];
+        return sort_topk_results<token_type>(std::move(res), this, this->first_term(query));
+    }
+
+public:
+    std::unique_ptr<typename topk_interface::iter> topk(
+            size_t k, const token_type* begin, const token_type* end,
+            bool multi_occ = false, bool only_match = false) override {
+        return topk_union(k, {{begin, end}}, multi_occ, only_match);
+    }
+
+    // Block-Max WAND.
+    std::unique_ptr<typename topk_interface::iter> topk_union(
+            size_t k, const typename topk_interface::intersect_query& query,
+            bool multi_occ = false, bool only_match = false) override {
+        result_heap heap(k);
+        auto terms = open(query);
+        std::vector<term_cursor*> live;
+        for (auto& t : terms)
+            live.push_back(&t);
+        auto by_doc = [](const term_cursor* a, const term_cursor* b) {
+            return a->c.doc() < b->c.doc();
+        };
+        while (k > 0 and budget_step()) {
+            std::sort(live.begin(), live.end(), by_doc);
+            while (!live.empty() and live.back()->c.done())
+                live.pop_back();
+            double threshold = heap.threshold();
+            // The pivot is the first document whose lists may score above
+            // the threshold; the lists before it hold lower documents.
+            double ub = 0;
+            size_t p = 0;
+            while (p < live.size() and (ub += live[p]->max_score) <= threshold)
+                ++p;
+            if (p == live.size())
+                break;
+            uint64_t pivot = live[p]->c.doc();
+            while (p + 1 < live.size() and live[p + 1]->c.doc() == pivot)
+                ++p;
+
+            double block_ub = 0;
+            uint64_t skip = p + 1 < live.size() ? live[p + 1]->c.doc() : end_doc;
+            for (size_t i = 0; i <= p; ++i) {
+                if (live[i]->c.skip_blocks(pivot)) {
+                    block_ub += block_bound(*live[i]);
+                    skip = std::min(skip, live[i]->c.block_last() + 1);
+                }
+            }
+            if (block_ub > threshold) {
+                if (live[0]->c.doc() == pivot) {
+                    double s = 0;
+                    for (size_t i = 0; i <= p; ++i) {
+                        s += score(*live[i], multi_occ);
+                        live[i]->c.next();
+                    }
+                    if (!this->is_excluded(m_doc_map[pivot]))
+                        heap.add({pivot, s});
+                } else {
+                    for (size_t i = 0; i < p and live[i]->c.doc() < pivot; ++i)
+                        live[i]->c.next_geq(pivot);
+                }
+            } else {
+                // No document before skip can beat the threshold.
+                skip = std::max(skip, pivot + 1);
+                for (size_t i = 0; i <= p; ++i)
+                    live[i]->c.next_geq(skip);
+            }
+        }
+        return results(heap, query);
+    }
+
+    // Document at a time over all lists, shortest first.
+    std::unique_ptr<typename topk_interface::iter> topk_intersect(
+            size_t k, const typename topk_interface::intersect_query& query,
+            bool multi_occ = false, bool only_match = false) override {
+        result_heap heap(k);
+        auto terms = open(query);
+        std::sort(terms.begin(), terms.end(), [](const term_cursor& a, const term_cursor& b) {
+            return a.df < b.df;
+        });
+        uint64_t doc = terms.empty() or k == 0 ? end_doc : terms[0].c.doc();
+        while (doc != end_doc and budget_step()) {
+            size_t i = 1;
+            while (i < terms.size()) {
+                terms[i].c.next_geq(doc);
+                if (terms[i].c.doc() != doc)
+                    break;
+                ++i;
+            }
+            if (i < terms.size()) {
+                terms[0].c.next_geq(terms[i].c.doc());
+                doc = terms[0].c.doc();
+                continue;
+            }
+            double ub = 0;
+            uint64_t skip = end_doc;
+            for (auto& t : terms) {
+                t.c.skip_blocks(doc);
+                ub += block_bound(t);
+                skip = std::min(skip, t.c.block_last() + 1);
+            }
+            if (ub <= heap.threshold()) {
+                terms[0].c.next_geq(skip);
+            } else {
+                double s = 0;
+                bool counts = true;
+                for (const auto& t : terms) {
+                    double ts = score(t, multi_occ);
+                    counts &= ts > 0;
+                    s += ts;
+                }
+                if (counts and !this->is_excluded(m_doc_map[doc]))
+                    heap.add({doc, s});
+                terms[0].c.next();
+            }
+            doc = terms[0].c.doc();
+        }
+        return results(heap, query);
+    }
+
+    bool supports_intersect() const override {
+        return true;
+    }
+
+    bool supports_union() const override {
+        return true;
+    }
+
+    uint64_t doc_cnt() const {
+        return m_doc_map.size();
+    }
+
+    const postings_type& postings() const {
+        return m_postings;
+    }
+
+    void load(sdsl::cache_config& cc) {
+        load_from_cache(m_postings, KEY_INVFILE_PLISTS, cc, true);
+        load_from_cache(m_doc_map, KEY_INVFILE_IDOCPERM, cc);
+        m_ranker = ranker_type(cc);
+    }
+
+    size_type serialize(std::ostream& out, sdsl::structure_tree_node* v = nullptr,
+                        std::string name = "") const {
+        using namespace sdsl;
+        structure_tree_node* child = structure_tree::add_child(
+                                         v, name, util::class_name(*this));
+        size_type written_bytes = 0;
+        written_bytes += m_postings.serialize(out, child, "POSTINGS");
+        written_bytes += m_doc_map.serialize(out, child, "DOC_MAP");
+        structure_tree::add_size(child, written_bytes);
+        return written_bytes;
+    }
+
+    void mem_info() const {
+        std::cout << sdsl::size_in_bytes(m_postings) << ";"; // POSTINGS
+        std::cout << sdsl::size_in_bytes(m_doc_map) << std::endl; // DOC_MAP
+    }
+};
+
+template<typename t_ranker, uint64_t t_block_size>
+void construct(idx_invidx<t_ranker, t_block_size>& idx, const std::string&,
+               sdsl::cache_config& cc, uint8_t num_bytes) {
+    using namespace sdsl;
+    using namespace std;
+    using postings_type = typename idx_invidx<t_ranker, t_block_size>::postings_type;
+
+    construct_col_len<int_alphabet_tag::WIDTH>(cc);
+    // The rankers only build the document lengths of byte collections.
+    if (!cache_file_exists(KEY_DOC_LENGTHS, cc))
+        construct_doc_lengths<int_alphabet_tag::WIDTH>(cc);
+
+    cout << "...DOC_MAP" << endl;
+    if (!cache_file_exists(KEY_INVFILE_IDOCPERM, cc)) {
+        int_vector<> id_mapping;
+        construct_invidx_doc_permuations(id_mapping, cc);
+        store_to_cache(id_mapping, KEY_INVFILE_IDOCPERM, cc);
+    }
+
+    cout << "...POSTINGS" << endl;
+    if (!cache_file_exists<postings_type>(KEY_INVFILE_PLISTS, cc)) {
+        vector<postings_builder> lists;
+        construct_postings_lists<postings_builder, t_ranker>(lists, cc);
+        int_vector<> id_mapping;
+        load_from_cache(id_mapping, KEY_INVFILE_IDOCPERM, cc);
+        t_ranker ranker(cc);
+        postings_type postings(lists, [&](uint64_t doc) {
+            return (uint64_t)ranker.doc_length(id_mapping[doc]);
+        });
+        store_to_cache(postings, KEY_INVFILE_PLISTS, cc, true);
+    }
+}
+
+} // end namespace surf
@@ -3,16 +3,21 @@
 #include <algorithm>
 #include <limits>
 #include <memory>
+#include <numeric>
 #include <queue>
-#include <set>
 #include <unordered_set>
 
 #include "sdsl/suffix_trees.hpp"
 #include "sdsl/k2_treap.hpp"
+#include "surf/backward_search_batch.hpp"
 #include "surf/construct_col_len.hpp"
 #include "surf/df_sada.hpp"
+#include "surf/doc_blocks.hpp"
 #include "surf/rank_functions.hpp"
+#include "surf/snippets.hpp"
 #include "surf/topk_interface.hpp"
+#include "surf/topk_list_algos.hpp"
+#include "surf/topk_scratch.hpp"
 
 namespace surf {
 
@@ -46,6 +51,77 @@ struct map_to_dup_type {
     }
 };
 
+//! Documents of the heaviest arrows of the grid, stored directly.
+/*!
+ * With offset encoding, the document of an arrow costs three selects on
+ * H and the doc offsets, an SA access and a rank on the document borders.
+ * The k2-treap reports arrows in decreasing weight order, so the heaviest
+ * arrows are the ones most queries report. The documents of the
+ * n/t_dens heaviest of the n arrows are stored in an array and found
+ * with a rank on a bit vector over the arrows.
+ *
+ * \tparam t_dens One in t_dens arrows is sampled, 0 samples none.
+ */
+template<uint64_t t_dens>
+class arrow_doc_sample {
+public:
+    using size_type = sdsl::int_vector<>::size_type;
+
+private:
+    sdsl::bit_vector          m_sampled;
+    sdsl::rank_support_v5<>   m_sampled_rank;
+    sdsl::int_vector<>        m_docs; // documents of the sampled arrows
+
+public:
+    arrow_doc_sample() = default;
+
+    //! Samples the heaviest arrows, given the documents and weights of all.
+    arrow_doc_sample(const int_vector<>& dup, const int_vector<>& weights) {
+        m_sampled = sdsl::bit_vector(dup.size(), 0);
+        size_t m = t_dens ? dup.size() / t_dens : 0;
+        std::vector<uint64_t> arrows(dup.size());
+        std::iota(arrows.begin(), arrows.end(), 0);
+        std::nth_element(arrows.begin(), arrows.begin() + m, arrows.end(),
+        [&](uint64_t a, uint64_t b) {
+            return weights[a] > weights[b] or (weights[a] == weights[b] and a < b);
+        });
+        for (size_t i = 0; i < m; ++i)
+            m_sampled[arrows[i]] = 1;
+        m_sampled_rank = sdsl::rank_support_v5<>(&m_sampled);
+        m_docs = int_vector<>(m, 0, dup.width());
+        for (size_t i = 0, j = 0; i < dup.size(); ++i)
+            if (m_sampled[i])
+                m_docs[j++] = dup[i];
+        sdsl::util::bit_compress(m_docs);
+    }
+
+    //! Sets doc to the document of arrow index, if it is sampled.
+    bool find(uint64_t index, uint64_t& doc) const {
+        if (m_docs.empty() or !m_sampled[index])
+            return false;
+        doc = m_docs[m_sampled_rank(index)];
+        return true;
+    }
+
+    size_type serialize(std::ostream& out, structure_tree_node* v = nullptr,
+                        std::string name = "") const {
+        structure_tree_node* child = structure_tree::add_child(v, name,
+                                     util::class_name(*this));
+        size_type written_bytes = 0;
+        written_bytes += m_sampled.serialize(out, child, "SAMPLED");
+        written_bytes += m_sampled_rank.serialize(out, child, "SAMPLED_RANK");
+        written_bytes += m_docs.serialize(out, child, "DOCS");
+        structure_tree::add_size(child, written_bytes);
+        return written_bytes;
+    }
+
+    void load(std::istream& in) {
+        m_sampled.load(in);
+        m_sampled_rank.load(in, &m_sampled);
+        m_docs.load(in);
+    }
+};
+
 /*! Class idx_nn consists of a
  *   - CSA over the collection concatenation
  *   - H
@@ -61,7 +137,9 @@ template<typename t_csa,
          typename t_h_select_0 = typename t_h::select_0_type,
          typename t_h_select_1 = typename t_h::select_1_type,
          bool     offset_encoding = true,
-         typename t_doc_offset = sdsl::hyb_sd_vector<>
+         typename t_doc_offset = sdsl::hyb_sd_vector<>,
+         uint64_t t_doc_sample = 0,
+         typename t_doc = sdsl::int_vector<>
          >
 class idx_nn
     : public topk_index_by_alphabet<typename t_csa::alphabet_category>::type {
@@ -81,10 +159,12 @@ public:
     typedef t_doc_offset                               doc_offset_type;
     typedef typename t_doc_offset::select_1_type       doc_offset_select_type;
     typedef map_to_dup_type<h_select_1_type>           map_to_h_type;
+    typedef arrow_doc_sample<t_doc_sample>             doc_sample_type;
+    typedef t_doc                                      doc_type;
     using topk_interface = typename topk_index_by_alphabet<alphabet_category>::type;
 
 private:
-    csa_type           m_csa;
+    std::shared_ptr<const csa_type> m_csa = std::make_shared<csa_type>(); // may be shared, see load()
     border_type        m_border;
     border_rank_type   m_border_rank;
     border_select_type m_border_select;
@@ -93,92 +173,130 @@ private:
     h_select_1_type    m_h_select_1;
     doc_offset_type    m_doc_offset; // offset representation of documents in node list
     doc_offset_select_type m_doc_offset_select;
-    int_vector<>       m_doc; // documents in node lists
+    doc_sample_type    m_doc_sample; // documents of the heaviest arrows
+    doc_type           m_doc; // documents in node lists
     rmqc_type          m_rmqc;
     k2treap_type       m_k2treap;
     map_to_h_type      m_map_to_h;
-    topk_result_set    m_results;
 
     class top_k_iterator : public topk_interface::iter {
     public:
         using k2treap_iterator = k2_treap_ns::top_k_iterator<t_k2treap>;
         typedef std::pair<uint64_t, double> t_doc_val;
-        typedef std::stack<std::array<uint64_t, 2>> t_stack_array;
     private:
         const idx_nn*      m_idx;
         uint64_t           m_sp;  // start point of lex interval
         uint64_t           m_ep;  // end point of lex interval
+        uint64_t           m_depth; // length of the pattern
+        uint64_t           m_occ = no_occurrence; // text position of a singleton result
+        mutable occurrence_sample m_sample;
         t_doc_val          m_doc_val;  // stores the current result
         bool               m_valid = false;
         k2treap_iterator   m_k2_iter;
-        std::set<uint64_t> m_reported;
-        std::set<uint64_t> m_singletons;
-        t_stack_array      m_states;
+        size_t             m_batch_size; // arrows taken from the treap at once
+        std::vector<uint64_t> m_batch;   // arrows of the batch, then their docs
+        std::vector<uint64_t> m_batch_weights;
+        std::vector<uint64_t> m_batch_occs; // occurrences in the docs of the batch
+        size_t             m_batch_pos = 0; // next result in the batch
+        topk_scratch::pointer m_scratch; // reported and singleton docs, RMQ stack
         bool               m_multi_occ = false; // true, if document has to occur more than once
     public:
         top_k_iterator() = delete;
-        top_k_iterator(const idx_nn* idx,
+        //! k is the number of results the caller expects, the documents of
+        //! up to k arrows are decoded in one batch.
+        top_k_iterator(const idx_nn* idx, size_t k,
                        const typename topk_interface::token_type* begin,
                        const typename topk_interface::token_type* end,
                        bool multi_occ, bool only_match) :
-            m_idx(idx), m_multi_occ(multi_occ) {
-            m_valid = backward_search(m_idx->m_csa, 0, m_idx->m_csa.size() - 1,
-                                      begin, end, m_sp, m_ep) > 0;
+            top_k_iterator(idx, k, idx->lookup(begin, end), end - begin,
+                           multi_occ, only_match) {}
+
+        top_k_iterator(const idx_nn* idx, size_t k, range_type range, uint64_t depth,
+                       bool multi_occ, bool only_match) :
+            top_k_iterator(idx, k, idx->interval(range), depth,
+                           multi_occ, only_match) {}
+
+        top_k_iterator(const idx_nn* idx, size_t k, const sa_interval& iv, uint64_t depth,
+                       bool multi_occ, bool only_match) :
+            m_idx(idx), m_sp(std::get<0>(iv.sa)), m_ep(std::get<1>(iv.sa)),
+            m_depth(depth),
+            m_batch_size(std::max<size_t>(1, std::min<size_t>(k, size_t(max_decode_batch)))),
+            m_multi_occ(multi_occ) {
+            m_valid = !empty(iv.sa);
             m_valid &= !only_match;
             if (m_valid) {
-                auto h_range = m_idx->m_map_to_h(m_sp, m_ep);
+                const auto& h_range = iv.derived;
                 if (!empty(h_range)) {
-                    uint64_t depth = end - begin;
                     m_k2_iter = k2_treap_ns::top_k(m_idx->m_k2treap,
                     {std::get<0>(h_range), 0},
                     {std::get<1>(h_range), depth - 1});
                 }
-                m_states.push({m_sp, m_ep});
+                // Doc ids of singletons go up to doc_cnt(), that of the
+                // last document.
+                m_scratch = topk_scratch::acquire(m_idx->doc_cnt() + 1);
+                m_scratch->states.push_back({m_sp, m_ep});
                 this->next();
             }
         }
 
         typename topk_interface::snippet_type extract_snippet(const size_t k)
         const override {
-            size_type s = (m_doc_val.first == 0)
-                          ?  0
-                          : (m_idx->m_border_select(m_doc_val.first) + 1);
-            size_type e = std::min(s + k,
-                                   m_idx->m_border_select(m_doc_val.first + 1) - 1);
-            auto res = extract(m_idx->m_csa, s, e);
-            return {res.begin(), res.end()};
+            // The occurrence is known for singletons and for offset
+            // encoded arrows, the others are taken from a sample of the
+            // SA interval.
+            uint64_t occ = m_occ;
+            if (occ == no_occurrence)
+                occ = m_sample.find(m_idx->csa(), m_idx->m_border_rank, {{m_sp, m_ep}},
+                                    m_doc_val.first, kwic_sample_probes);
+            return extract_windows<typename topk_interface::token_type>(
+                       m_idx->csa(), m_idx->m_border_select, {m_doc_val.first},
+                       {occ}, m_depth, k)[0];
+        }
+
+        typename topk_interface::pattern_type pattern() const override {
+            return {{{m_sp, m_ep}}, m_depth};
         }
 
         void next() override {
             if (m_valid) {
                 m_valid = false;
-                if (m_k2_iter) {   // multiple occurrence result exists
-                    auto xy_w = *m_k2_iter;
-                    uint64_t doc_id = offset_encoding
-                                      ? m_idx->get_doc(real(xy_w.first))
-                                      : m_idx->m_doc[real(xy_w.first)];
-                    m_doc_val = t_doc_val(doc_id, xy_w.second + 1);
-                    m_reported.insert(doc_id);
+                // multiple occurrence results, excluded documents are
+                // marked as reported so no singleton repeats them
+                while (m_batch_pos < m_batch.size() or m_k2_iter) {
+                    if (m_batch_pos == m_batch.size() and !next_batch())
+                        return;
+                    uint64_t doc_id = m_batch[m_batch_pos];
+                    uint64_t weight = m_batch_weights[m_batch_pos];
+                    uint64_t occ = m_batch_occs[m_batch_pos++];
+                    m_scratch->docs.insert(doc_id, doc_marks::REPORTED);
+                    if (m_idx->is_excluded(doc_id))
+                        continue;
+                    m_doc_val = t_doc_val(doc_id, weight + 1);
+                    m_occ = occ;
                     m_valid = true;
-                    ++m_k2_iter;
-                } else { // search for singleton results
-                    while (!m_multi_occ and !m_states.empty()) {
-                        auto state = m_states.top();
-                        m_states.pop();
-                        uint64_t min_idx = m_idx->m_rmqc(state[0], state[1]);
-                        uint64_t doc_id  = m_idx->m_border_rank(m_idx->m_csa[min_idx]);
-                        if (m_singletons.find(doc_id) == m_singletons.end()) {
-                            m_singletons.insert(doc_id);
-                            if (min_idx + 1 <= state[1])
-                                m_states.push({min_idx + 1, state[1]});
-                            if (state[0] + 1 <= min_idx)
-                                m_states.push({state[0], min_idx - 1});
-                            if (m_reported.find(doc_id) == m_reported.end()) {
-                                m_doc_val = t_doc_val(doc_id, 1);
-                                m_reported.insert(doc_id);
-                                m_valid = true;
-                                break;
-                            }
+                    return;
+                }
+                // search for singleton results
+                auto& docs = m_scratch->docs;
+                auto& states = m_scratch->states;
+                while (!m_multi_occ and !states.empty() and budget_step()) {
+                    auto state = states.back();
+                    states.pop_back();
+                    uint64_t min_idx = m_idx->m_rmqc(state[0], state[1]);
+                    uint64_t occ = m_idx->csa()[min_idx];
+                    uint64_t doc_id  = m_idx->m_border_rank(occ);
+                    if (docs.insert(doc_id, doc_marks::SINGLETON)) {
+                        if (min_idx + 1 <= state[1])
+                            states.push_back({min_idx + 1, state[1]});
+                        if (state[0] + 1 <= min_idx)
+                            states.push_back({state[0], min_idx - 1});
+                        if (!docs.contains(doc_id, doc_marks::REPORTED)
+                                and !m_idx->is_excluded(doc_id)) {
+                            m_doc_val = t_doc_val(doc_id, 1);
+                            m_occ = occ;
+                            docs.insert(doc_id, doc_marks::REPORTED);
+                            m_valid = true;
+                            break;
                         }
                     }
                 }
@@ -192,8 +310,43 @@ private:
         bool done() const override {
             return !m_valid;
         }
+
+    private:
+        // Takes the next arrows from the treap and decodes their
+        // documents. Returns false if the budget of the query is used up
+        // before the first one.
+        bool next_batch() {
+            m_batch.clear();
+            m_batch_weights.clear();
+            m_batch_pos = 0;
+            while (m_k2_iter and m_batch.size() < m_batch_size and budget_step()) {
+                auto xy_w = *m_k2_iter;
+                m_batch.push_back(real(xy_w.first));
+                m_batch_weights.push_back(xy_w.second);
+                ++m_k2_iter;
+            }
+            m_idx->get_docs(m_batch, m_batch_occs);
+            return !m_batch.empty();
+        }
     };
 
+    // Largest number of arrows decoded at once by an iterator.
+    static constexpr size_t max_decode_batch = 1024;
+
+    // SA interval and H range of a pattern.
+    sa_interval interval(range_type sa) const {
+        if (empty(sa))
+            return {sa, {1, 0}};
+        return {sa, m_map_to_h(std::get<0>(sa), std::get<1>(sa))};
+    }
+
+    sa_interval lookup(const typename topk_interface::token_type* begin,
+                       const typename topk_interface::token_type* end) const {
+        return cached_interval(this->get_interval_cache(), begin, end, [&]() {
+            return interval(sa_range(*m_csa, begin, end));
+        });
+    }
+
 public:
 
     std::unique_ptr<typename topk_interface::iter> topk(
@@ -202,11 +355,47 @@ public:
         const typename topk_interface::token_type* end,
         bool multi_occ = false, bool only_match = false) override {
         return std::make_unique<top_k_iterator>(
-                   this, begin, end, multi_occ, only_match);
+                   this, k, begin, end, multi_occ, only_match);
     }
 
-    // Decode m_doc value at postion index by using offset encoding.
-    uint64_t get_doc(const uint64_t index) const {
+    // topk() for the SA interval of a pattern of length depth.
+    std::unique_ptr<typename topk_interface::iter> topk(
+        size_t k, range_type range, uint64_t depth,
+        bool multi_occ = false, bool only_match = false) {
+        return std::make_unique<top_k_iterator>(
+                   this, k, range, depth, multi_occ, only_match);
+    }
+
+    std::vector<topk_result_set> topk_batch(
+        size_t k, const typename topk_interface::batch_query& patterns,
+        bool multi_occ = false, bool only_match = false) override {
+        return surf::topk_batch(*this, *m_csa, k, patterns, multi_occ, only_match);
+    }
+
+    std::unique_ptr<typename topk_interface::iter> topk_union(
+        size_t k, const typename topk_interface::intersect_query& query,
+        bool multi_occ = false, bool only_match = false) override {
+        std::vector<std::unique_ptr<typename topk_interface::iter>> lists;
+        for (const auto& q : query)
+            lists.emplace_back(std::make_unique<top_k_iterator>(
+                       this, k, q.first, q.second, multi_occ, only_match));
+        return sort_topk_results<typename topk_interface::token_type>(
+                   topk_list_algos::topk_union(k, lists, multi_occ), this, this->first_term(query));
+    }
+
+    bool supports_union() const override {
+        return true;
+    }
+
+    // Decode m_doc value at postion index by using offset encoding. If occ
+    // is given, it is set to the text position of an occurrence of the
+    // pattern in the document, or no_occurrence for sampled arrows.
+    uint64_t get_doc(const uint64_t index, uint64_t* occ = nullptr) const {
+        uint64_t doc_id;
+        if (occ)
+            *occ = no_occurrence;
+        if (m_doc_sample.find(index, doc_id))
+            return doc_id;
         // All sa offsets are relative to sa_base_pos (rightmost leaf of left subtree).
         uint64_t sa_base_pos = m_h_select_0(index + 1) - index + 1;
         uint64_t base_index = // Index of first dup entry in the node.
@@ -217,38 +406,107 @@ public:
             m_doc_offset_select(index + 1) - m_doc_offset_select(base_index);
         --sa_delta; // Because zero deltas can't be encoded otherwise.
         uint64_t sa_pos = sa_base_pos + sa_delta;
-        uint64_t text_pos = m_csa[sa_pos];
+        uint64_t text_pos = (*m_csa)[sa_pos];
+        if (occ)
+            *occ = text_pos;
         return m_border_rank(text_pos);
     }
 
+    // Replaces the arrows in index by their documents, like get_doc(), and
+    // sets occs to the text positions of the occurrences they were
+    // decoded from. Sampled arrows and arrows without offset encoding get
+    // no_occurrence.
+    // The arrows are decoded in increasing order, so those of one node
+    // share the selects on H and the offset of the first arrow of the
+    // node. The SA is then accessed in increasing order.
+    void get_docs(std::vector<uint64_t>& index, std::vector<uint64_t>& occs) const {
+        occs.assign(index.size(), no_occurrence);
+        if (!offset_encoding) {
+            for (auto& i : index)
+                i = m_doc[i];
+            return;
+        }
+        std::vector<std::pair<uint64_t, size_t>> pos; // arrow, then SA position
+        for (size_t i = 0; i < index.size(); ++i) {
+            uint64_t doc_id;
+            if (m_doc_sample.find(index[i], doc_id))
+                index[i] = doc_id;
+            else
+                pos.emplace_back(index[i], i);
+        }
+        std::sort(pos.begin(), pos.end());
+        uint64_t sa_base_pos = 0, base_offset = 0;
+        uint64_t node_end = 0; // first arrow after the current node
+        for (auto& p : pos) {
+            if (p.first >= node_end) {
+                sa_base_pos = m_h_select_0(p.first + 1) - p.first + 1;
+                uint64_t base_index = m_h_select_1(sa_base_pos - 1) + 2 - sa_base_pos;
+                node_end = m_h_select_1(sa_base_pos) + 1 - sa_base_pos;
+                base_offset = base_index == 0 ? 0 : m_doc_offset_select(base_index);
+            }
+            p.first = sa_base_pos + m_doc_offset_select(p.first + 1) - base_offset - 1;
+        }
+        std::sort(pos.begin(), pos.end());
+        for (const auto& p : pos) {
+            occs[p.second] = (*m_csa)[p.first];
+            index[p.second] = m_border_rank(occs[p.second]);
+        }
+    }
+
 
-    auto doc(uint64_t doc_id) -> decltype(extract(m_csa, 0, 0)) {
+    auto doc(uint64_t doc_id) -> decltype(extract(*m_csa, 0, 0)) {
         size_type doc_begin = 0;
         if (doc_id) {
             doc_begin = m_border_select(doc_id) + 1;
         }
         size_type doc_end = m_border_select(doc_id + 1) - 1;
-        auto res = extract(m_csa, doc_begin, doc_end);
+        auto res = extract(*m_csa, doc_begin, doc_end);
         return res;
     }
 
+    std::vector<typename topk_interface::snippet_type>
+    extract_docs(const std::vector<uint64_t>& docs, size_t k,
+                 const typename topk_interface::pattern_type& pattern) const override {
+        return extract_snippets(*m_csa, m_border_rank, m_border_select, docs, k, pattern);
+    }
+
+    std::vector<std::vector<uint64_t>>
+    locate_docs(const std::vector<uint64_t>& docs, size_t max_positions,
+                const typename topk_interface::pattern_type& pattern) const override {
+        return doc_positions(*m_csa, m_border_rank, m_border_select, docs, max_positions, pattern);
+    }
+
     uint64_t doc_cnt() const {
-        return m_border_rank(m_csa.size());
+        return m_border_rank(m_csa->size());
+    }
+
+    const csa_type& csa() const {
+        return *m_csa;
     }
 
     uint64_t word_cnt() const {
-        return m_csa.size() - doc_cnt();
+        return m_csa->size() - doc_cnt();
     }
 
 
     void load(sdsl::cache_config& cc) {
-        load_from_cache(m_csa, surf::KEY_CSA, cc, true);
+        auto csa = std::make_shared<csa_type>();
+        load_from_cache(*csa, surf::KEY_CSA, cc, true);
+        load(cc, std::move(csa));
+    }
+
+    //! Loads the index with a CSA of the collection which is loaded
+    //! already, e.g. the one idx_planner shares between its indexes.
+    void load(sdsl::cache_config& cc, std::shared_ptr<const csa_type> csa) {
+        m_csa = std::move(csa);
         if (offset_encoding) {
             load_from_cache(m_doc_offset, surf::KEY_DOC_OFFSET, cc, true);
             load_from_cache(m_doc_offset_select, surf::KEY_DOC_OFFSET_SELECT, cc, true);
             m_doc_offset_select.set_vector(&m_doc_offset);
+            if (t_doc_sample)
+                load_from_cache(m_doc_sample, surf::KEY_DOC_SAMPLE, cc, true);
         } else {
-            load_from_cache(m_doc, surf::KEY_DUP, cc);
+            load_from_cache(m_doc, surf::KEY_DUP, cc, !is_plain_doc_array<doc_type>::value);
         }
         load_from_cache(m_border, surf::KEY_DOCBORDER, cc, true);
         load_from_cache(m_border_rank, surf::KEY_DOCBORDER_RANK, cc, true);
@@ -268,16 +526,20 @@ public:
         load_from_cache(m_k2treap, key_w_and_p, cc, true);
     }
 
+    // write_csa is false if the CSA is shared and written once by the
+    // owner, see idx_planner.
     size_type serialize(std::ostream& out, structure_tree_node* v = nullptr,
-                        std::string name = "")const {
+                        std::string name = "", bool write_csa = true)const {
         structure_tree_node* child = structure_tree::add_child(v, name,
                                      util::class_name(*this));
         size_type written_bytes = 0;
-        written_bytes += m_csa.serialize(out, child, "CSA");
+        if (write_csa)
+            written_bytes += m_csa->serialize(out, child, "CSA");
         if (offset_encoding) {
             written_bytes += m_doc_offset.serialize(out, child, "DOC_OFFSET");
             written_bytes += m_doc_offset_select.serialize(out, child,
                              "DOC_OFFSET_SELECT");
+            written_bytes += m_doc_sample.serialize(out, child, "DOC_SAMPLE");
         } else {
             written_bytes += m_doc.serialize(out, child, "DOC");
         }
@@ -294,12 +556,13 @@ public:
 
     void mem_info()const {
         std::cout << "Dupsize " << m_doc.size() << std::endl;
-        std::cout << sdsl::size_in_bytes(m_csa) +
+        std::cout << sdsl::size_in_bytes(*m_csa) +
                   sdsl::size_in_bytes(m_border) +
                   sdsl::size_in_bytes(m_border_rank) << ";"; // CSA
         if (offset_encoding) {
             std::cout << sdsl::size_in_bytes(m_doc_offset)
-                      + sdsl::size_in_bytes(m_doc_offset_select) << ";"; // DOC
+                      + sdsl::size_in_bytes(m_doc_offset_select)
+                      + sdsl::size_in_bytes(m_doc_sample) << ";"; // DOC
         } else {
             std::cout << sdsl::size_in_bytes(m_doc) << ";"; // DOC
         }
@@ -346,11 +609,13 @@ template<typename t_csa,
          typename t_h_select_0,
          typename t_h_select_1,
          bool     offset_encoding,
-         typename t_doc_offset
+         typename t_doc_offset,
+         uint64_t t_doc_sample,
+         typename t_doc
          >
 void construct(idx_nn<t_csa, t_k2treap, max_query_length, t_rmq, t_border, t_border_rank,
                t_border_select, t_h, t_h_select_0, t_h_select_1, offset_encoding,
-               t_doc_offset>& idx, const std::string&, sdsl::cache_config& cc,
+               t_doc_offset, t_doc_sample, t_doc>& idx, const std::string&, sdsl::cache_config& cc,
                uint8_t num_bytes) {
     using namespace sdsl;
     using namespace std;
@@ -358,8 +623,10 @@ void construct(idx_nn<t_csa, t_k2treap, max_query_length, t_rmq, t_border, t_bor
     using cst_type = typename t_df::cst_type;
     using t_wtd = WTD_TYPE;
     using idx_type = idx_nn<t_csa, t_k2treap, max_query_length, t_rmq, t_border, t_border_rank,
-          t_border_select, t_h, t_h_select_0, t_h_select_1, offset_encoding, t_doc_offset>;
+          t_border_select, t_h, t_h_select_0, t_h_select_1, offset_encoding, t_doc_offset,
+          t_doc_sample, t_doc>;
     using doc_offset_type = typename idx_type::doc_offset_type;
+    using doc_sample_type = typename idx_type::doc_sample_type;
 
     construct_col_len<t_df::alphabet_category::WIDTH>(cc);
 
@@ -557,6 +824,24 @@ void construct(idx_nn<t_csa, t_k2treap, max_query_length, t_rmq, t_border, t_bor
             store_to_cache(doc_offset, surf::KEY_DOC_OFFSET, cc, true);
             store_to_cache(doc_offset_select, surf::KEY_DOC_OFFSET_SELECT, cc, true);
         }
+        if (t_doc_sample) {
+            cout << "...DOC_SAMPLE" << endl;
+            if (!cache_file_exists<doc_sample_type>(surf::KEY_DOC_SAMPLE, cc)) {
+                int_vector<> dup, weights;
+                load_from_cache(dup, surf::KEY_DUP_G, cc);
+                load_from_cache(weights, key_weights, cc);
+                doc_sample_type doc_sample(dup, weights);
+                store_to_cache(doc_sample, surf::KEY_DOC_SAMPLE, cc, true);
+            }
+        }
+    } else if (!is_plain_doc_array<t_doc>::value) {
+        cout << "...DOC" << endl;
+        if (!cache_file_exists<t_doc>(surf::KEY_DUP, cc)) {
+            int_vector<> dup;
+            load_from_cache(dup, surf::KEY_DUP, cc);
+            t_doc doc(dup);
+            store_to_cache(doc, surf::KEY_DUP, cc, true);
+        }
     }
 
     cout << "...RMQ_C" << endl;
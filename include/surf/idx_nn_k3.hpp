@@ -4,16 +4,19 @@
 #include <limits>
 #include <memory>
 #include <queue>
-#include <set>
 #include <unordered_set>
 
 #include "sdsl/k3_treap.hpp"
 #include "sdsl/k3_treap_query.hpp"
 #include "sdsl/suffix_trees.hpp"
+#include "surf/backward_search_batch.hpp"
 #include "surf/construct_col_len.hpp"
 #include "surf/df_sada.hpp"
 #include "surf/k3_treap_algos.hpp"
 #include "surf/rank_functions.hpp"
+#include "surf/snippets.hpp"
+#include "surf/topk_list_algos.hpp"
+#include "surf/topk_scratch.hpp"
 
 namespace surf {
 
@@ -68,7 +71,7 @@ public:
 private:
     using token_type = typename topk_interface::token_type;
 
-    csa_type           m_csa;
+    std::shared_ptr<const csa_type> m_csa = std::make_shared<csa_type>(); // may be shared, see load()
     border_type        m_border;
     border_rank_type   m_border_rank;
     border_select_type m_border_select;
@@ -81,88 +84,112 @@ private:
     rmqc_type          m_rmqc;
     k2treap_type       m_k2treap;
     map_to_h_type      m_map_to_h;
-    topk_result_set    m_results;
 
     class top_k_iterator : public topk_interface::iter {
     public:
         using k2treap_iterator = k3_treap_ns::top_k_iterator<t_k2treap>;
         typedef std::pair<uint64_t, double> t_doc_val;
-        typedef std::stack<std::array<uint64_t, 2>> t_stack_array;
     private:
         const idx_nn_k3* m_idx;
         uint64_t           m_sp;  // start point of lex interval
         uint64_t           m_ep;  // end point of lex interval
+        uint64_t           m_depth; // length of the pattern
+        uint64_t           m_occ = no_occurrence; // text position of a singleton result
+        mutable occurrence_sample m_sample;
         t_doc_val          m_doc_val;  // stores the current result
         bool               m_valid = false;
         k2treap_iterator   m_k2_iter;
-        std::set<uint64_t> m_reported;
-        std::set<uint64_t> m_singletons;
-        t_stack_array      m_states;
+        topk_scratch::pointer m_scratch; // reported and singleton docs, RMQ stack
         bool               m_multi_occ = false; // true, if document has to occur more than once
     public:
         top_k_iterator() = delete;
         top_k_iterator(const idx_nn_k3* idx,
                        const token_type* begin, const token_type* end,
                        bool multi_occ, bool only_match) :
-            m_idx(idx), m_multi_occ(multi_occ) {
-            m_valid = backward_search(m_idx->m_csa, 0, m_idx->m_csa.size() - 1,
-                                      begin, end, m_sp, m_ep) > 0;
+            top_k_iterator(idx, idx->lookup(begin, end), end - begin,
+                           multi_occ, only_match) {}
+
+        top_k_iterator(const idx_nn_k3* idx, const sa_interval& iv, uint64_t depth,
+                       bool multi_occ, bool only_match) :
+            m_idx(idx), m_sp(std::get<0>(iv.sa)), m_ep(std::get<1>(iv.sa)),
+            m_depth(depth), m_multi_occ(multi_occ) {
+            m_valid = !empty(iv.sa);
             m_valid &= !only_match;
             if (m_valid) {
-                auto h_range = m_idx->m_map_to_h(m_sp, m_ep);
+                const auto& h_range = iv.derived;
                 if (!empty(h_range)) {
-                    uint64_t depth = end - begin;
                     m_k2_iter = k3_treap_ns::top_k(m_idx->m_k2treap,
                         {std::get<0>(h_range), 0, 0},
                         {std::get<1>(h_range), depth - 1,
                         std::numeric_limits<uint64_t>::max()});
                 }
-                m_states.push({m_sp, m_ep});
+                // Doc ids of singletons go up to doc_cnt(), that of the
+                // last document.
+                m_scratch = topk_scratch::acquire(m_idx->doc_cnt() + 1);
+                m_scratch->states.push_back({m_sp, m_ep});
                 this->next();
             }
         }
 
         typename topk_interface::snippet_type extract_snippet(const size_t k)
                 const override {
-            size_type s = (m_doc_val.first == 0)
-                          ?  0
-                          : (m_idx->m_border_select(m_doc_val.first) + 1);
-            size_type e = std::min(s + k,
-                                   m_idx->m_border_select(m_doc_val.first + 1) - 1);
-            auto res = extract(m_idx->m_csa, s, e);
-            return {res.begin(), res.end()};
+            // The occurrence of a singleton is known, the others are
+            // taken from a sample of the SA interval.
+            uint64_t occ = m_occ;
+            if (occ == no_occurrence)
+                occ = m_sample.find(m_idx->csa(), m_idx->m_border_rank, {{m_sp, m_ep}},
+                                    m_doc_val.first, kwic_sample_probes);
+            return extract_windows<typename topk_interface::token_type>(
+                       m_idx->csa(), m_idx->m_border_select, {m_doc_val.first},
+                       {occ}, m_depth, k)[0];
+        }
+
+        typename topk_interface::pattern_type pattern() const override {
+            return {{{m_sp, m_ep}}, m_depth};
         }
 
         void next() override {
             if (m_valid) {
                 m_valid = false;
-                if (m_k2_iter) {   // multiple occurrence result exists
+                // multiple occurrence results, excluded documents are
+                // marked as reported so no singleton repeats them
+                while (m_k2_iter) {
+                    if (!budget_step())
+                        return;
                     auto xyz_w = *m_k2_iter;
-                    uint64_t doc_id = offset_encoding
-                                      ? m_idx->get_doc(std::get<0>(xyz_w)[0])
-                                      : m_idx->m_doc[std::get<0>(xyz_w)[0]];
+                    // The third coordinate of an arrow is its document,
+                    // so it needs no decoding from the offsets.
+                    uint64_t doc_id = std::get<0>(xyz_w)[2];
+                    m_scratch->docs.insert(doc_id, doc_marks::REPORTED);
+                    ++m_k2_iter;
+                    if (m_idx->is_excluded(doc_id))
+                        continue;
                     m_doc_val = t_doc_val(doc_id, std::get<1>(xyz_w) + 1);
-                    m_reported.insert(doc_id);
+                    m_occ = no_occurrence;
                     m_valid = true;
-                    ++m_k2_iter;
-                } else { // search for singleton results
-                    while (!m_multi_occ and !m_states.empty()) {
-                        auto state = m_states.top();
-                        m_states.pop();
-                        uint64_t min_idx = m_idx->m_rmqc(state[0], state[1]);
-                        uint64_t doc_id  = m_idx->m_border_rank(m_idx->m_csa[min_idx]);
-                        if (m_singletons.find(doc_id) == m_singletons.end()) {
-                            m_singletons.insert(doc_id);
-                            if (min_idx + 1 <= state[1])
-                                m_states.push({min_idx + 1, state[1]});
-                            if (state[0] + 1 <= min_idx)
-                                m_states.push({state[0], min_idx - 1});
-                            if (m_reported.find(doc_id) == m_reported.end()) {
-                                m_doc_val = t_doc_val(doc_id, 1);
-                                m_reported.insert(doc_id);
-                                m_valid = true;
-                                break;
-                            }
+                    return;
+                }
+                // search for singleton results
+                auto& docs = m_scratch->docs;
+                auto& states = m_scratch->states;
+                while (!m_multi_occ and !states.empty() and budget_step()) {
+                    auto state = states.back();
+                    states.pop_back();
+                    uint64_t min_idx = m_idx->m_rmqc(state[0], state[1]);
+                    uint64_t occ = m_idx->csa()[min_idx];
+                    uint64_t doc_id  = m_idx->m_border_rank(occ);
+                    if (docs.insert(doc_id, doc_marks::SINGLETON)) {
+                        if (min_idx + 1 <= state[1])
+                            states.push_back({min_idx + 1, state[1]});
+                        if (state[0] + 1 <= min_idx)
+                            states.push_back({state[0], min_idx - 1});
+                        if (!docs.contains(doc_id, doc_marks::REPORTED)
+                                and !m_idx->is_excluded(doc_id)) {
+                            m_doc_val = t_doc_val(doc_id, 1);
+                            m_occ = occ;
+                            docs.insert(doc_id, doc_marks::REPORTED);
+                            m_valid = true;
+                            break;
                         }
                     }
                 }
@@ -178,6 +205,19 @@ private:
         }
     };
 
+    // SA interval and H range of a pattern.
+    sa_interval interval(range_type sa) const {
+        if (empty(sa))
+            return {sa, {1, 0}};
+        return {sa, m_map_to_h(std::get<0>(sa), std::get<1>(sa))};
+    }
+
+    sa_interval lookup(const token_type* begin, const token_type* end) const {
+        return cached_interval(this->get_interval_cache(), begin, end, [&]() {
+            return interval(sa_range(*m_csa, begin, end));
+        });
+    }
+
 public:
 
     std::unique_ptr<typename topk_interface::iter> topk(
@@ -185,77 +225,67 @@ public:
             const token_type* begin,
             const token_type* end,
             bool multi_occ = false, bool only_match = false) override {
-        if (!multi_occ) {
-            std::cerr << "No singleton queries implemented yet" << std::endl;
-            abort();
-        }
+        return topk(k, lookup(begin, end), end - begin,
+                    multi_occ, only_match);
+    }
+
+    // topk() for the SA interval of a pattern of length depth.
+    std::unique_ptr<typename topk_interface::iter> topk(
+            size_t k, range_type range, uint64_t depth,
+            bool multi_occ = false, bool only_match = false) {
+        return topk(k, interval(range), depth, multi_occ, only_match);
+    }
+
+    std::unique_ptr<typename topk_interface::iter> topk(
+            size_t k, const sa_interval& iv, uint64_t depth,
+            bool multi_occ = false, bool only_match = false) {
         switch (t_treap_algo) {
             case k3_treap_algo::UNORDERED: {
                 return std::make_unique<top_k_iterator>(
-                        this, begin, end, multi_occ, only_match);
+                        this, iv, depth, multi_occ, only_match);
             }
             case k3_treap_algo::DAAT: {
-                m_results.clear();
-                uint64_t sp, ep;
-                bool valid = backward_search(m_csa, 0, m_csa.size() - 1, begin,
-                                            end, sp, ep) > 0;
+                topk_result_set results;
+                uint64_t sp = std::get<0>(iv.sa), ep = std::get<1>(iv.sa);
+                bool valid = !empty(iv.sa);
+                valid &= !only_match;
                 if (valid) {
-                    auto h_range = m_map_to_h(sp, ep);
+                    const auto& h_range = iv.derived;
                     if (!empty(h_range)) {
-                        uint64_t depth = end - begin;
                         auto res = k3_treap_algos::topk_increasing_z(
                                 m_k2treap, k,
                                 std::get<0>(h_range), std::get<1>(h_range),
-                                0, depth - 1);
+                                0, depth - 1, this->get_excluded_docs());
                         for (auto it : res)
-                            m_results.emplace_back(it.second, it.first + 1);
+                            results.emplace_back(it.second, it.first + 1);
+                    }
+                    if (!multi_occ and results.size() < k) {
+                        add_singletons(k, sp, ep, results);
                     }
-                    // TODO singleton results
                 }
-                return sort_topk_results<token_type>(&m_results);
+                return sort_topk_results<token_type>(std::move(results), this, {iv.sa, depth});
             }
         }
     }
 
+    std::vector<topk_result_set> topk_batch(
+            size_t k, const typename topk_interface::batch_query& patterns,
+            bool multi_occ = false, bool only_match = false) override {
+        return surf::topk_batch(*this, *m_csa, k, patterns, multi_occ, only_match);
+    }
+
     std::unique_ptr<typename topk_interface::iter> topk_intersect(
             size_t k, const typename topk_interface::intersect_query& query,
             bool multi_occ = false, bool only_match = false) override {
-        /*
-        std::vector<k3_treap_ns::top_k_iterator<t_k2treap>> iters;
-
-        m_results.clear();
-        for (const auto& q : query) {
-            uint64_t sp, ep;
-            bool valid = backward_search(m_csa, 0, m_csa.size() - 1,
-                                         q.first, q.second, sp, ep) > 0;
-            if (!valid)
-                return sort_topk_results<token_type>(&m_results);
-            auto h_range = m_map_to_h(sp, ep);
-            if (!empty(h_range)) {
-                uint64_t depth = q.second - q.first;
-                auto it = k3_treap_ns::top_k(m_k2treap,
-                        {std::get<0>(h_range), 0, 0},
-                        {std::get<1>(h_range), depth - 1,
-                                std::numeric_limits<uint64_t>::max()});
-                iters.push_back(it);
-            }
-        }
-
-        for (auto it : k3_treap_intersection::k3_treap_intersection(iters, k))
-            m_results.emplace_back(it.first, it.second);
-        return sort_topk_results<token_type>(&m_results);
-        */
-
         std::vector<k3_treap_algos::xy_range> ranges;
 
-        m_results.clear();
+        topk_result_set results;
         for (const auto& q : query) {
-            uint64_t sp, ep;
-            bool valid = backward_search(m_csa, 0, m_csa.size() - 1,
-                                         q.first, q.second, sp, ep) > 0;
-            auto h_range = m_map_to_h(sp, ep);
-            if (!valid || empty(h_range))
-                return sort_topk_results<token_type>(&m_results);
+            auto iv = lookup(q.first, q.second);
+            const auto& h_range = iv.derived;
+            if (empty(iv.sa) || empty(h_range))
+                return sort_topk_results<token_type>(
+                           std::move(results), this, this->first_term(query));
             uint64_t depth = q.second - q.first;
             ranges.emplace_back(
                     k3_treap_algos::xy_point{std::get<0>(h_range), 0},
@@ -275,7 +305,8 @@ public:
                         {0, inf});
                     std::vector<std::pair<uint64_t, double>> tmp, new_res;
                     while (it) {
-                        tmp.emplace_back((*it).first[2], (*it).second + 1);
+                        if (!this->is_excluded((*it).first[2]))
+                            tmp.emplace_back((*it).first[2], (*it).second + 1);
                         ++it;
                     }
                     std::sort(tmp.begin(), tmp.end());
@@ -290,35 +321,83 @@ public:
                     */
 
                     if (i == 0) {
-                        m_results = std::move(tmp);
+                        results = std::move(tmp);
                         continue;
                     }
                     size_t j = 0;
                     for (const auto& doc : tmp) {
-                        while (j < m_results.size() && m_results[j].first < doc.first)
+                        while (j < results.size() && results[j].first < doc.first)
                             ++j;
-                        if (j < m_results.size() && m_results[j].first == doc.first)
-                            new_res.emplace_back(doc.first, m_results[j].second + doc.second);
+                        if (j < results.size() && results[j].first == doc.first)
+                            new_res.emplace_back(doc.first, results[j].second + doc.second);
                     }
-                    m_results = std::move(new_res);
+                    results = std::move(new_res);
                 }
                 break;
             }
             case k3_treap_intersect_algo::DAAT: {
-                res = k3_treap_algos::topk_intersect3(m_k2treap, k, ranges);
+                res = k3_treap_algos::topk_intersect3(m_k2treap, k, ranges, 0,
+                                                      this->get_excluded_docs());
                 break;
             }
             case k3_treap_intersect_algo::DAAT_BINSEARCH: {
                 res = k3_treap_algos::topk_intersect2(m_k2treap, k, ranges,
-                            0, [&](uint64_t w0, uint64_t w) { return w0 + w + 1; });
+                            0, [&](uint64_t w0, uint64_t w) { return w0 + w + 1; },
+                            this->get_excluded_docs());
                 break;
             }
             default: abort();
         }
 
         for (auto it : res)
-            m_results.emplace_back(it.second, it.first);
-        return sort_topk_results<token_type>(&m_results);
+            results.emplace_back(it.second, it.first);
+        return sort_topk_results<token_type>(std::move(results), this, this->first_term(query));
+    }
+
+    std::unique_ptr<typename topk_interface::iter> topk_union(
+        size_t k, const typename topk_interface::intersect_query& query,
+        bool multi_occ = false, bool only_match = false) override {
+        std::vector<std::unique_ptr<typename topk_interface::iter>> lists;
+        for (const auto& q : query)
+            lists.emplace_back(std::make_unique<top_k_iterator>(
+                       this, q.first, q.second, multi_occ, only_match));
+        return sort_topk_results<typename topk_interface::token_type>(
+                   topk_list_algos::topk_union(k, lists, multi_occ), this, this->first_term(query));
+    }
+
+    bool supports_intersect() const override {
+        return true;
+    }
+
+    bool supports_union() const override {
+        return true;
+    }
+
+    // Fill results up to k entries with documents which contain
+    // the pattern exactly once. These are not stored in the treap
+    // and are found by RMQ over the C array of [sp, ep].
+    void add_singletons(size_t k, uint64_t sp, uint64_t ep,
+                        topk_result_set& results) const {
+        auto scratch = topk_scratch::acquire(doc_cnt() + 1);
+        auto& docs = scratch->docs;
+        auto& states = scratch->states;
+        for (const auto& res : results)
+            docs.insert(res.first, doc_marks::REPORTED);
+        states.push_back({sp, ep});
+        while (results.size() < k and !states.empty() and budget_step()) {
+            auto state = states.back();
+            states.pop_back();
+            uint64_t min_idx = m_rmqc(state[0], state[1]);
+            uint64_t doc_id  = m_border_rank((*m_csa)[min_idx]);
+            if (docs.insert(doc_id, doc_marks::SINGLETON)) {
+                if (min_idx + 1 <= state[1])
+                    states.push_back({min_idx + 1, state[1]});
+                if (state[0] + 1 <= min_idx)
+                    states.push_back({state[0], min_idx - 1});
+                if (docs.insert(doc_id, doc_marks::REPORTED) and !this->is_excluded(doc_id))
+                    results.emplace_back(doc_id, 1);
+            }
+        }
     }
 
     // Decode m_doc value at postion index by using offset encoding.
@@ -333,32 +412,56 @@ public:
             m_doc_offset_select(index + 1) - m_doc_offset_select(base_index);
         --sa_delta; // Because zero deltas can't be encoded otherwise.
         uint64_t sa_pos = sa_base_pos + sa_delta;
-        uint64_t text_pos = m_csa[sa_pos];
+        uint64_t text_pos = (*m_csa)[sa_pos];
         return m_border_rank(text_pos);
     }
 
 
-    auto doc(uint64_t doc_id) -> decltype(extract(m_csa, 0, 0)) {
+    auto doc(uint64_t doc_id) -> decltype(extract(*m_csa, 0, 0)) {
         size_type doc_begin = 0;
         if (doc_id) {
             doc_begin = m_border_select(doc_id) + 1;
         }
         size_type doc_end = m_border_select(doc_id + 1) - 1;
-        auto res = extract(m_csa, doc_begin, doc_end);
+        auto res = extract(*m_csa, doc_begin, doc_end);
         return res;
     }
 
+    std::vector<typename topk_interface::snippet_type>
+    extract_docs(const std::vector<uint64_t>& docs, size_t k,
+                 const typename topk_interface::pattern_type& pattern) const override {
+        return extract_snippets(*m_csa, m_border_rank, m_border_select, docs, k, pattern);
+    }
+
+    std::vector<std::vector<uint64_t>>
+    locate_docs(const std::vector<uint64_t>& docs, size_t max_positions,
+                const typename topk_interface::pattern_type& pattern) const override {
+        return doc_positions(*m_csa, m_border_rank, m_border_select, docs, max_positions, pattern);
+    }
+
     uint64_t doc_cnt() const {
-        return m_border_rank(m_csa.size());
+        return m_border_rank(m_csa->size());
+    }
+
+    const csa_type& csa() const {
+        return *m_csa;
     }
 
     uint64_t word_cnt() const {
-        return m_csa.size() - doc_cnt();
+        return m_csa->size() - doc_cnt();
     }
 
 
     void load(sdsl::cache_config& cc) {
-        load_from_cache(m_csa, surf::KEY_CSA, cc, true);
+        auto csa = std::make_shared<csa_type>();
+        load_from_cache(*csa, surf::KEY_CSA, cc, true);
+        load(cc, std::move(csa));
+    }
+
+    //! Loads the index with a CSA of the collection which is loaded
+    //! already, e.g. the one idx_planner shares between its indexes.
+    void load(sdsl::cache_config& cc, std::shared_ptr<const csa_type> csa) {
+        m_csa = std::move(csa);
         if (offset_encoding) {
             load_from_cache(m_doc_offset, surf::KEY_DOC_OFFSET, cc, true);
             load_from_cache(m_doc_offset_select, surf::KEY_DOC_OFFSET_SELECT, cc, true);
@@ -384,12 +487,15 @@ public:
             load_from_cache(m_k2treap, surf::KEY_W_AND_P + "_k3", cc, true);
     }
 
+    // write_csa is false if the CSA is shared and written once by the
+    // owner, see idx_planner.
     size_type serialize(std::ostream& out, structure_tree_node* v = nullptr,
-                        std::string name = "") const {
+                        std::string name = "", bool write_csa = true) const {
         structure_tree_node* child = structure_tree::add_child(v, name,
                                      util::class_name(*this));
         size_type written_bytes = 0;
-        written_bytes += m_csa.serialize(out, child, "CSA");
+        if (write_csa)
+            written_bytes += m_csa->serialize(out, child, "CSA");
         if (offset_encoding) {
             written_bytes += m_doc_offset.serialize(out, child, "DOC_OFFSET");
             written_bytes += m_doc_offset_select.serialize(out, child,
@@ -410,7 +516,7 @@ public:
 
     void mem_info()const {
         std::cout << "Dupsize " << m_doc.size() << std::endl;
-        std::cout << sdsl::size_in_bytes(m_csa) +
+        std::cout << sdsl::size_in_bytes(*m_csa) +
                   sdsl::size_in_bytes(m_border) +
                   sdsl::size_in_bytes(m_border_rank) << ";"; // CSA
         if (offset_encoding) {
@@ -11,10 +11,14 @@
 #include "sdsl/rrr_vector.hpp"
 #include "sdsl/suffix_trees.hpp"
 #include "sdsl/k2_treap.hpp"
+#include "surf/backward_search_batch.hpp"
 #include "surf/construct_col_len.hpp"
 #include "surf/df_sada.hpp"
+#include "surf/doc_blocks.hpp"
 #include "surf/rank_functions.hpp"
+#include "surf/snippets.hpp"
 #include "surf/topk_interface.hpp"
+#include "surf/topk_list_algos.hpp"
 
 namespace surf {
 
@@ -33,7 +37,8 @@ template<typename t_csa,
          typename t_h_select_0 = typename t_h::select_0_type,
          typename t_h_select_1 = typename t_h::select_1_type,
          bool     offset_encoding = false,
-         typename t_doc_offset = sdsl::hyb_sd_vector<>
+         typename t_doc_offset = sdsl::hyb_sd_vector<>,
+         typename t_doc = sdsl::int_vector<>
          >
 class idx_nn_quantile
     : public topk_index_by_alphabet<typename t_csa::alphabet_category>::type {
@@ -52,17 +57,20 @@ public:
     typedef t_doc_offset                               doc_offset_type;
     typedef typename t_doc_offset::select_1_type       doc_offset_select_type;
     typedef map_to_dup_type<h_select_1_type>           map_to_h_type;
+    typedef t_doc                                      doc_type;
 
     using qfilter_type = rrr_vector<>;
 
     using topk_interface = typename topk_index_by_alphabet<alphabet_category>::type;
+    // The grid does not distinguish documents which contain the pattern once.
+    static constexpr bool supports_multi_occ = false;
 
     static constexpr string QUANTILE_SUFFIX() {
         return string("_q") + std::to_string(quantile);
     };
 
 private:
-    csa_type           m_csa;
+    std::shared_ptr<const csa_type> m_csa = std::make_shared<csa_type>(); // may be shared, see load()
     border_type        m_border;
     border_rank_type   m_border_rank;
     border_select_type m_border_select;
@@ -72,57 +80,190 @@ private:
     typename h_type::rank_1_type m_h_rank;
     doc_offset_type    m_doc_offset; // offset representation of documents in node list
     doc_offset_select_type m_doc_offset_select;
-    int_vector<>       m_doc; // documents in node lists
+    doc_type           m_doc; // documents in node lists
     k2treap_type       m_k2treap;
     map_to_h_type      m_map_to_h;
-    topk_result_set    m_results;
 
     qfilter_type m_quantile_filter;
     qfilter_type::rank_1_type m_quantile_filter_rank;
     qfilter_type::select_1_type m_quantile_filter_select;
 
-    // Using k2treap.
-    void getTopK(k2treap_iterator k2_iter, uint64_t k) {
-        while (k2_iter && k != 0) {
-            auto xy_w = *k2_iter;
-            uint64_t arrow_id = real(xy_w.first);
-            uint64_t doc_id;
-            if (offset_encoding) {
-                uint64_t h_id = m_quantile_filter_select(arrow_id+1);
-                if (m_h[h_id]) { // Singleton.
-                    doc_id = sa_to_doc(m_h_rank(h_id));
-                } else{
-                    uint64_t ones = m_h_rank(h_id); // Offset id.
-                    uint64_t zeros = h_id - ones;
-                    uint64_t zeros_start = m_h_select_1(ones) - ones;
-                    assert(zeros_start < zeros);
-                    uint64_t p = ones + 
-                        m_doc_offset_select(zeros+2) - m_doc_offset_select(zeros_start+2);
-                    doc_id = sa_to_doc(p-1);
-                }
-            } else {
-                //std::cerr << "arrow_id = " << arrow_id << " #m_doc=" << m_doc.size() << endl;
-                doc_id = m_doc[arrow_id];
-                //std::cerr << "decode: " << doc_id << " " << arrow_id << std::endl;
+    // Decode the document of an arrow of the filtered grid.
+    uint64_t arrow_to_doc(uint64_t arrow_id) const {
+        if (offset_encoding) {
+            uint64_t h_id = m_quantile_filter_select(arrow_id+1);
+            if (m_h[h_id]) { // Singleton.
+                return sa_to_doc(m_h_rank(h_id));
+            } else{
+                uint64_t ones = m_h_rank(h_id); // Offset id.
+                uint64_t zeros = h_id - ones;
+                uint64_t zeros_start = m_h_select_1(ones) - ones;
+                assert(zeros_start < zeros);
+                uint64_t p = ones +
+                    m_doc_offset_select(zeros+2) - m_doc_offset_select(zeros_start+2);
+                return sa_to_doc(p-1);
             }
-            m_results.push_back(topk_result(doc_id, xy_w.second));
+        } else {
+            //std::cerr << "arrow_id = " << arrow_id << " #m_doc=" << m_doc.size() << endl;
+            return m_doc[arrow_id];
+        }
+    }
+
+    // Using k2treap. Only the first grid_size items of the grid are
+    // guaranteed to be the most frequent documents. Returns false if
+    // excluded documents used them up before k results were found.
+    bool getTopK(k2treap_iterator k2_iter, uint64_t k, uint64_t grid_size,
+                 topk_result_set& results) const {
+        bool skipped = false;
+        while (k2_iter && k != 0 && budget_step()) {
+            if (grid_size-- == 0)
+                return false;
+            auto xy_w = *k2_iter;
+            uint64_t doc_id = arrow_to_doc(real(xy_w.first));
             ++k2_iter;
+            if (this->is_excluded(doc_id)) {
+                skipped = true;
+                continue;
+            }
+            results.push_back(topk_result(doc_id, xy_w.second));
             k--;
         }
+        return k == 0 or !skipped or k2_iter;
     }
-    // Naive fallback.
-    void getTopK(uint64_t s, uint64_t e) {
+
+    std::unordered_map<uint64_t, uint64_t> count_docs(uint64_t s, uint64_t e) const {
         std::unordered_map<uint64_t, uint64_t> counts;
         //std::cerr << s << "---" << e << std::endl;
-        for (size_t i = s; i <= e; ++i) {
+        for (size_t i = s; i <= e and budget_step(); ++i) {
             uint64_t doc_id = sa_to_doc(i);
             counts[doc_id]++;
         }
+        return counts;
+    }
+
+    // SA interval and the range of the filtered grid of a pattern. The
+    // grid range is empty if it contains no samples.
+    sa_interval interval(range_type sa) const {
+        using std::get;
+        if (empty(sa) or get<0>(sa) == get<1>(sa))
+            return {sa, {1, 0}};
+        // round up to succeeding sample
+        uint64_t from = m_quantile_filter_rank(m_h_select_1(get<0>(sa)+1));
+        // round down to preceding sample (`to` is exclusive!)
+        uint64_t to = m_quantile_filter_rank(m_h_select_1(get<1>(sa)+1)+1);
+        if (from < to)
+            return {sa, {from, to - 1}};
+        return {sa, {1, 0}};
+    }
+
+    sa_interval lookup(const typename topk_interface::token_type* begin,
+                       const typename topk_interface::token_type* end) const {
+        return cached_interval(this->get_interval_cache(), begin, end, [&]() {
+            return interval(sa_range(*m_csa, begin, end));
+        });
+    }
+
+    // Naive fallback.
+    void getTopK(uint64_t s, uint64_t e, topk_result_set& results) const {
         // TODO only take top k.
-        for (const auto res : counts)
-            m_results.push_back(topk_result(res.first, res.second));
+        for (const auto res : count_docs(s, e))
+            if (!this->is_excluded(res.first))
+                results.push_back(topk_result(res.first, res.second));
     }
 
+    // Returns (doc, freq) pairs of a lexicographic range in non-increasing
+    // frequency order. The grid is only guaranteed to contain the
+    // (ep-sp+1)/quantile most frequent documents of the range, so we take
+    // at most that many from it and count the remaining documents naively
+    // if more are requested.
+    class term_iterator : public topk_interface::iter {
+    private:
+        const idx_nn_quantile* m_idx;
+        uint64_t           m_sp, m_ep;
+        uint64_t           m_depth; // length of the pattern
+        mutable occurrence_sample m_sample;
+        k2treap_iterator   m_k2_iter;
+        uint64_t           m_grid_left = 0; // guaranteed grid items left
+        bool               m_naive = false; // true, if counting was done
+        std::unordered_set<uint64_t> m_reported;
+        topk_result_set    m_rest;  // naive results, sorted
+        size_t             m_rest_idx = 0;
+        topk_result        m_doc_val;
+        bool               m_valid = false;
+
+    public:
+        term_iterator(const idx_nn_quantile* idx, const sa_interval& iv,
+                      uint64_t depth, size_t k)
+            : m_idx(idx), m_sp(std::get<0>(iv.sa)), m_ep(std::get<1>(iv.sa)),
+              m_depth(depth) {
+            uint64_t interval_size = m_ep - m_sp + 1;
+            const auto& grid = iv.derived;
+            if (interval_size >= k*quantile && interval_size > 1 && !empty(grid)) {
+                m_k2_iter = k2_treap_ns::top_k(m_idx->m_k2treap,
+                                               {std::get<0>(grid), 0},
+                                               {std::get<1>(grid), depth - 1});
+                m_grid_left = interval_size / quantile;
+            }
+            m_valid = true;
+            next();
+        }
+
+        topk_result get() const override {
+            return m_doc_val;
+        }
+
+        bool done() const override {
+            return !m_valid;
+        }
+
+        void next() override {
+            m_valid = false;
+            while (!m_naive and m_grid_left) {
+                if (!m_k2_iter)  // the grid contains all documents
+                    return;
+                if (!budget_step())
+                    return;
+                auto xy_w = *m_k2_iter;
+                m_doc_val = topk_result(m_idx->arrow_to_doc(real(xy_w.first)),
+                                        xy_w.second);
+                m_reported.insert(m_doc_val.first);
+                ++m_k2_iter;
+                --m_grid_left;
+                if (!m_idx->is_excluded(m_doc_val.first)) {
+                    m_valid = true;
+                    return;
+                }
+            }
+            if (!m_naive) {
+                for (const auto res : m_idx->count_docs(m_sp, m_ep))
+                    if (m_reported.find(res.first) == m_reported.end()
+                            and !m_idx->is_excluded(res.first))
+                        m_rest.emplace_back(res.first, res.second);
+                std::sort(m_rest.begin(), m_rest.end(),
+                          [](const topk_result& a, const topk_result& b) {
+                              return std::make_pair(-a.second, a.first) <
+                                  std::make_pair(-b.second, b.first);
+                          });
+                m_naive = true;
+            }
+            if (m_rest_idx == m_rest.size())
+                return;
+            m_doc_val = m_rest[m_rest_idx++];
+            m_valid = true;
+        }
+
+        typename topk_interface::snippet_type extract_snippet(const size_t k) const override {
+            uint64_t occ = m_sample.find(m_idx->csa(), m_idx->m_border_rank, {{m_sp, m_ep}},
+                                         m_doc_val.first, kwic_sample_probes);
+            return extract_windows<typename topk_interface::token_type>(
+                       m_idx->csa(), m_idx->m_border_select, {m_doc_val.first},
+                       {occ}, m_depth, k)[0];
+        }
+
+        typename topk_interface::pattern_type pattern() const override {
+            return {{{m_sp, m_ep}}, m_depth};
+        }
+    };
 
 public:
 
@@ -131,11 +272,24 @@ public:
         const typename topk_interface::token_type* begin,
         const typename topk_interface::token_type* end,
         bool multi_occ, bool only_match) override {
+            return topk(k, lookup(begin, end), end - begin,
+                        multi_occ, only_match);
+    }
+
+    // topk() for the SA interval of a pattern of length depth.
+    std::unique_ptr<typename topk_interface::iter> topk(
+        size_t k, range_type range, uint64_t depth,
+        bool multi_occ, bool only_match) {
+            return topk(k, interval(range), depth, multi_occ, only_match);
+    }
+
+    std::unique_ptr<typename topk_interface::iter> topk(
+        size_t k, const sa_interval& iv, uint64_t depth,
+        bool multi_occ, bool only_match) {
             using std::get;
-            m_results.clear();
-            uint64_t sp, ep;
-            bool valid = backward_search(m_csa, 0, m_csa.size() - 1,
-                                      begin, end, sp, ep) > 0;
+            topk_result_set results;
+            uint64_t sp = get<0>(iv.sa), ep = get<1>(iv.sa);
+            bool valid = !empty(iv.sa);
             //std::cerr << "sp ep = " << sp << " " << ep << std::endl;
             valid &= !only_match;
             uint64_t interval_size = 0;
@@ -146,36 +300,70 @@ public:
                 // interval_size > 1 handles the special case interval_size = quantile = k = 1
                 if (interval_size >= k*quantile && interval_size > 1) { // Use grid.
                     //std::cerr << "using grid" << std::endl;
-                    uint64_t depth = end - begin;
-
-                    // round up to succeeding sample
-                    uint64_t from = m_quantile_filter_rank(m_h_select_1(sp+1));
-                    // round down to preceding sample (`to` is exclusive!)
-                    uint64_t to = m_quantile_filter_rank(m_h_select_1(ep+1)+1);
-
-                    //std::cerr
-                        //<< "x range = " << get<0>(h_range) << " " << get<1>(h_range)
-                        //<< " q range = " << from << "-" << to
-                        //<< " depth range = 0-" << depth-1 << std::endl;
-
-                    if (from < to) {
-                        --to;
-                        if (from <= to) {
-                            getTopK(k2_treap_ns::top_k(m_k2treap,
-                                        {from, 0},
-                                        {to, depth - 1}),
-                                    k);
-                        }
+                    const auto& grid = iv.derived;
+                    if (!empty(grid) and !getTopK(k2_treap_ns::top_k(m_k2treap,
+                                                      {get<0>(grid), 0},
+                                                      {get<1>(grid), depth - 1}),
+                                                  k, interval_size / quantile, results)) {
+                        results.clear();
+                        getTopK(sp, ep, results);
                     }
                 } else { // Naive fallback.
                     //std::cerr << "fallback" << std::endl;
-                    getTopK(sp, ep);
+                    getTopK(sp, ep, results);
                 }
             }
 
             if (this->get_debug_stream())
                 (*this->get_debug_stream()) << "INTERVAL_SIZE;" << interval_size << "\n";
-            return sort_topk_results<typename topk_interface::token_type>(&m_results);
+            return sort_topk_results<typename topk_interface::token_type>(
+                       std::move(results), this, {iv.sa, depth});
+    }
+
+    std::vector<topk_result_set> topk_batch(
+        size_t k, const typename topk_interface::batch_query& patterns,
+        bool multi_occ, bool only_match) override {
+            return surf::topk_batch(*this, *m_csa, k, patterns, multi_occ, only_match);
+    }
+
+    std::unique_ptr<typename topk_interface::iter> topk_intersect(
+        size_t k, const typename topk_interface::intersect_query& query,
+        bool multi_occ, bool only_match) override {
+            std::vector<std::unique_ptr<term_iterator>> lists;
+            for (const auto& q : query) {
+                auto iv = lookup(q.first, q.second);
+                if (empty(iv.sa) or only_match)
+                    return sort_topk_results<typename topk_interface::token_type>(
+                               {}, this, this->first_term(query));
+                lists.emplace_back(std::make_unique<term_iterator>(
+                            this, iv, q.second - q.first, k));
+            }
+            return sort_topk_results<typename topk_interface::token_type>(
+                       topk_list_algos::topk_intersect(k, lists, multi_occ), this,
+                       this->first_term(query));
+    }
+
+    std::unique_ptr<typename topk_interface::iter> topk_union(
+        size_t k, const typename topk_interface::intersect_query& query,
+        bool multi_occ, bool only_match) override {
+            std::vector<std::unique_ptr<term_iterator>> lists;
+            for (const auto& q : query) {
+                auto iv = lookup(q.first, q.second);
+                if (!empty(iv.sa) and !only_match)
+                    lists.emplace_back(std::make_unique<term_iterator>(
+                                this, iv, q.second - q.first, k));
+            }
+            return sort_topk_results<typename topk_interface::token_type>(
+                       topk_list_algos::topk_union(k, lists, multi_occ), this,
+                       this->first_term(query));
+    }
+
+    bool supports_intersect() const override {
+        return true;
+    }
+
+    bool supports_union() const override {
+        return true;
     }
 
     // Decode m_doc value at postion index by using offset encoding.
@@ -193,38 +381,63 @@ public:
         return sa_to_doc(sa_base_pos + sa_delta);
     }
 
-    auto doc(uint64_t doc_id) -> decltype(extract(m_csa, 0, 0)) {
+    auto doc(uint64_t doc_id) -> decltype(extract(*m_csa, 0, 0)) {
         size_type doc_begin = 0;
         if (doc_id) {
             doc_begin = m_border_select(doc_id) + 1;
         }
         size_type doc_end = m_border_select(doc_id + 1) - 1;
-        auto res = extract(m_csa, doc_begin, doc_end);
+        auto res = extract(*m_csa, doc_begin, doc_end);
         return res;
     }
 
     uint64_t sa_to_doc(const uint64_t sa_pos) const {
-        return m_border_rank(m_csa[sa_pos]);
+        return m_border_rank((*m_csa)[sa_pos]);
+    }
+
+    std::vector<typename topk_interface::snippet_type>
+    extract_docs(const std::vector<uint64_t>& docs, size_t k,
+                 const typename topk_interface::pattern_type& pattern) const override {
+        return extract_snippets(*m_csa, m_border_rank, m_border_select, docs, k, pattern);
+    }
+
+    std::vector<std::vector<uint64_t>>
+    locate_docs(const std::vector<uint64_t>& docs, size_t max_positions,
+                const typename topk_interface::pattern_type& pattern) const override {
+        return doc_positions(*m_csa, m_border_rank, m_border_select, docs, max_positions, pattern);
     }
 
     uint64_t doc_cnt() const {
-        return m_border_rank(m_csa.size());
+        return m_border_rank(m_csa->size());
+    }
+
+    const csa_type& csa() const {
+        return *m_csa;
     }
 
     uint64_t word_cnt() const {
-        return m_csa.size() - doc_cnt();
+        return m_csa->size() - doc_cnt();
     }
 
 
     void load(sdsl::cache_config& cc) {
-        load_from_cache(m_csa, surf::KEY_CSA, cc, true);
+        auto csa = std::make_shared<csa_type>();
+        load_from_cache(*csa, surf::KEY_CSA, cc, true);
+        load(cc, std::move(csa));
+    }
+
+    //! Loads the index with a CSA of the collection which is loaded
+    //! already, e.g. the one idx_planner shares between its indexes.
+    void load(sdsl::cache_config& cc, std::shared_ptr<const csa_type> csa) {
+        m_csa = std::move(csa);
         if (offset_encoding) {
             // TODO(niklasb) don't forget to use QUANTILE_SUFFIX if we ever fix this
             load_from_cache(m_doc_offset, surf::KEY_DOC_OFFSET + QUANTILE_SUFFIX(), cc, true);
             load_from_cache(m_doc_offset_select, surf::KEY_DOC_OFFSET_SELECT + QUANTILE_SUFFIX(), cc, true);
             m_doc_offset_select.set_vector(&m_doc_offset);
         } else {
-            load_from_cache(m_doc, surf::KEY_DUP_G + QUANTILE_SUFFIX(), cc);
+            load_from_cache(m_doc, surf::KEY_DUP_G + QUANTILE_SUFFIX(), cc,
+                            !is_plain_doc_array<doc_type>::value);
         }
 
         load_from_cache(m_quantile_filter,
@@ -259,12 +472,15 @@ public:
         load_from_cache(m_k2treap, key_w_and_p + QUANTILE_SUFFIX(), cc, true);
     }
 
+    // write_csa is false if the CSA is shared and written once by the
+    // owner, see idx_planner.
     size_type serialize(std::ostream& out, structure_tree_node* v = nullptr,
-                        std::string name = "")const {
+                        std::string name = "", bool write_csa = true)const {
         structure_tree_node* child = structure_tree::add_child(v, name,
                                      util::class_name(*this));
         size_type written_bytes = 0;
-        written_bytes += m_csa.serialize(out, child, "CSA");
+        if (write_csa)
+            written_bytes += m_csa->serialize(out, child, "CSA");
         if (offset_encoding) {
             written_bytes += m_doc_offset.serialize(out, child, "DOC_OFFSET");
             written_bytes += m_doc_offset_select.serialize(out, child,
@@ -288,7 +504,7 @@ public:
 
     void mem_info()const {
         std::cout << "Dupsize " << m_doc.size() << std::endl;
-        std::cout << sdsl::size_in_bytes(m_csa) +
+        std::cout << sdsl::size_in_bytes(*m_csa) +
                   sdsl::size_in_bytes(m_border) +
                   sdsl::size_in_bytes(m_border_rank) << ";"; // CSA
         if (offset_encoding) {
@@ -327,19 +543,26 @@ template<typename t_csa,
          typename t_h_select_0,
          typename t_h_select_1,
          bool     offset_encoding,
-         typename t_doc_offset
+         typename t_doc_offset,
+         typename t_doc
          >
 void construct(idx_nn_quantile<t_csa, t_k2treap, quantile, max_query_length, t_border, t_border_rank,
                t_border_select, t_h, t_h_select_0, t_h_select_1, offset_encoding,
-               t_doc_offset>& idx, const std::string&, sdsl::cache_config& cc,
+               t_doc_offset, t_doc>& idx, const std::string&, sdsl::cache_config& cc,
                uint8_t num_bytes) {
     using namespace sdsl;
     using namespace std;
+#ifdef QUANTILE_DF_TYPE
+    // Configs which also build other indexes, e.g. for idx_planner, need
+    // a separate DF type with the quantile H mapping.
+    using t_df = QUANTILE_DF_TYPE;
+#else
     using t_df = DF_TYPE;
+#endif
     using cst_type = typename t_df::cst_type;
     using t_wtd = WTD_TYPE;
     using idx_type = idx_nn_quantile<t_csa, t_k2treap, quantile, max_query_length, t_border, t_border_rank,
-          t_border_select, t_h, t_h_select_0, t_h_select_1, offset_encoding, t_doc_offset>;
+          t_border_select, t_h, t_h_select_0, t_h_select_1, offset_encoding, t_doc_offset, t_doc>;
     using doc_offset_type = typename idx_type::doc_offset_type;
     using timer = chrono::high_resolution_clock;
     using qfilter_type = rrr_vector<>;
@@ -833,6 +1056,15 @@ void construct(idx_nn_quantile<t_csa, t_k2treap, quantile, max_query_length, t_b
         sdsl::remove(W_and_P_file + ".y");
         sdsl::remove(W_and_P_file + ".w");
     }
+    if (!offset_encoding and !is_plain_doc_array<t_doc>::value) {
+        cout << "...DOC" << endl;
+        if (!cache_file_exists<t_doc>(key_dup + idx_type::QUANTILE_SUFFIX(), cc)) {
+            int_vector<> dup;
+            load_from_cache(dup, key_dup + idx_type::QUANTILE_SUFFIX(), cc);
+            t_doc doc(dup);
+            store_to_cache(doc, key_dup + idx_type::QUANTILE_SUFFIX(), cc, true);
+        }
+    }
 }
 
 } // end namespace surf
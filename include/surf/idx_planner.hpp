@@ -0,0 +1,564 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <random>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "surf/backward_search_batch.hpp"
+#include "surf/compact_result.hpp"
+#include "surf/config.hpp"
+#include "surf/topk_interface.hpp"
+
+namespace surf {
+
+// Indexes can declare that they do not handle multi_occ correctly with
+//   static constexpr bool supports_multi_occ = false;
+// and that they need it with supports_singletons(). The planner does not
+// route such queries to them; if no index can answer a query, topk()
+// aborts like the unsupported queries of topk_index.
+template<typename t_idx, typename = void>
+struct planner_supports_multi_occ : std::true_type {};
+
+template<typename t_idx>
+struct planner_supports_multi_occ<t_idx,
+        typename std::enable_if<!t_idx::supports_multi_occ>::type>
+    : std::false_type {};
+
+// True if t_idx can be loaded with a CSA of type t_csa which is loaded
+// already, with load(cc, csa), and written without it, with
+// serialize(out, v, name, false).
+template<typename t_idx, typename t_csa, typename = void>
+struct planner_shares_csa : std::false_type {};
+
+template<typename t_idx, typename t_csa>
+struct planner_shares_csa<t_idx, t_csa,
+        decltype(std::declval<t_idx&>().load(std::declval<sdsl::cache_config&>(),
+                                             std::declval<std::shared_ptr<const t_csa>>()))>
+    : std::true_type {};
+
+//! Linear model of the query time of one index.
+/*!
+ * The features are the size of the SA interval, k, the pattern length and
+ * k * log2(size). The weights are fitted by least squares on timings of a
+ * calibration run.
+ */
+class planner_cost_model {
+public:
+    static constexpr size_t features = 5;
+    using feature_type = std::array<double, features>;
+    using size_type = sdsl::int_vector<>::size_type;
+
+private:
+    feature_type m_w{{0, 0, 0, 0, 0}};
+
+public:
+    static feature_type features_of(uint64_t size, uint64_t k, uint64_t depth) {
+        return {{1.0, (double)size, (double)k, (double)depth,
+                 k * std::log2(size + 1.0)}};
+    }
+
+    double predict(uint64_t size, uint64_t k, uint64_t depth) const {
+        auto x = features_of(size, k, depth);
+        double res = 0;
+        for (size_t i = 0; i < features; ++i)
+            res += m_w[i] * x[i];
+        return std::max(res, 0.0);
+    }
+
+    //! Least squares fit of the weights, y[i] is the time of sample x[i].
+    void fit(const std::vector<feature_type>& x, const std::vector<double>& y) {
+        // Scale the features to [0, 1] to keep the normal equations stable.
+        feature_type scale;
+        scale.fill(1.0);
+        for (const auto& xi : x)
+            for (size_t j = 0; j < features; ++j)
+                scale[j] = std::max(scale[j], std::abs(xi[j]));
+        std::array<std::array<double, features + 1>, features> a{};
+        for (size_t s = 0; s < x.size(); ++s) {
+            for (size_t i = 0; i < features; ++i) {
+                for (size_t j = 0; j < features; ++j)
+                    a[i][j] += x[s][i] / scale[i] * x[s][j] / scale[j];
+                a[i][features] += x[s][i] / scale[i] * y[s];
+            }
+        }
+        for (size_t i = 0; i < features; ++i)
+            a[i][i] += 1e-9 * x.size(); // ridge, for collinear features
+        // Gaussian elimination with partial pivoting.
+        for (size_t c = 0; c < features; ++c) {
+            size_t p = c;
+            for (size_t r = c + 1; r < features; ++r)
+                if (std::abs(a[r][c]) > std::abs(a[p][c]))
+                    p = r;
+            std::swap(a[c], a[p]);
+            if (a[c][c] == 0)
+                continue;
+            for (size_t r = 0; r < features; ++r) {
+                if (r == c)
+                    continue;
+                double f = a[r][c] / a[c][c];
+                for (size_t j = c; j <= features; ++j)
+                    a[r][j] -= f * a[c][j];
+            }
+        }
+        for (size_t i = 0; i < features; ++i)
+            m_w[i] = a[i][i] == 0 ? 0 : a[i][features] / a[i][i] / scale[i];
+    }
+
+    const feature_type& weights() const {
+        return m_w;
+    }
+
+    size_type serialize(std::ostream& out, sdsl::structure_tree_node* v = nullptr,
+                        std::string name = "") const {
+        using namespace sdsl;
+        structure_tree_node* child = structure_tree::add_child(
+                                         v, name, util::class_name(*this));
+        size_type written_bytes = 0;
+        for (const auto& w : m_w)
+            written_bytes += write_member(w, out, child, "w");
+        structure_tree::add_size(child, written_bytes);
+        return written_bytes;
+    }
+
+    void load(std::istream& in) {
+        for (auto& w : m_w)
+            sdsl::read_member(w, in);
+    }
+};
+
+//! Routes each top-k query to the index which is expected to answer it fastest.
+/*!
+ * All indexes are built over the same collection and use the same CSA
+ * type. The backward search is done once with the CSA of the first index,
+ * then the cost of each index is estimated from the size of the SA
+ * interval, k and the pattern length, and the query is passed on to the
+ * cheapest one with the SA interval. Indexes without a topk() for SA
+ * intervals get the pattern.
+ *
+ * The cost models are fitted by calibrate() during construction and stored
+ * in the cache. Intersections and unions go to the index with the lowest
+ * estimated cost of the single terms among those which implement them.
+ *
+ * The indexes which load their CSA with load(cc, csa) share one CSA, so
+ * it is held in memory and serialized once. The SA interval cache of the
+ * planner holds the intervals it plans with; each index gets a cache of
+ * the same capacity for its own ranges.
+ *
+ * Usage in a config:
+ *   INDEX_TYPE=surf::idx_planner<surf::idx_nn<...>, surf::idx_nn_quantile<...>>
+ *
+ * \tparam t_idx The indexes. The first one has to provide csa().
+ */
+template<typename... t_idx>
+class idx_planner
+    : public std::tuple_element<0, std::tuple<t_idx...>>::type::topk_interface {
+public:
+    using first_type = typename std::tuple_element<0, std::tuple<t_idx...>>::type;
+    using alphabet_category = typename first_type::alphabet_category;
+    using topk_interface = typename first_type::topk_interface;
+    using token_type = typename topk_interface::token_type;
+    using size_type = sdsl::int_vector<>::size_type;
+    using csa_type = typename first_type::csa_type;
+    // float if any of the indexes scores its results
+    using compact_weight_type = typename std::common_type<
+        typename compact_weight<t_idx>::type...>::type;
+    static constexpr size_t index_cnt = sizeof...(t_idx);
+
+private:
+    using index_sequence = std::make_index_sequence<index_cnt>;
+
+    std::tuple<t_idx...>            m_indexes;
+    std::shared_ptr<const csa_type> m_csa; // shared, see planner_shares_csa
+    std::vector<planner_cost_model> m_models; // [2 * index + multi_occ]
+    std::unique_ptr<std::atomic<uint64_t>[]> m_routed{new std::atomic<uint64_t>[index_cnt]()};
+
+    template<typename t_fn, size_t... I>
+    void for_each_index(t_fn fn, std::index_sequence<I...>) {
+        int dummy[] = {0, (fn(std::get<I>(m_indexes), I), 0)...};
+        (void)dummy;
+    }
+
+    template<typename t_fn, size_t... I>
+    void for_each_index(t_fn fn, std::index_sequence<I...>) const {
+        int dummy[] = {0, (fn(std::get<I>(m_indexes), I), 0)...};
+        (void)dummy;
+    }
+
+    template<typename t_fn>
+    void for_each_index(t_fn fn) {
+        for_each_index(fn, index_sequence());
+    }
+
+    template<typename t_fn>
+    void for_each_index(t_fn fn) const {
+        for_each_index(fn, index_sequence());
+    }
+
+    template<typename t_index>
+    static bool supports(const t_index& idx, bool multi_occ) {
+        return multi_occ ? planner_supports_multi_occ<t_index>::value
+                         : idx.supports_singletons();
+    }
+
+    // Prefer the topk() for SA intervals, fall back to the pattern.
+    template<typename t_index>
+    static auto dispatch(t_index& idx, size_t k, range_type range,
+                         const token_type* begin, const token_type* end,
+                         bool multi_occ, bool only_match, int)
+    -> decltype(idx.topk(k, range, (uint64_t)0, multi_occ, only_match)) {
+        return idx.topk(k, range, end - begin, multi_occ, only_match);
+    }
+
+    template<typename t_index>
+    static std::unique_ptr<typename topk_interface::iter>
+    dispatch(t_index& idx, size_t k, range_type,
+             const token_type* begin, const token_type* end,
+             bool multi_occ, bool only_match, long) {
+        return idx.topk(k, begin, end, multi_occ, only_match);
+    }
+
+    // Loads idx with the shared CSA if it takes one.
+    template<typename t_index>
+    void load_index(t_index& idx, sdsl::cache_config& cc, std::true_type) const {
+        idx.load(cc, m_csa);
+    }
+
+    template<typename t_index>
+    void load_index(t_index& idx, sdsl::cache_config& cc, std::false_type) const {
+        idx.load(cc);
+    }
+
+    template<typename t_index>
+    static size_type serialize_index(const t_index& idx, std::ostream& out,
+                                     sdsl::structure_tree_node* v, const std::string& name,
+                                     std::true_type) {
+        return idx.serialize(out, v, name, false);
+    }
+
+    template<typename t_index>
+    static size_type serialize_index(const t_index& idx, std::ostream& out,
+                                     sdsl::structure_tree_node* v, const std::string& name,
+                                     std::false_type) {
+        return idx.serialize(out, v, name);
+    }
+
+    // SA interval of a pattern in the planner's own cache, if one is set.
+    range_type lookup(const token_type* begin, const token_type* end) const {
+        return cached_interval(this->get_interval_cache(), begin, end, [&]() {
+            return sa_interval{sa_range(csa(), begin, end), {1, 0}};
+        }).sa;
+    }
+
+    // Index with the lowest estimated cost of the terms of query among
+    // those for which supported(index) holds, index_cnt if there is none.
+    // Indexes which do not handle the flags of the query only get it if
+    // no other index can answer it.
+    template<typename t_supported>
+    size_t plan_terms(const typename topk_interface::intersect_query& query, uint64_t k,
+                      bool multi_occ, t_supported supported) const {
+        std::vector<std::pair<uint64_t, uint64_t>> terms; // interval size, length
+        for (const auto& q : query) {
+            auto range = lookup(q.first, q.second);
+            terms.emplace_back(empty(range) ? 0 : range[1] - range[0] + 1, q.second - q.first);
+        }
+        size_t best = index_cnt;
+        std::pair<bool, double> best_cost(true, std::numeric_limits<double>::max());
+        for_each_index([&](const auto& idx, size_t i) {
+            if (!supported(idx))
+                return;
+            std::pair<bool, double> cost(!supports(idx, multi_occ), 0);
+            for (const auto& t : terms)
+                cost.second += m_models[2 * i + multi_occ].predict(t.first, k, t.second);
+            if (best == index_cnt or cost < best_cost) {
+                best = i;
+                best_cost = cost;
+            }
+        });
+        return best;
+    }
+
+    template<typename t_fn>
+    std::unique_ptr<typename topk_interface::iter> with_index(size_t i, t_fn fn) {
+        std::unique_ptr<typename topk_interface::iter> res;
+        for_each_index([&](auto& idx, size_t j) {
+            if (j == i)
+                res = fn(idx);
+        });
+        return res;
+    }
+
+    std::unique_ptr<typename topk_interface::iter>
+    topk_with(size_t i, size_t k, range_type range,
+              const token_type* begin, const token_type* end,
+              bool multi_occ, bool only_match) {
+        return with_index(i, [&](auto& idx) {
+            return dispatch(idx, k, range, begin, end, multi_occ, only_match, 0);
+        });
+    }
+
+public:
+    idx_planner() : m_models(2 * index_cnt) {}
+
+    //! Index with the lowest estimated cost for the query, index_cnt if
+    //! no index can answer it.
+    size_t plan(uint64_t size, uint64_t k, uint64_t depth, bool multi_occ) const {
+        size_t best = index_cnt;
+        double best_cost = std::numeric_limits<double>::max();
+        for_each_index([&](const auto& idx, size_t i) {
+            if (!supports(idx, multi_occ))
+                return;
+            double cost = m_models[2 * i + multi_occ].predict(size, k, depth);
+            if (cost < best_cost) {
+                best = i;
+                best_cost = cost;
+            }
+        });
+        return best;
+    }
+
+    std::unique_ptr<typename topk_interface::iter> topk(
+        size_t k, const token_type* begin, const token_type* end,
+        bool multi_occ = false, bool only_match = false) override {
+        auto range = lookup(begin, end);
+        uint64_t size = empty(range) ? 0 : range[1] - range[0] + 1;
+        size_t i = plan(size, k, end - begin, multi_occ);
+        if (i == index_cnt) {
+            std::cerr << "singletons not supported" << std::endl;
+            abort();
+        }
+        ++m_routed[i];
+        if (this->get_debug_stream())
+            (*this->get_debug_stream()) << "PLAN;" << i << ";" << size << "\n";
+        return topk_with(i, k, range, begin, end, multi_occ, only_match);
+    }
+
+    void set_excluded_docs(std::shared_ptr<const sdsl::bit_vector> excluded) override {
+        topk_interface::set_excluded_docs(excluded);
+        for_each_index([&](auto& idx, size_t) {
+            idx.set_excluded_docs(excluded);
+        });
+    }
+
+    // The derived ranges differ between the index types, so the indexes
+    // do not share the cache.
+    void set_interval_cache(std::shared_ptr<sa_interval_cache<token_type>> cache) override {
+        for_each_index([&](auto& idx, size_t) {
+            idx.set_interval_cache(cache ? std::make_shared<sa_interval_cache<token_type>>(
+                                               cache->capacity(), cache->shards())
+                                         : nullptr);
+        });
+        topk_interface::set_interval_cache(std::move(cache));
+    }
+
+    // All indexes hold the same text.
+    std::vector<typename topk_interface::snippet_type>
+    extract_docs(const std::vector<uint64_t>& docs, size_t k,
+                 const typename topk_interface::pattern_type& pattern) const override {
+        return std::get<0>(m_indexes).extract_docs(docs, k, pattern);
+    }
+
+    std::vector<std::vector<uint64_t>>
+    locate_docs(const std::vector<uint64_t>& docs, size_t max_positions,
+                const typename topk_interface::pattern_type& pattern) const override {
+        return std::get<0>(m_indexes).locate_docs(docs, max_positions, pattern);
+    }
+
+    std::unique_ptr<typename topk_interface::iter> topk_intersect(
+        size_t k, const typename topk_interface::intersect_query& query,
+        bool multi_occ = false, bool only_match = false) override {
+        size_t i = plan_terms(query, k, multi_occ, [](const topk_interface& idx) {
+            return idx.supports_intersect();
+        });
+        if (i == index_cnt)
+            return topk_interface::topk_intersect(k, query, multi_occ, only_match);
+        ++m_routed[i];
+        return with_index(i, [&](auto& idx) {
+            return idx.topk_intersect(k, query, multi_occ, only_match);
+        });
+    }
+
+    std::unique_ptr<typename topk_interface::iter> topk_union(
+        size_t k, const typename topk_interface::intersect_query& query,
+        bool multi_occ = false, bool only_match = false) override {
+        size_t i = plan_terms(query, k, multi_occ, [](const topk_interface& idx) {
+            return idx.supports_union();
+        });
+        if (i == index_cnt)
+            return topk_interface::topk_union(k, query, multi_occ, only_match);
+        ++m_routed[i];
+        return with_index(i, [&](auto& idx) {
+            return idx.topk_union(k, query, multi_occ, only_match);
+        });
+    }
+
+    bool supports_intersect() const override {
+        bool res = false;
+        for_each_index([&](const auto& idx, size_t) {
+            res |= idx.supports_intersect();
+        });
+        return res;
+    }
+
+    bool supports_union() const override {
+        bool res = false;
+        for_each_index([&](const auto& idx, size_t) {
+            res |= idx.supports_union();
+        });
+        return res;
+    }
+
+    // plan() routes singleton queries to the indexes which support them.
+    bool supports_singletons() const override {
+        bool res = false;
+        for_each_index([&](const auto& idx, size_t) {
+            res |= idx.supports_singletons();
+        });
+        return res;
+    }
+
+    //! Fits the cost models to timings of random patterns of the text.
+    /*!
+     * \param patterns Number of sampled patterns.
+     * \param ks       Values of k each pattern is queried with.
+     * \param max_len  Maximal length of the sampled patterns.
+     */
+    void calibrate(size_t patterns = 200, const std::vector<size_t>& ks = {1, 10, 100},
+                   size_t max_len = 8, uint64_t seed = 1) {
+        using timer = std::chrono::high_resolution_clock;
+        const auto& text_csa = csa();
+        std::mt19937_64 rng(seed);
+        std::vector<std::vector<planner_cost_model::feature_type>> x(2 * index_cnt);
+        std::vector<std::vector<double>> y(2 * index_cnt);
+        for (size_t p = 0; p < patterns; ++p) {
+            size_t len = 1 + rng() % max_len;
+            if (text_csa.size() <= len + 1)
+                break;
+            size_t pos = rng() % (text_csa.size() - len - 1);
+            auto text = extract(text_csa, pos, pos + len - 1);
+            std::vector<token_type> pat(text.begin(), text.end());
+            // skip patterns which span a document border
+            if (std::any_of(pat.begin(), pat.end(),
+                            [](token_type c) { return (uint64_t)c <= 1; }))
+                continue;
+            const token_type* begin = pat.data();
+            const token_type* end = pat.data() + pat.size();
+            auto range = sa_range(text_csa, begin, end);
+            uint64_t size = empty(range) ? 0 : range[1] - range[0] + 1;
+            for (size_t k : ks) {
+                for (bool multi_occ : {false, true}) {
+                    for_each_index([&](auto& idx, size_t i) {
+                        if (!supports(idx, multi_occ))
+                            return;
+                        auto start = timer::now();
+                        auto it = dispatch(idx, k, range, begin, end, multi_occ, false, 0);
+                        topk_interface::take(*it, k);
+                        double usecs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                           timer::now() - start).count() / 1000.0;
+                        x[2 * i + multi_occ].push_back(
+                            planner_cost_model::features_of(size, k, len));
+                        y[2 * i + multi_occ].push_back(usecs);
+                    });
+                }
+            }
+        }
+        for (size_t m = 0; m < m_models.size(); ++m)
+            if (!x[m].empty())
+                m_models[m].fit(x[m], y[m]);
+    }
+
+    const csa_type& csa() const {
+        return std::get<0>(m_indexes).csa();
+    }
+
+    const std::tuple<t_idx...>& indexes() const {
+        return m_indexes;
+    }
+
+    //! Number of queries routed to index i.
+    uint64_t routed(size_t i) const {
+        return m_routed[i];
+    }
+
+    uint64_t doc_cnt() const {
+        return std::get<0>(m_indexes).doc_cnt();
+    }
+
+    // The models depend on all index types, so the key contains the hash
+    // of the planner type.
+    std::string model_key() const {
+        return KEY_PLANNER_MODEL + "_" + sdsl::util::class_to_hash(*this);
+    }
+
+    void load(sdsl::cache_config& cc) {
+        load_indexes(cc);
+        load_from_cache(m_models, model_key(), cc);
+    }
+
+    void load_indexes(sdsl::cache_config& cc) {
+        auto csa = std::make_shared<csa_type>();
+        load_from_cache(*csa, surf::KEY_CSA, cc, true);
+        m_csa = std::move(csa);
+        for_each_index([&](auto& idx, size_t) {
+            using index_type = typename std::decay<decltype(idx)>::type;
+            load_index(idx, cc, planner_shares_csa<index_type, csa_type>());
+        });
+    }
+
+    void store_models(sdsl::cache_config& cc) const {
+        store_to_cache(m_models, model_key(), cc);
+    }
+
+    size_type serialize(std::ostream& out, sdsl::structure_tree_node* v = nullptr,
+                        std::string name = "") const {
+        using namespace sdsl;
+        structure_tree_node* child = structure_tree::add_child(
+                                         v, name, util::class_name(*this));
+        size_type written_bytes = 0;
+        bool shared = false;
+        for_each_index([&](const auto& idx, size_t) {
+            using index_type = typename std::decay<decltype(idx)>::type;
+            shared |= planner_shares_csa<index_type, csa_type>::value;
+        });
+        if (shared and m_csa)
+            written_bytes += m_csa->serialize(out, child, "CSA");
+        for_each_index([&](const auto& idx, size_t i) {
+            using index_type = typename std::decay<decltype(idx)>::type;
+            written_bytes += serialize_index(idx, out, child, "INDEX_" + std::to_string(i),
+                                             planner_shares_csa<index_type, csa_type>());
+        });
+        written_bytes += sdsl::serialize(m_models, out, child, "COST_MODELS");
+        structure_tree::add_size(child, written_bytes);
+        return written_bytes;
+    }
+
+    void mem_info() const {
+        for_each_index([&](const auto& idx, size_t) {
+            idx.mem_info();
+        });
+    }
+};
+
+template<typename... t_idx>
+void construct(idx_planner<t_idx...>& idx, const std::string& file,
+               sdsl::cache_config& cc, uint8_t num_bytes) {
+    using namespace sdsl;
+    int dummy[] = {0, (construct(*std::make_unique<t_idx>(), file, cc, num_bytes), 0)...};
+    (void)dummy;
+    if (!cache_file_exists(idx.model_key(), cc)) {
+        auto event = memory_monitor::event("planner calibration");
+        idx.load_indexes(cc);
+        idx.calibrate();
+        idx.store_models(cc);
+    }
+}
+
+} // end namespace surf
@@ -0,0 +1,402 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sdsl/int_vector.hpp"
+#include "surf/compact_result.hpp"
+#include "surf/config.hpp"
+#include "surf/topk_interface.hpp"
+#include "surf/util.hpp"
+
+namespace surf {
+
+//! Index which splits the collection into t_shards parts.
+/*!
+ * The documents are partitioned into t_shards ranges of consecutive
+ * documents of about equal size. Each range is a collection of its own
+ * in index/shards_<t_shards>/<i>, with its own t_idx, and the shards are
+ * built in parallel. Queries are answered by all shards in parallel and
+ * the shard-local doc ids are mapped back to global ones. The calling
+ * thread searches the first shard, every other shard has a pool of
+ * threads which live as long as the index, so the per-thread working
+ * memory of the queries (topk_scratch) is reused. The shards draw their
+ * steps from the one step budget of the query.
+ *
+ * The shards pull their results in decreasing weight order into one
+ * shared top-k heap and stop as soon as their next weight is below the
+ * k-th weight found so far.
+ *
+ * \tparam t_idx    Index type of the shards.
+ * \tparam t_shards Number of shards.
+ */
+template<typename t_idx, uint64_t t_shards = 4>
+class idx_sharded : public t_idx::topk_interface {
+    static_assert(t_shards >= 1, "at least one shard is needed.");
+public:
+    using shard_type = t_idx;
+    using alphabet_category = typename t_idx::alphabet_category;
+    using topk_interface = typename t_idx::topk_interface;
+    using token_type = typename topk_interface::token_type;
+    using size_type = sdsl::int_vector<>::size_type;
+    using compact_weight_type = typename compact_weight<t_idx>::type;
+
+private:
+    std::vector<std::unique_ptr<t_idx>> m_shards;
+    sdsl::int_vector<64>                m_doc_base; // first global doc id of each shard
+
+    // Threads which run the queries of one shard, in the order they were
+    // submitted.
+    class worker_pool {
+        std::mutex                        m_mutex;
+        std::condition_variable           m_cv;
+        std::deque<std::function<void()>> m_tasks;
+        std::vector<std::thread>          m_threads;
+        bool                              m_stop = false;
+
+        void run() {
+            while (true) {
+                std::function<void()> task;
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_cv.wait(lock, [this]() { return m_stop or !m_tasks.empty(); });
+                    if (m_tasks.empty())
+                        return;
+                    task = std::move(m_tasks.front());
+                    m_tasks.pop_front();
+                }
+                task();
+            }
+        }
+
+    public:
+        explicit worker_pool(size_t threads) {
+            for (size_t i = 0; i < threads; ++i)
+                m_threads.emplace_back([this]() { run(); });
+        }
+
+        ~worker_pool() {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stop = true;
+            }
+            m_cv.notify_all();
+            for (auto& t : m_threads)
+                t.join();
+        }
+
+        void submit(std::function<void()> task) {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_tasks.push_back(std::move(task));
+            }
+            m_cv.notify_one();
+        }
+    };
+
+    std::vector<std::unique_ptr<worker_pool>> m_pools; // of shards 1, 2, ...
+
+    // Collects the best k results of all shards.
+    class merger {
+        size_t          m_k;
+        std::mutex      m_mutex;
+        topk_result_set m_heap; // min-heap of the best results so far
+
+        static bool better(const topk_result& a, const topk_result& b) {
+            return std::make_pair(-a.second, a.first) < std::make_pair(-b.second, b.first);
+        }
+
+    public:
+        explicit merger(size_t k) : m_k(k) {}
+
+        // Returns false if res and all following results with a lower
+        // weight can not make it into the top-k anymore.
+        bool add(const topk_result& res) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_heap.size() == m_k) {
+                if (res.second < m_heap.front().second)
+                    return false;
+                if (!better(res, m_heap.front()))
+                    return true;
+                std::pop_heap(m_heap.begin(), m_heap.end(), better);
+                m_heap.pop_back();
+            }
+            m_heap.push_back(res);
+            std::push_heap(m_heap.begin(), m_heap.end(), better);
+            return true;
+        }
+
+        topk_result_set result() {
+            return std::move(m_heap);
+        }
+    };
+
+    // Runs query(shard) on all shards in parallel and merges the results.
+    template<typename t_query>
+    std::unique_ptr<typename topk_interface::iter> scatter(
+        size_t k, t_query query, typename topk_interface::pattern_type pattern) {
+        merger top(k);
+        query_budget* budget = query_budget::current();
+        const doc_filter* filter = doc_filter::current();
+        std::atomic<int64_t> steps(budget ? budget->shared_steps() : 0);
+        auto run = [&](size_t s) {
+            // The budgets of the threads share the steps of the query.
+            query_budget local = budget ? budget->part(steps) : query_budget();
+            budget_scope scope(local);
+            // The filter is translated to shard-local doc ids; shards
+            // without allowed documents are not searched.
+            doc_filter local_filter = filter ? filter->shifted(m_doc_base[s]) : doc_filter();
+            filter_scope fscope(local_filter);
+            uint64_t docs = s + 1 < m_shards.size() ? m_doc_base[s + 1] - m_doc_base[s]
+                            : std::numeric_limits<uint64_t>::max();
+            if (local_filter.excludes_all(docs))
+                return false;
+            auto it = query(*m_shards[s]);
+            for (size_t n = 0; n < k and !it->done(); ++n) {
+                auto res = it->get();
+                if (!top.add(topk_result(m_doc_base[s] + res.first, res.second)))
+                    break;
+                if (n + 1 < k)
+                    it->next();
+            }
+            return local.truncated();
+        };
+        if (k > 0) {
+            std::vector<std::future<bool>> futures;
+            for (size_t s = 1; s < m_shards.size(); ++s) {
+                auto task = std::make_shared<std::packaged_task<bool()>>([&, s]() {
+                    return run(s);
+                });
+                futures.push_back(task->get_future());
+                m_pools[s - 1]->submit([task]() { (*task)(); });
+            }
+            // The tasks refer to this frame, so all of them are waited
+            // for before an error is passed on.
+            std::exception_ptr error;
+            bool truncated = false;
+            for (size_t s = 0; s < m_shards.size(); ++s) {
+                try {
+                    truncated |= s == 0 ? run(0) : futures[s - 1].get();
+                } catch (...) {
+                    if (!error)
+                        error = std::current_exception();
+                }
+            }
+            if (error)
+                std::rethrow_exception(error);
+            if (budget)
+                budget->join(steps, truncated);
+        }
+        return sort_topk_results<token_type>(top.result(), this, std::move(pattern));
+    }
+
+    // Calls f(shard, local doc ids) once for each shard holding some of
+    // the documents and returns the results in the order of docs.
+    template<typename t_res, typename t_fun>
+    std::vector<t_res> per_shard(const std::vector<uint64_t>& docs, t_fun f) const {
+        std::vector<t_res> res(docs.size());
+        std::vector<std::vector<uint64_t>> local_docs(m_shards.size());
+        std::vector<std::vector<size_t>> positions(m_shards.size());
+        for (size_t i = 0; i < docs.size(); ++i) {
+            size_t s = std::upper_bound(m_doc_base.begin(), m_doc_base.end(), docs[i])
+                       - m_doc_base.begin() - 1;
+            local_docs[s].push_back(docs[i] - m_doc_base[s]);
+            positions[s].push_back(i);
+        }
+        for (size_t s = 0; s < m_shards.size(); ++s) {
+            if (local_docs[s].empty())
+                continue;
+            auto shard_res = f(*m_shards[s], local_docs[s]);
+            for (size_t j = 0; j < shard_res.size(); ++j)
+                res[positions[s][j]] = std::move(shard_res[j]);
+        }
+        return res;
+    }
+
+public:
+    std::unique_ptr<typename topk_interface::iter> topk(
+        size_t k, const token_type* begin, const token_type* end,
+        bool multi_occ = false, bool only_match = false) override {
+        return scatter(k, [&](t_idx& shard) {
+            return shard.topk(k, begin, end, multi_occ, only_match);
+        }, {begin, end});
+    }
+
+    std::unique_ptr<typename topk_interface::iter> topk_intersect(
+        size_t k, const typename topk_interface::intersect_query& query,
+        bool multi_occ = false, bool only_match = false) override {
+        return scatter(k, [&](t_idx& shard) {
+            return shard.topk_intersect(k, query, multi_occ, only_match);
+        }, topk_interface::first_term(query));
+    }
+
+    std::unique_ptr<typename topk_interface::iter> topk_union(
+        size_t k, const typename topk_interface::intersect_query& query,
+        bool multi_occ = false, bool only_match = false) override {
+        return scatter(k, [&](t_idx& shard) {
+            return shard.topk_union(k, query, multi_occ, only_match);
+        }, topk_interface::first_term(query));
+    }
+
+    bool supports_intersect() const override {
+        return !m_shards.empty() and m_shards[0]->supports_intersect();
+    }
+
+    bool supports_union() const override {
+        return !m_shards.empty() and m_shards[0]->supports_union();
+    }
+
+    bool supports_singletons() const override {
+        return !m_shards.empty() and m_shards[0]->supports_singletons();
+    }
+
+    // Every shard gets the slice of its own documents.
+    void set_excluded_docs(std::shared_ptr<const sdsl::bit_vector> excluded) override {
+        topk_interface::set_excluded_docs(excluded);
+        for (size_t s = 0; s < m_shards.size(); ++s) {
+            uint64_t end = s + 1 < m_shards.size() ? m_doc_base[s + 1]
+                           : std::numeric_limits<uint64_t>::max();
+            m_shards[s]->set_excluded_docs(excluded_slice(excluded.get(), m_doc_base[s], end));
+        }
+    }
+
+    // Each shard extracts the snippets of its own documents in one batch.
+    // The results carry the tokens of the pattern, which every shard
+    // looks up in its own CSA.
+    std::vector<typename topk_interface::snippet_type>
+    extract_docs(const std::vector<uint64_t>& docs, size_t k,
+                 const typename topk_interface::pattern_type& pattern) const override {
+        return per_shard<typename topk_interface::snippet_type>(docs,
+        [&](const t_idx& shard, const std::vector<uint64_t>& local_docs) {
+            return shard.extract_docs(local_docs, k, pattern);
+        });
+    }
+
+    // The offsets are relative to the documents, so they need no mapping.
+    std::vector<std::vector<uint64_t>>
+    locate_docs(const std::vector<uint64_t>& docs, size_t max_positions,
+                const typename topk_interface::pattern_type& pattern) const override {
+        return per_shard<std::vector<uint64_t>>(docs,
+        [&](const t_idx& shard, const std::vector<uint64_t>& local_docs) {
+            return shard.locate_docs(local_docs, max_positions, pattern);
+        });
+    }
+
+    //! Collection directory of shard i.
+    static std::string shard_dir(const sdsl::cache_config& cc, size_t i) {
+        return cc.dir + "/shards_" + std::to_string(t_shards) + "/" + std::to_string(i);
+    }
+
+    const t_idx& shard(size_t i) const {
+        return *m_shards[i];
+    }
+
+    uint64_t doc_base(size_t i) const {
+        return m_doc_base[i];
+    }
+
+    void load(sdsl::cache_config& cc) {
+        load_from_cache(m_doc_base, KEY_SHARD_DOC_BASE + std::to_string(t_shards), cc);
+        m_shards.clear();
+        for (size_t i = 0; i < t_shards; ++i) {
+            auto shard_cc = parse_collection<alphabet_category>(shard_dir(cc, i));
+            m_shards.emplace_back(new t_idx());
+            m_shards.back()->load(shard_cc);
+        }
+        // The threads of the server are spread over the shards.
+        size_t threads = std::max<size_t>(1, std::thread::hardware_concurrency() / t_shards);
+        m_pools.clear();
+        for (size_t i = 1; i < t_shards; ++i)
+            m_pools.emplace_back(new worker_pool(threads));
+    }
+
+    size_type serialize(std::ostream& out, sdsl::structure_tree_node* v = nullptr,
+                        std::string name = "") const {
+        using namespace sdsl;
+        structure_tree_node* child = structure_tree::add_child(
+                                         v, name, util::class_name(*this));
+        size_type written_bytes = 0;
+        written_bytes += m_doc_base.serialize(out, child, "DOC_BASE");
+        for (size_t i = 0; i < m_shards.size(); ++i)
+            written_bytes += m_shards[i]->serialize(out, child, "SHARD_" + std::to_string(i));
+        structure_tree::add_size(child, written_bytes);
+        return written_bytes;
+    }
+
+    void mem_info() const {
+        for (const auto& shard : m_shards)
+            shard->mem_info();
+    }
+};
+
+template<typename t_idx, uint64_t t_shards>
+void construct(idx_sharded<t_idx, t_shards>& idx, const std::string& file,
+               sdsl::cache_config& cc, uint8_t num_bytes) {
+    using namespace sdsl;
+    using namespace std;
+    using idx_type = idx_sharded<t_idx, t_shards>;
+    using alphabet_category = typename t_idx::alphabet_category;
+    constexpr bool int_alphabet = is_same<alphabet_category, int_alphabet_tag>::value;
+    using text_type = typename conditional<int_alphabet, int_vector<>, int_vector<8>>::type;
+    const string key_base = KEY_SHARD_DOC_BASE + to_string(t_shards);
+
+    cout << "...SHARDS" << endl;
+    if (!cache_file_exists(key_base, cc)) {
+        text_type text;
+        load_from_cache(text, int_alphabet ? conf::KEY_TEXT_INT : conf::KEY_TEXT, cc);
+        // Every document ends with a 1, the text with a 0.
+        vector<uint64_t> doc_end;
+        for (size_t i = 0; i < text.size(); ++i)
+            if (text[i] == 1)
+                doc_end.push_back(i + 1);
+        if (doc_end.size() < t_shards) {
+            cerr << "ERROR: " << t_shards << " shards need at least as many documents." << endl;
+            exit(EXIT_FAILURE);
+        }
+        create_directory(cc.dir + "/shards_" + to_string(t_shards));
+        int_vector<64> doc_base(t_shards, doc_end.size());
+        size_t doc = 0, begin = 0;
+        for (size_t s = 0; s < t_shards; ++s) {
+            // Cut the text at the first document end after s+1 equal parts.
+            size_t target = (text.size() - 1) * (s + 1) / t_shards;
+            doc_base[s] = doc;
+            // Each shard gets at least one document.
+            while (doc < doc_end.size() - (t_shards - s - 1)
+                    and (doc_end[doc] <= target or doc == doc_base[s] or s + 1 == t_shards))
+                ++doc;
+            size_t end = doc ? doc_end[doc - 1] : 0;
+            end = std::max(end, begin);
+            text_type shard_text(end - begin + 1, 0, text.width());
+            std::copy(text.begin() + begin, text.begin() + end, shard_text.begin());
+            create_collection<alphabet_category>(idx_type::shard_dir(cc, s), shard_text,
+                                                 cc.dir + "/../" + DICT_FILENAME);
+            begin = end;
+        }
+        store_to_cache(doc_base, key_base, cc);
+    }
+
+    // The shards are independent collections, so they are built in parallel.
+    vector<thread> builders;
+    for (size_t s = 0; s < t_shards; ++s) {
+        builders.emplace_back([&, s]() {
+            auto shard_cc = parse_collection<alphabet_category>(idx_type::shard_dir(cc, s));
+            t_idx shard;
+            construct(shard, file, shard_cc, num_bytes);
+        });
+    }
+    for (auto& b : builders)
+        b.join();
+}
+
+} // end namespace surf
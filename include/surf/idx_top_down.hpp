@@ -3,7 +3,10 @@
 #include <vector>
 
 #include "sdsl/suffix_trees.hpp"
+#include "surf/backward_search_batch.hpp"
+#include "surf/snippets.hpp"
 #include "surf/topk_interface.hpp"
+#include "surf/topk_list_algos.hpp"
 #include "sdsl/rmq_succinct_sct.hpp"
 
 namespace surf {
@@ -80,6 +83,24 @@ private:
     h_select_0_type    m_h_select_0;
     map_to_h_type      m_map_to_h;
 
+    // SA interval and H range of a pattern.
+    sa_interval interval(range_type sa) const {
+        if (empty(sa))
+            return {sa, {1, 0}};
+        auto h_range = m_map_to_h(std::get<0>(sa), std::get<1>(sa), SINGLETONS);
+        if (SINGLETONS) {
+            std::get<0>(h_range)--;
+            std::get<1>(h_range)++;
+        }
+        return {sa, h_range};
+    }
+
+    sa_interval lookup(const token_type* begin, const token_type* end) const {
+        return cached_interval(this->get_interval_cache(), begin, end, [&]() {
+            return interval(sa_range(m_csa, begin, end));
+        });
+    }
+
 public:
 
     template <typename t_token>
@@ -88,6 +109,8 @@ public:
         const idx_top_down* m_idx;
         uint64_t           m_sp;  // start point of lex interval
         uint64_t           m_ep;  // end point of lex interval
+        uint64_t           m_depth; // length of the pattern
+        mutable occurrence_sample m_sample;
         bool               m_valid = false;
         bool               m_multi_occ = false; // true, if document has to occur more than once
         struct top_down_result {
@@ -134,20 +157,23 @@ public:
                                const typename topk_interface::token_type* begin,
                                const typename topk_interface::token_type* end,
                                bool multi_occ, bool only_match) :
-            m_idx(idx), m_multi_occ(multi_occ) {
-            m_valid = backward_search(m_idx->m_csa, 0, m_idx->m_csa.size() - 1,
-                                      begin, end, m_sp, m_ep) > 0;
+            top_down_topk_iterator(idx, idx->lookup(begin, end),
+                                   end - begin, multi_occ, only_match) {}
+
+        top_down_topk_iterator(const idx_top_down* idx, const sa_interval& iv,
+                               uint64_t pattern_len,
+                               bool multi_occ, bool only_match) :
+            m_idx(idx), m_depth(pattern_len), m_multi_occ(multi_occ) {
+            m_sp = std::get<0>(iv.sa);
+            m_ep = std::get<1>(iv.sa);
+            m_valid = !empty(iv.sa);
             m_valid &= !only_match;
             if (m_valid) {
-                auto h_range = m_idx->m_map_to_h(m_sp, m_ep, SINGLETONS);
-                if (SINGLETONS) {
-                    std::get<0>(h_range)--;
-                    std::get<1>(h_range)++;
-                }
+                const auto& h_range = iv.derived;
                 if (!empty(h_range)) {
                     uint64_t offset = 0;
                     // <= here instead of < ??? TODO
-                    for (uint64_t depth = 0; depth <= (end - begin); ++depth) {
+                    for (uint64_t depth = 0; depth <= pattern_len; ++depth) {
                         top_down_result interval;
                         interval.start = idx->m_tails.rank(std::get<0>(h_range), depth) + offset;
                         interval.end = idx->m_tails.rank(std::get<1>(h_range) + 1, depth) + offset;
@@ -159,6 +185,7 @@ public:
                         }
                         offset += idx->m_tails.rank(idx->m_tails.size(), depth); // TODO dont do this for last.
                     }
+                    skip_docs();
                 }
             }
         }
@@ -177,6 +204,24 @@ public:
         void next() override {
             if (m_intervals.empty())
                 abort();
+            split_top();
+            skip_docs();
+        }
+
+        std::vector<t_token> extract_snippet(const size_t k) const override {
+            uint64_t occ = m_sample.find(m_idx->m_csa, m_idx->m_border_rank, {{m_sp, m_ep}},
+                                         get().first, kwic_sample_probes);
+            return extract_windows<t_token>(m_idx->m_csa, m_idx->m_border_select,
+                                            {get().first}, {occ}, m_depth, k)[0];
+        }
+
+        typename topk_interface::pattern_type pattern() const override {
+            return {{{m_sp, m_ep}}, m_depth};
+        }
+    private:
+        // Reports the document of the top interval and replaces the
+        // interval by its parts left and right of the document.
+        void split_top() {
             auto t = m_intervals.top();
             m_reported_docs.insert(t.document);
             m_intervals.pop();
@@ -199,18 +244,20 @@ public:
                 init_interval(interval);
                 m_intervals.push(interval);
             }
-            // Remove already reported docs from front.
-            while (!m_intervals.empty() &&
-                    m_reported_docs.count(m_intervals.top().document) == 1) {
-                m_intervals.pop();
-            }
         }
 
-        std::vector<t_token> extract_snippet(const size_t k) const override {
-            // TODO implement
-            return {};
+        // Removes already reported docs from front. Excluded docs are
+        // split off, the rest of their intervals may hold other docs.
+        void skip_docs() {
+            while (!m_intervals.empty()) {
+                if (m_reported_docs.count(m_intervals.top().document) == 1)
+                    m_intervals.pop();
+                else if (m_idx->is_excluded(m_intervals.top().document))
+                    split_top();
+                else
+                    break;
+            }
         }
-    private:
     };
 
     std::unique_ptr<typename topk_interface::iter> topk(
@@ -223,6 +270,36 @@ public:
                            begin, end, multi_occ, only_match));
     }
 
+    // topk() for the SA interval of a pattern of length depth.
+    std::unique_ptr<typename topk_interface::iter> topk(
+        size_t k, range_type range, uint64_t depth,
+        bool multi_occ = false, bool only_match = false) {
+        return std::make_unique<top_down_topk_iterator<token_type>>(
+                   top_down_topk_iterator<token_type>(this,
+                           interval(range), depth, multi_occ, only_match));
+    }
+
+    std::vector<topk_result_set> topk_batch(
+        size_t k, const typename topk_interface::batch_query& patterns,
+        bool multi_occ = false, bool only_match = false) override {
+        return surf::topk_batch(*this, m_csa, k, patterns, multi_occ, only_match);
+    }
+
+    std::unique_ptr<typename topk_interface::iter> topk_union(
+        size_t k, const typename topk_interface::intersect_query& query,
+        bool multi_occ = false, bool only_match = false) override {
+        std::vector<std::unique_ptr<typename topk_interface::iter>> lists;
+        for (const auto& q : query)
+            lists.emplace_back(std::make_unique<top_down_topk_iterator<token_type>>(
+                       this, q.first, q.second, multi_occ, only_match));
+        return sort_topk_results<token_type>(
+                   topk_list_algos::topk_union(k, lists, multi_occ), this, this->first_term(query));
+    }
+
+    bool supports_union() const override {
+        return true;
+    }
+
     // Decode m_doc value at postion index by using offset encoding.
     uint64_t get_doc(const uint64_t index_zero, const uint64_t index_one) const {
         // All sa offsets are relative to sa_base_pos (rightmost leaf of left subtree).
@@ -242,6 +319,18 @@ public:
         return m_border_rank(m_csa[sa_pos]);
     }
 
+    std::vector<typename topk_interface::snippet_type>
+    extract_docs(const std::vector<uint64_t>& docs, size_t k,
+                 const typename topk_interface::pattern_type& pattern) const override {
+        return extract_snippets(m_csa, m_border_rank, m_border_select, docs, k, pattern);
+    }
+
+    std::vector<std::vector<uint64_t>>
+    locate_docs(const std::vector<uint64_t>& docs, size_t max_positions,
+                const typename topk_interface::pattern_type& pattern) const override {
+        return doc_positions(m_csa, m_border_rank, m_border_select, docs, max_positions, pattern);
+    }
+
     uint64_t doc_cnt() const {
         return m_border_rank(m_csa.size());
     }
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "sdsl/int_vector.hpp"
+
+namespace surf {
+
+//! The documents of every term of an integer collection, by decreasing
+//! frequency.
+/*!
+ * The list of a term holds each document the term occurs in once, with
+ * its frequency, ordered by decreasing frequency and increasing doc id.
+ * This is the order of the top-k results of the term, so a top-k query
+ * reads a prefix of the list. The lists of all terms are concatenated.
+ */
+class impact_lists {
+public:
+    typedef uint64_t size_type;
+
+private:
+    sdsl::int_vector<> m_start; // per term + 1, offset of its list
+    sdsl::int_vector<> m_docs;
+    sdsl::int_vector<> m_freqs;
+
+public:
+    impact_lists() = default;
+
+    //! Builds the lists from the term ranges of construct_term_ranges().
+    /*!
+     * \param sa       Suffix array of the collection.
+     * \param doc_rank Maps a text position to its document.
+     */
+    template<typename t_sa, typename t_doc_rank>
+    impact_lists(const sdsl::int_vector<>& ids, const sdsl::int_vector<>& sp,
+                 const sdsl::int_vector<>& ep, t_sa& sa, const t_doc_rank& doc_rank) {
+        size_type terms = ids.size() ? ids[ids.size() - 1] + 1 : 0;
+        m_start = sdsl::int_vector<>(terms + 1, 0);
+        std::vector<uint64_t> docs, freqs, occ;
+        std::vector<std::pair<int64_t, uint64_t>> list; // (-frequency, doc)
+        size_type t = 0;
+        // The ranges are ordered by term id.
+        for (size_type i = 2; i < ids.size(); ++i) { // skip \0 and \1
+            while (t <= ids[i])
+                m_start[t++] = docs.size();
+            occ.clear();
+            for (size_type j = sp[i]; j <= ep[i]; ++j)
+                occ.push_back(doc_rank(sa[j]));
+            std::sort(occ.begin(), occ.end());
+            list.clear();
+            for (size_type j = 0; j < occ.size(); ++j) {
+                if (j == 0 or occ[j] != occ[j - 1])
+                    list.emplace_back(0, occ[j]);
+                --list.back().first;
+            }
+            std::sort(list.begin(), list.end());
+            for (const auto& p : list) {
+                docs.push_back(p.second);
+                freqs.push_back(-p.first);
+            }
+        }
+        while (t <= terms)
+            m_start[t++] = docs.size();
+        m_docs = sdsl::int_vector<>(docs.size(), 0);
+        m_freqs = sdsl::int_vector<>(freqs.size(), 0);
+        std::copy(docs.begin(), docs.end(), m_docs.begin());
+        std::copy(freqs.begin(), freqs.end(), m_freqs.begin());
+        sdsl::util::bit_compress(m_start);
+        sdsl::util::bit_compress(m_docs);
+        sdsl::util::bit_compress(m_freqs);
+    }
+
+    //! Number of term ids, the largest id plus one.
+    size_type terms() const { return m_start.size() ? m_start.size() - 1 : 0; }
+
+    //! Positions [first, second) of the list of term.
+    std::pair<size_type, size_type> list(uint64_t term) const {
+        if (term >= terms())
+            return {0, 0};
+        return {m_start[term], m_start[term + 1]};
+    }
+
+    uint64_t doc(size_type i) const { return m_docs[i]; }
+    uint64_t freq(size_type i) const { return m_freqs[i]; }
+
+    size_type serialize(std::ostream& out,
+                        sdsl::structure_tree_node* v = nullptr,
+                        std::string name = "") const {
+        using namespace sdsl;
+        structure_tree_node* child = structure_tree::add_child(
+                                         v, name, util::class_name(*this));
+        size_type written_bytes = 0;
+        written_bytes += m_start.serialize(out, child, "start");
+        written_bytes += m_docs.serialize(out, child, "docs");
+        written_bytes += m_freqs.serialize(out, child, "freqs");
+        structure_tree::add_size(child, written_bytes);
+        return written_bytes;
+    }
+
+    void load(std::istream& in) {
+        m_start.load(in);
+        m_docs.load(in);
+        m_freqs.load(in);
+    }
+};
+
+} // end namespace surf
@@ -7,3 +7,8 @@
 #include "idx_top_down.hpp"
 #include "idx_d.hpp"
 #include "idx_nn_quantile.hpp"
+#include "idx_planner.hpp"
+#include "idx_sharded.hpp"
+#include "idx_delta.hpp"
+#include "idx_invidx.hpp"
+#include "idx_hybrid.hpp"
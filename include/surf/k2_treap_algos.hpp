@@ -1,8 +1,10 @@
 #pragma once
 
+#include <limits>
 #include <queue>
 
 #include "sdsl/k2_treap.hpp"
+#include "surf/query_budget.hpp"
 #include "surf/topk_heap.hpp"
 
 namespace surf {
@@ -11,7 +13,9 @@ namespace k2_treap_algos {
 template <typename t_k2_treap>
 // items of result vector are (weight, docid)
 std::vector<std::pair<uint64_t, uint64_t>>
-topk_increasing_y(const t_k2_treap& t, size_t k, uint64_t x_lo, uint64_t x_hi) {
+topk_increasing_y(const t_k2_treap& t, size_t k, uint64_t x_lo, uint64_t x_hi,
+                  const sdsl::bit_vector* excluded = nullptr,
+                  uint64_t y_lo = 0, uint64_t y_hi = std::numeric_limits<uint64_t>::max()) {
     using node = std::tuple<
         uint64_t, // south border
         uint8_t, // level (root = maximal level)
@@ -31,28 +35,30 @@ topk_increasing_y(const t_k2_treap& t, size_t k, uint64_t x_lo, uint64_t x_hi) {
     // Intuitively it should be better to sort from leaf to root
     std::priority_queue<node, std::vector<node>, cmp> q;
 
-    topk_heap result(k);
+    topk_heap result(k, excluded);
 
     if (t.size() == 0)
         return {};
 
     auto root = t.root();
     q.emplace(root.south(t), root.t, root, true);
-    uint64_t d = 0;
+    uint64_t d = y_lo;
     size_t max_q_size = 0;
     uint64_t dequeued  =0;
-    while (!q.empty()) {
+    while (!q.empty() && budget_step()) {
         max_q_size = std::max(max_q_size, q.size());
         auto v = std::get<2>(q.top());
         bool consider_inserting_max = std::get<3>(q.top());
         q.pop();
+        if (v.south(t) > y_hi)
+            break; // the queue is sorted by south border
         if (v.north(t) < d || v.max_v <= result.lower_bound()
                 || v.east(t) < x_lo || v.west(t) > x_hi)
             continue;
         dequeued++;
         uint64_t x = real(v.max_p), docid = imag(v.max_p);
         bool max_in_range = x_lo <= x && x <= x_hi;
-        if (consider_inserting_max && max_in_range && docid >= d) {
+        if (consider_inserting_max && max_in_range && docid >= d && docid <= y_hi) {
             result.insert_or_update(docid, v.max_v);
         }
         if (t.is_leaf(v)) {
@@ -60,7 +66,7 @@ topk_increasing_y(const t_k2_treap& t, size_t k, uint64_t x_lo, uint64_t x_hi) {
             d = docid + 1;
         } else {
             for (auto w : t.children(v)) {
-                if (w.north(t) < d || w.max_v <= result.lower_bound()
+                if (w.north(t) < d || w.south(t) > y_hi || w.max_v <= result.lower_bound()
                         || w.east(t) < x_lo || w.west(t) > x_hi)
                     continue;
                 auto child_x = real(w.max_p);
@@ -1,30 +1,57 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <queue>
 
 #include "sdsl/k3_treap.hpp"
+#include "surf/k3_treap_sampled.hpp"
+#include "surf/query_budget.hpp"
 #include "surf/topk_heap.hpp"
 
 namespace surf {
 namespace k3_treap_algos {
 
 // TODO(niklasb) Ideas for optimization:
-// * We use mimimal z order here to order quad tree nodes. We should
-//   potentially use minimum d actually stored in the node. This can potentially
-//   be sampled and only be stored on each i-th level
-// * Use min y coordinate of a node for pruning, because most nodes have small y
 // * Handle y differently somehow, because it has very special structure
 
+// Lower bound on the coordinates of the points in the subtree of v, given
+// the bound lo of its parent. A plain treap only knows the bounding box
+// of v, k3_treap_sampled also knows the minimal y and z on sampled levels.
+template <typename t_k3_treap>
+k3_treap_ns::point_type
+subtree_lo(const t_k3_treap& t, const k3_treap_ns::node_type& v,
+           k3_treap_ns::point_type lo) {
+    const auto bb_lo = t.bounding_box(v).first;
+    for (size_t i = 0; i < 3; ++i)
+        lo[i] = std::max(lo[i], bb_lo[i]);
+    return lo;
+}
+
+template <typename t_k3_treap, uint8_t t_sample_rate>
+k3_treap_ns::point_type
+subtree_lo(const k3_treap_sampled<t_k3_treap, t_sample_rate>& t,
+           const k3_treap_ns::node_type& v,
+           k3_treap_ns::point_type lo) {
+    const auto bb_lo = t.bounding_box(v).first;
+    for (size_t i = 0; i < 3; ++i)
+        lo[i] = std::max(lo[i], bb_lo[i]);
+    t.tighten(v, lo);
+    return lo;
+}
+
 template <typename t_k3_treap>
 // items of result vector are (weight, z)
 std::vector<std::pair<uint64_t, uint64_t>>
 topk_increasing_z(const t_k3_treap& t, size_t k,
                   uint64_t x_lo, uint64_t x_hi,
-                  uint64_t y_lo, uint64_t y_hi) {
+                  uint64_t y_lo, uint64_t y_hi,
+                  const sdsl::bit_vector* excluded = nullptr) {
     using node = std::tuple<
         uint64_t, // lowest possible z coordinate
         uint8_t, // level (root = maximal level)
-        typename t_k3_treap::node_type // the node
+        typename t_k3_treap::node_type, // the node
+        k3_treap_ns::point_type // lower bound of the points below the node
         >;
     struct cmp {
         bool operator()(const node& a, const node& b) {
@@ -34,33 +61,34 @@ topk_increasing_z(const t_k3_treap& t, size_t k,
         }
     };
 
-    // items are (zmin, level, node), increasingly sorted by (zmin, -level)
+    // items are (zmin, level, node, lo), increasingly sorted by (zmin, -level)
     // TODO apparently it is better to sort from root to leaf, why?
     // Intuitively it should be better to sort from leaf to root
     std::priority_queue<node, std::vector<node>, cmp> q;
 
-    topk_heap2 result(k);
+    topk_heap2 result(k, excluded);
 
     if (t.size() == 0)
         return {};
 
     uint64_t d = 0;
 
-    auto is_valid = [&](const typename t_k3_treap::node_type& v) {
-        const auto bb = t.bounding_box(v);
-        const auto lo = bb.first;
-        const auto hi = bb.second;
+    auto is_valid = [&](const typename t_k3_treap::node_type& v,
+                        const k3_treap_ns::point_type& lo) {
+        const auto hi = t.bounding_box(v).second;
         return !(hi[2] < d || v.max_v <= result.lower_bound()
                 || hi[0] < x_lo || lo[0] > x_hi
                 || hi[1] < y_lo || lo[1] > y_hi);
     };
 
     auto root = t.root();
-    q.emplace(t.bounding_box(root).first[0], root.t, root);
-    while (!q.empty()) {
+    auto root_lo = subtree_lo(t, root, {0, 0, 0});
+    q.emplace(root_lo[2], root.t, root, root_lo);
+    while (!q.empty() && budget_step()) {
         const auto v = std::get<2>(q.top());
+        const auto lo = std::get<3>(q.top());
         q.pop();
-        if (!is_valid(v)) continue;
+        if (!is_valid(v, lo)) continue;
 
         uint64_t x = v.max_p[0], y = v.max_p[1], docid = v.max_p[2];
 
@@ -74,8 +102,9 @@ topk_increasing_z(const t_k3_treap& t, size_t k,
             d = docid + 1;
         } else {
             for (auto w : t.children(v)) {
-                if (!is_valid(w)) continue;
-                q.emplace(t.bounding_box(w).first[2], w.t, w);
+                auto w_lo = subtree_lo(t, w, lo);
+                if (!is_valid(w, w_lo)) continue;
+                q.emplace(w_lo[2], w.t, w, w_lo);
             }
         }
     }
@@ -227,12 +256,13 @@ topk_intersect2(
         const t_k3_treap& t, size_t k,
         std::vector<xy_range>& ranges,
         t_weight weight_init,
-        t_weight_reduce weight_reduce) {
+        t_weight_reduce weight_reduce,
+        const sdsl::bit_vector* excluded = nullptr) {
     const auto inf = std::numeric_limits<uint64_t>::max();
     if (t.size() == 0)
         return {};
 
-    topk_heap2 result(k);
+    topk_heap2 result(k, excluded);
     uint64_t d_lo = 0;
     uint64_t none = -1;
 
@@ -447,9 +477,95 @@ struct range2 {
 };
 */
 
+// Same as k3_treap_ns::top_k_iterator, but the queued nodes carry the
+// lower bound of subtree_lo, so nodes whose points all lie above the
+// query box are dropped without expanding them. This matters after
+// split2() shrinks the z range of the box.
+template <typename t_k3_treap>
+class bounded_top_k_iterator {
+public:
+    using node_type = k3_treap_ns::node_type;
+    using point_type = k3_treap_ns::point_type;
+    using t_point_val = std::pair<point_type, uint64_t>;
+
+private:
+    struct entry {
+        node_type v;
+        point_type lo;
+        bool operator<(const entry& e) const { return v < e.v; }
+    };
+
+    const t_k3_treap* m_treap = nullptr;
+    std::priority_queue<entry> m_pq;
+    t_point_val m_point_val;
+    bool m_valid = false;
+
+    bool overlap(const entry& e) const {
+        const auto hi = m_treap->bounding_box(e.v).second;
+        for (size_t i = 0; i < 3; ++i)
+            if (e.lo[i] > m_p2[i] || hi[i] < m_p1[i])
+                return false;
+        return true;
+    }
+
+public:
+    point_type m_p1;
+    point_type m_p2;
+
+    bounded_top_k_iterator() = default;
+    bounded_top_k_iterator(const t_k3_treap& treap, point_type p1, point_type p2)
+        : m_treap(&treap), m_p1(p1), m_p2(p2) {
+        if (treap.size() > 0) {
+            auto root = treap.root();
+            m_pq.push({root, subtree_lo(treap, root, {0, 0, 0})});
+            ++(*this);
+        }
+    }
+
+    bounded_top_k_iterator& operator++() {
+        m_valid = false;
+        while (!m_pq.empty()) {
+            auto e = m_pq.top();
+            m_pq.pop();
+            if (!overlap(e))
+                continue;
+            for (auto w : m_treap->children(e.v)) {
+                entry c{w, subtree_lo(*m_treap, w, e.lo)};
+                if (overlap(c))
+                    m_pq.push(c);
+            }
+            if (k3_treap_ns::contained(e.v.max_p, m_p1, m_p2)) {
+                m_point_val = t_point_val(e.v.max_p, e.v.max_v);
+                m_valid = true;
+                break;
+            }
+        }
+        return *this;
+    }
+
+    t_point_val operator*() const { return m_point_val; }
+    explicit operator bool() const { return m_valid; }
+
+    size_t queue_size() const { return m_pq.size(); }
+    uint64_t split_point() const { return (m_p1[2] + m_p2[2]) >> 1; }
+
+    std::array<bounded_top_k_iterator, 2> split2() const {
+        std::array<bounded_top_k_iterator, 2> res;
+        uint64_t mid = split_point();
+        uint64_t cur_z = m_point_val.first[2];
+        res[0] = *this;
+        res[0].m_p2[2] = mid;
+        if (cur_z > mid) ++res[0];
+        res[1] = *this;
+        res[1].m_p1[2] = mid + 1;
+        if (cur_z <= mid) ++res[1];
+        return res;
+    }
+};
+
 template <typename t_k3_treap>
 struct range2 {
-    using iter =  k3_treap_ns::top_k_iterator<t_k3_treap>;
+    using iter = bounded_top_k_iterator<t_k3_treap>;
     iter m_iter;
 
     range2(iter m_iter) : m_iter(std::move(m_iter)) {}
@@ -488,14 +604,15 @@ template <typename t_k3_treap>
 std::vector<std::pair<uint64_t, uint64_t>>
 topk_intersect3(const t_k3_treap& t, size_t k,
                 std::vector<xy_range>& ranges,
-                uint64_t weight_lower_bound = 0) {
+                uint64_t weight_lower_bound = 0,
+                const sdsl::bit_vector* excluded = nullptr) {
     using Range = range2<t_k3_treap>;
     if (ranges.empty()) abort();
     if (!t.size()) return {};
 
     const uint64_t inf = std::numeric_limits<uint64_t>::max();
     const uint64_t none = -1;
-    topk_heap2 result(k);
+    topk_heap2 result(k, excluded);
     auto get_cur_min = [&]() { return result.lower_bound(); };
 
     std::vector<std::vector<Range>> stacks(ranges.size());
@@ -513,7 +630,7 @@ topk_intersect3(const t_k3_treap& t, size_t k,
                 {r.first[0], r.first[1], 0},
                 {r.second[0], r.second[1], d_max});
                 */
-        Range k3r(k3_treap_ns::top_k(t,
+        Range k3r(typename Range::iter(t,
                     {r.first[0], r.first[1], 0},
                     {r.second[0], r.second[1], d_max}));
 
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "sdsl/k3_treap.hpp"
+
+namespace surf {
+
+//! k3-treap which additionally stores, for the nodes on every
+//! t_sample_rate-th level, the minimal y and z coordinate of the points in
+//! their subtree.
+/*!
+ * The bounding box of a node only tells us that its points lie somewhere
+ * in a cube of side k^t. In the node list grid most points have small y
+ * (depth) and the z (document) coordinates of a subtree are often
+ * clustered far away from the corner of the cube. The sampled minima let
+ * the traversals in k3_treap_algos order nodes by the smallest document
+ * they actually contain and drop nodes whose points all lie above the
+ * query range. Nodes on levels without samples inherit the bounds of
+ * their sampled ancestor.
+ *
+ * The minima are stored relative to the lower corner of the node, so a
+ * node on level l needs l * ceil(log2 k) bits per coordinate.
+ */
+template<typename t_k3_treap, uint8_t t_sample_rate = 4>
+class k3_treap_sampled : public t_k3_treap {
+    static_assert(t_sample_rate > 0, "t_sample_rate has to be positive.");
+public:
+    typedef typename t_k3_treap::size_type size_type;
+    using node_type = typename t_k3_treap::node_type;
+    using point_type = typename t_k3_treap::point_type;
+
+private:
+    // rank of the first node of each level, ranks are assigned in BFS order
+    sdsl::int_vector<64>            m_level_start;
+    std::vector<sdsl::int_vector<>> m_min_y; // per level, empty if not sampled
+    std::vector<sdsl::int_vector<>> m_min_z;
+
+    // ceil(log2 k), the bits per level of a coordinate offset
+    static constexpr uint8_t level_bits(uint64_t k) {
+        return k <= 1 ? 0 : 1 + level_bits((k + 1) / 2);
+    }
+
+    static bool sampled_level(uint8_t l) {
+        return l > 0 and l % t_sample_rate == 0;
+    }
+
+    static uint64_t rank(const node_type& v) {
+        return v.idx / (t_k3_treap::k * t_k3_treap::k * t_k3_treap::k);
+    }
+
+    void count_nodes(const node_type& v, std::vector<uint64_t>& cnt) const {
+        ++cnt[v.t];
+        for (const auto& w : this->children(v))
+            count_nodes(w, cnt);
+    }
+
+    // Returns the minimal y and z coordinate below v and stores them if
+    // the level of v is sampled.
+    std::pair<uint64_t, uint64_t> sample(const node_type& v) {
+        auto res = std::make_pair(v.max_p[1], v.max_p[2]);
+        for (const auto& w : this->children(v)) {
+            auto r = sample(w);
+            res.first = std::min(res.first, r.first);
+            res.second = std::min(res.second, r.second);
+        }
+        if (sampled_level(v.t) and !this->is_leaf(v)) {
+            uint64_t i = rank(v) - m_level_start[v.t];
+            m_min_y[v.t][i] = res.first - v.p[1];
+            m_min_z[v.t][i] = res.second - v.p[2];
+        }
+        return res;
+    }
+
+public:
+    k3_treap_sampled() = default;
+
+    //! Computes the samples for the points of the underlying treap.
+    void build_samples() {
+        const uint8_t t = this->t;
+        m_level_start = sdsl::int_vector<64>(t + 1, 0);
+        m_min_y = std::vector<sdsl::int_vector<>>(t + 1);
+        m_min_z = std::vector<sdsl::int_vector<>>(t + 1);
+        if (this->size() == 0)
+            return;
+        std::vector<uint64_t> cnt(t + 1, 0);
+        count_nodes(this->root(), cnt);
+        for (uint8_t l = t; l > 0; --l)
+            m_level_start[l - 1] = m_level_start[l] + cnt[l];
+        for (uint8_t l = 0; l <= t; ++l) {
+            if (sampled_level(l)) {
+                uint8_t width = std::min(64, l * level_bits(t_k3_treap::k));
+                m_min_y[l] = sdsl::int_vector<>(cnt[l], 0, width);
+                m_min_z[l] = sdsl::int_vector<>(cnt[l], 0, width);
+            }
+        }
+        sample(this->root());
+    }
+
+    //! Raises lo to the sampled minima of the subtree of v, if any.
+    void tighten(const node_type& v, point_type& lo) const {
+        if (!sampled_level(v.t) or this->is_leaf(v))
+            return;
+        uint64_t i = rank(v) - m_level_start[v.t];
+        lo[1] = std::max(lo[1], v.p[1] + m_min_y[v.t][i]);
+        lo[2] = std::max(lo[2], v.p[2] + m_min_z[v.t][i]);
+    }
+
+    size_type serialize(std::ostream& out,
+                        sdsl::structure_tree_node* v = nullptr,
+                        std::string name = "") const {
+        using namespace sdsl;
+        structure_tree_node* child = structure_tree::add_child(
+                                         v, name, util::class_name(*this));
+        size_type written_bytes = 0;
+        written_bytes += t_k3_treap::serialize(out, child, "treap");
+        written_bytes += m_level_start.serialize(out, child, "level_start");
+        written_bytes += serialize_vector(m_min_y, out, child, "min_y");
+        written_bytes += serialize_vector(m_min_z, out, child, "min_z");
+        structure_tree::add_size(child, written_bytes);
+        return written_bytes;
+    }
+
+    void load(std::istream& in) {
+        t_k3_treap::load(in);
+        m_level_start.load(in);
+        m_min_y.resize(m_level_start.size());
+        m_min_z.resize(m_level_start.size());
+        sdsl::load_vector(m_min_y, in);
+        sdsl::load_vector(m_min_z, in);
+    }
+};
+
+template<typename t_k3_treap, uint8_t t_sample_rate>
+void construct(k3_treap_sampled<t_k3_treap, t_sample_rate>& idx,
+               std::string file) {
+    construct(static_cast<t_k3_treap&>(idx), file);
+    idx.build_samples();
+}
+
+} // end namespace surf
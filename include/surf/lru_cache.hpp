@@ -0,0 +1,129 @@
+#pragma once
+
+#include <algorithm>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace surf {
+
+//! FNV-1a hash of a sequence of integral values.
+template<typename t_seq>
+struct seq_hash {
+    size_t operator()(const t_seq& seq) const {
+        uint64_t h = 14695981039346656037ULL;
+        for (const auto& c : seq) {
+            h ^= (uint64_t)c;
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+};
+
+//! Thread-safe LRU cache.
+/*!
+ * The cache is split into shards with a mutex each, so threads looking up
+ * different keys rarely wait for each other. Every entry has a cost, e.g.
+ * its size in bytes, and the least recently used entries of a shard are
+ * evicted once the sum of costs exceeds its share of the capacity.
+ *
+ * \tparam t_key   Key type.
+ * \tparam t_value Value type, copied out on a hit.
+ * \tparam t_hash  Hash function for keys.
+ */
+template<typename t_key, typename t_value, typename t_hash = std::hash<t_key>>
+class lru_cache {
+private:
+    struct entry {
+        t_key   key;
+        t_value value;
+        size_t  cost;
+    };
+    using list_type = std::list<entry>;
+
+    struct shard {
+        std::mutex mutex;
+        list_type  lru; // most recently used first
+        std::unordered_map<t_key, typename list_type::iterator, t_hash> map;
+        size_t     cost = 0;
+    };
+
+    size_t m_shard_capacity;
+    std::vector<std::unique_ptr<shard>> m_shards;
+
+    shard& shard_of(const t_key& key) {
+        return *m_shards[t_hash()(key) % m_shards.size()];
+    }
+
+    void erase(shard& s, typename list_type::iterator it) {
+        s.cost -= it->cost;
+        s.map.erase(it->key);
+        s.lru.erase(it);
+    }
+
+public:
+    //! Constructor
+    /*!
+     * \param capacity Maximal sum of the costs of the cached entries.
+     * \param shards   Number of independently locked shards.
+     */
+    explicit lru_cache(size_t capacity, size_t shards = 16) {
+        shards = std::max<size_t>(1, shards);
+        m_shard_capacity = std::max<size_t>(1, capacity / shards);
+        for (size_t i = 0; i < shards; ++i)
+            m_shards.emplace_back(new shard());
+    }
+
+    //! Copies the value of key to res. Returns false if key is not cached.
+    bool find(const t_key& key, t_value& res) {
+        auto& s = shard_of(key);
+        std::lock_guard<std::mutex> lock(s.mutex);
+        auto it = s.map.find(key);
+        if (it == s.map.end())
+            return false;
+        s.lru.splice(s.lru.begin(), s.lru, it->second);
+        res = it->second->value;
+        return true;
+    }
+
+    //! Inserts or replaces the value of key. Entries which cost more than
+    //! the capacity of a shard are not cached.
+    void insert(const t_key& key, const t_value& value, size_t cost = 1) {
+        auto& s = shard_of(key);
+        std::lock_guard<std::mutex> lock(s.mutex);
+        auto it = s.map.find(key);
+        if (it != s.map.end())
+            erase(s, it->second);
+        if (cost > m_shard_capacity)
+            return;
+        s.lru.push_front(entry{key, value, cost});
+        s.map.emplace(key, s.lru.begin());
+        s.cost += cost;
+        while (s.cost > m_shard_capacity)
+            erase(s, std::prev(s.lru.end()));
+    }
+
+    void clear() {
+        for (auto& s : m_shards) {
+            std::lock_guard<std::mutex> lock(s->mutex);
+            s->lru.clear();
+            s->map.clear();
+            s->cost = 0;
+        }
+    }
+
+    //! Sum of the costs of the cached entries.
+    size_t cost() {
+        size_t res = 0;
+        for (auto& s : m_shards) {
+            std::lock_guard<std::mutex> lock(s->mutex);
+            res += s->cost;
+        }
+        return res;
+    }
+};
+
+} // end namespace surf
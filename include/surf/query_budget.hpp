@@ -0,0 +1,148 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+
+namespace surf {
+
+//! Deadline and work budget of one query.
+/*!
+ * The expensive loops of the indexes (k2-treap iteration, naive counting
+ * of SA intervals, RMQ search for singleton documents) call
+ * budget_step() once per step. A query whose budget is exhausted stops
+ * early and returns the results found so far; truncated() tells the
+ * caller that they are partial. A step decodes a document or expands a
+ * treap node, which takes far longer than reading the clock.
+ *
+ * A budget is attached to the current thread with a budget_scope, so the
+ * signatures of the query methods do not change and a shared index stays
+ * reentrant. Parts of a query which run on other threads get a part()
+ * of the budget, which draws from the same steps.
+ */
+class query_budget {
+public:
+    using clock = std::chrono::steady_clock;
+
+private:
+    clock::time_point m_deadline;
+    bool              m_has_deadline = false;
+    uint64_t          m_steps_left = std::numeric_limits<uint64_t>::max();
+    bool              m_truncated = false;
+    std::atomic<int64_t>* m_shared_steps = nullptr; // steps of all parts, see part()
+
+    static constexpr uint64_t unlimited = std::numeric_limits<uint64_t>::max();
+
+    bool owns_steps() const {
+        return m_shared_steps == nullptr and m_steps_left != unlimited;
+    }
+
+public:
+    query_budget() = default;
+
+    //! Constructor
+    /*!
+     * \param timeout   Time limit of the query, zero for no limit.
+     * \param max_steps Maximal number of steps, zero for no limit.
+     * \param start     Start of the time limit, e.g. the arrival of a
+     *                  request which waited in a queue.
+     */
+    query_budget(std::chrono::microseconds timeout, uint64_t max_steps = 0,
+                 clock::time_point start = clock::now()) {
+        if (timeout.count() > 0) {
+            m_deadline = start + timeout;
+            m_has_deadline = true;
+        }
+        if (max_steps > 0)
+            m_steps_left = max_steps;
+    }
+
+    //! Accounts for one step. Returns false if the query has to stop.
+    bool step() {
+        if (m_truncated)
+            return false;
+        if (m_shared_steps) {
+            if (m_shared_steps->fetch_sub(1, std::memory_order_relaxed) <= 0) {
+                m_truncated = true;
+                return false;
+            }
+        } else if (m_steps_left != unlimited and m_steps_left-- == 0) {
+            m_truncated = true;
+            return false;
+        }
+        if (m_has_deadline and clock::now() >= m_deadline)
+            m_truncated = true;
+        return !m_truncated;
+    }
+
+    //! True if the deadline has passed.
+    bool expired() const {
+        return m_has_deadline and clock::now() >= m_deadline;
+    }
+
+    //! True if the query was stopped early.
+    bool truncated() const {
+        return m_truncated;
+    }
+
+    //! Marks the query as stopped early, e.g. if a part of it was.
+    void truncate() {
+        m_truncated = true;
+    }
+
+    //! Steps left to share between the parts of the query, see part().
+    int64_t shared_steps() const {
+        return std::min<uint64_t>(m_steps_left, std::numeric_limits<int64_t>::max());
+    }
+
+    //! Budget of a part of the query which runs on another thread.
+    /*!
+     * The part has the same deadline and takes its steps from steps,
+     * which all parts share and which starts at shared_steps(). join()
+     * charges the steps of the parts to this budget.
+     */
+    query_budget part(std::atomic<int64_t>& steps) const {
+        query_budget res = *this;
+        if (owns_steps())
+            res.m_shared_steps = &steps;
+        return res;
+    }
+
+    //! Takes the steps the parts of part() left over, and their truncation.
+    void join(const std::atomic<int64_t>& steps, bool truncated) {
+        if (owns_steps())
+            m_steps_left = std::max<int64_t>(0, steps.load());
+        if (truncated)
+            m_truncated = true;
+    }
+
+    //! Budget of the query the current thread is answering, if any.
+    static query_budget*& current() {
+        static thread_local query_budget* budget = nullptr;
+        return budget;
+    }
+};
+
+//! Attaches a budget to the current thread for the lifetime of the scope.
+class budget_scope {
+    query_budget* m_prev;
+public:
+    explicit budget_scope(query_budget& budget) : m_prev(query_budget::current()) {
+        query_budget::current() = &budget;
+    }
+    ~budget_scope() {
+        query_budget::current() = m_prev;
+    }
+    budget_scope(const budget_scope&) = delete;
+    budget_scope& operator=(const budget_scope&) = delete;
+};
+
+//! Accounts for one step of the current query, see query_budget::step().
+inline bool budget_step() {
+    auto budget = query_budget::current();
+    return budget == nullptr or budget->step();
+}
+
+} // end namespace surf
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+
+#include "sdsl/wt_helper.hpp"
+#include "surf/lru_cache.hpp"
+
+namespace surf {
+
+// SA interval of a pattern and the range an index derives from it, e.g.
+// the H range of the node lists or the range of the quantile grid.
+struct sa_interval {
+    sdsl::range_type sa;
+    sdsl::range_type derived;
+};
+
+//! Concurrent LRU cache mapping patterns to their sa_interval.
+/*!
+ * Query logs are heavily skewed, so the same patterns are searched over
+ * and over again. The cache can be shared by the index instances of
+ * several threads. The derived range is index specific, only share a
+ * cache between indexes of the same type over the same collection.
+ *
+ * \tparam t_token Token type of the patterns.
+ */
+template<typename t_token>
+class sa_interval_cache {
+public:
+    using key_type = std::vector<t_token>;
+
+private:
+    lru_cache<key_type, sa_interval, seq_hash<key_type>> m_cache;
+    size_t m_capacity;
+    size_t m_shards;
+    std::atomic<uint64_t> m_hits{0};
+    std::atomic<uint64_t> m_misses{0};
+
+public:
+    //! Constructor
+    /*!
+     * \param capacity Maximal number of cached patterns.
+     * \param shards   Number of independently locked shards.
+     */
+    explicit sa_interval_cache(size_t capacity, size_t shards = 16)
+        : m_cache(capacity, shards), m_capacity(capacity), m_shards(shards) {}
+
+    //! Looks up the pattern [begin, end). Returns false if it is not cached.
+    bool find(const t_token* begin, const t_token* end, sa_interval& res) {
+        if (m_cache.find(key_type(begin, end), res)) {
+            ++m_hits;
+            return true;
+        }
+        ++m_misses;
+        return false;
+    }
+
+    void insert(const t_token* begin, const t_token* end, const sa_interval& value) {
+        m_cache.insert(key_type(begin, end), value);
+    }
+
+    void clear() { m_cache.clear(); }
+
+    size_t capacity() const { return m_capacity; }
+    size_t shards() const { return m_shards; }
+    uint64_t hits() const { return m_hits; }
+    uint64_t misses() const { return m_misses; }
+};
+
+//! Returns the cached sa_interval of [begin, end), or computes and caches it.
+/*!
+ * \param cache   The cache, may be nullptr.
+ * \param compute Functor returning the sa_interval on a cache miss.
+ */
+template<typename t_token, typename t_compute>
+sa_interval cached_interval(sa_interval_cache<t_token>* cache,
+                            const t_token* begin, const t_token* end,
+                            t_compute compute) {
+    sa_interval res;
+    if (cache != nullptr and cache->find(begin, end, res))
+        return res;
+    res = compute();
+    if (cache != nullptr)
+        cache->insert(begin, end, res);
+    return res;
+}
+
+} // end namespace surf
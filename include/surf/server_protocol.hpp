@@ -0,0 +1,352 @@
+#pragma once
+
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "surf/compact_result.hpp"
+#include "surf/doc_filter.hpp"
+#include "surf/query_budget.hpp"
+#include "surf/topk_interface.hpp"
+
+namespace surf {
+
+// Binary framing of surf_server. Integers and weights are written in the
+// byte order of the server host, so clients have to run on hosts of the
+// same byte order. Tokens take sizeof(token_type) bytes, i.e. one byte for
+// byte alphabets and eight bytes for integer alphabets.
+//
+// request:
+//   uint8  type (request_type)
+//   uint8  flags (bit 0: multi_occ, bit 1: only_match, bit 2: doc_range,
+//                 bit 3: compact)
+//   uint32 k
+//   uint32 snippet_size, 0 if no snippets are requested
+//   uint32 timeout in microseconds from the arrival of the request at the
+//          server, 0 for the default of the server
+//   uint64 maximal number of steps, 0 for the default of the server
+//   [uint64 first doc id, uint64 last doc id] if doc_range is set
+//   uint32 number of terms, followed by each term as
+//          uint32 length, length tokens
+//   TOPK requests have exactly one term, INTERSECT and UNION requests at
+//   most max_terms, terms are not empty, k is at most max_k and
+//   snippet_size at most max_snippet_size. INTERSECT and
+//   UNION requests to an index which does not implement them, and
+//   requests without multi_occ to an index which can not report
+//   singletons, are answered with BAD_REQUEST. Requests whose deadline
+//   passed before they were started are answered with OVERLOADED.
+//
+// response:
+//   uint8  status (response_status)
+//   uint32 number of results, followed by each result as
+//          uint64 doc id, double weight
+//          [uint32 snippet length, snippet tokens] if snippet_size > 0
+//
+// compact response:
+//   uint8  status (response_status)
+//   uint32 number of results
+//   uint8  weight type (weight_type)
+//   each result as uint32 doc id, 32 bit weight
+//   [each snippet as uint32 snippet length, snippet tokens] if snippet_size > 0
+namespace server_protocol {
+
+enum request_type : uint8_t {
+    TOPK = 0,
+    INTERSECT = 1,
+    UNION = 2,
+};
+
+enum response_status : uint8_t {
+    OK = 0,
+    BAD_REQUEST = 1,
+    OVERLOADED = 2, // rejected by admission control or expired in the queue
+    TRUNCATED = 3,  // deadline or budget exceeded, the results are partial
+};
+
+enum request_flags : uint8_t {
+    MULTI_OCC = 1,
+    ONLY_MATCH = 2,
+    DOC_RANGE = 4, // only documents of [doc_lo, doc_hi] are returned
+    COMPACT = 8,   // the results are sent as compact_result
+};
+
+enum weight_type : uint8_t {
+    FREQUENCY = 0, // uint32
+    SCORE = 1,     // float
+};
+
+// Limits of k and snippet_size, the results and snippets are allocated
+// up front.
+constexpr uint32_t max_k = 1 << 16;
+constexpr uint32_t max_snippet_size = 1 << 20;
+// Limit of the number of terms, each term is decoded and searched.
+constexpr uint32_t max_terms = 64;
+
+template<typename t_token>
+struct request {
+    request_type type = TOPK;
+    uint8_t      flags = 0;
+    uint32_t     k = 10;
+    uint32_t     snippet_size = 0;
+    uint32_t     timeout_us = 0;
+    uint64_t     max_steps = 0;
+    uint64_t     doc_lo = 0;
+    uint64_t     doc_hi = 0;
+    std::vector<std::vector<t_token>> terms;
+};
+
+// A decoded response, see decode_response().
+template<typename t_token>
+struct response {
+    response_status status = OK;
+    topk_result_set results;
+    std::vector<std::vector<t_token>> snippets; // if snippet_size > 0
+};
+
+class reader {
+    const char* m_cur;
+    const char* m_end;
+public:
+    reader(const char* data, size_t size) : m_cur(data), m_end(data + size) {}
+
+    template<typename t_value>
+    bool read(t_value& x) {
+        if ((size_t)(m_end - m_cur) < sizeof(x))
+            return false;
+        memcpy(&x, m_cur, sizeof(x));
+        m_cur += sizeof(x);
+        return true;
+    }
+
+    bool at_end() const { return m_cur == m_end; }
+};
+
+template<typename t_value>
+void write(std::string& out, const t_value& x) {
+    out.append(reinterpret_cast<const char*>(&x), sizeof(x));
+}
+
+template<typename t_token>
+std::string encode_request(const request<t_token>& req) {
+    std::string out;
+    write(out, (uint8_t)req.type);
+    write(out, req.flags);
+    write(out, req.k);
+    write(out, req.snippet_size);
+    write(out, req.timeout_us);
+    write(out, req.max_steps);
+    if (req.flags & DOC_RANGE) {
+        write(out, req.doc_lo);
+        write(out, req.doc_hi);
+    }
+    write(out, (uint32_t)req.terms.size());
+    for (const auto& term : req.terms) {
+        write(out, (uint32_t)term.size());
+        for (const auto& c : term)
+            write(out, c);
+    }
+    return out;
+}
+
+// Returns false if the request is malformed. Every request needs at least
+// one term and every term at least one token.
+template<typename t_token>
+bool decode_request(const char* data, size_t size, request<t_token>& req) {
+    reader in(data, size);
+    uint8_t type;
+    uint32_t n_terms;
+    if (!in.read(type) or !in.read(req.flags) or !in.read(req.k)
+            or !in.read(req.snippet_size) or !in.read(req.timeout_us)
+            or !in.read(req.max_steps))
+        return false;
+    if (req.k > max_k or req.snippet_size > max_snippet_size)
+        return false;
+    if ((req.flags & DOC_RANGE) and (!in.read(req.doc_lo) or !in.read(req.doc_hi)))
+        return false;
+    if (!in.read(n_terms))
+        return false;
+    if (type > UNION or n_terms == 0 or n_terms > max_terms
+            or (type == TOPK and n_terms != 1))
+        return false;
+    req.type = (request_type)type;
+    req.terms.clear();
+    for (uint32_t i = 0; i < n_terms; ++i) {
+        uint32_t len;
+        if (!in.read(len) or len == 0 or len > size)
+            return false;
+        req.terms.emplace_back(len);
+        for (auto& c : req.terms.back())
+            if (!in.read(c))
+                return false;
+    }
+    return in.at_end();
+}
+
+// Returns false if the response to req is malformed.
+template<typename t_token>
+bool decode_response(const request<t_token>& req, const char* data, size_t size,
+                     response<t_token>& res) {
+    reader in(data, size);
+    uint8_t status;
+    uint32_t cnt;
+    if (!in.read(status) or !in.read(cnt) or status > TRUNCATED)
+        return false;
+    res.status = (response_status)status;
+    res.results.clear();
+    res.snippets.clear();
+    if (status == BAD_REQUEST or status == OVERLOADED)
+        return cnt == 0 and in.at_end();
+    if (cnt > req.k)
+        return false;
+    auto read_snippet = [&]() {
+        uint32_t len;
+        if (!in.read(len) or len > req.snippet_size)
+            return false;
+        res.snippets.emplace_back(len);
+        for (auto& c : res.snippets.back())
+            if (!in.read(c))
+                return false;
+        return true;
+    };
+    if (req.flags & COMPACT) {
+        uint8_t weights;
+        if (!in.read(weights) or weights > SCORE)
+            return false;
+        for (uint32_t i = 0; i < cnt; ++i) {
+            uint32_t doc;
+            double weight;
+            if (weights == FREQUENCY) {
+                uint32_t w;
+                if (!in.read(doc) or !in.read(w))
+                    return false;
+                weight = w;
+            } else {
+                float w;
+                if (!in.read(doc) or !in.read(w))
+                    return false;
+                weight = w;
+            }
+            res.results.emplace_back(doc, weight);
+        }
+        for (uint32_t i = 0; req.snippet_size and i < cnt; ++i)
+            if (!read_snippet())
+                return false;
+    } else {
+        for (uint32_t i = 0; i < cnt; ++i) {
+            uint64_t doc;
+            double weight;
+            if (!in.read(doc) or !in.read(weight))
+                return false;
+            res.results.emplace_back(doc, weight);
+            if (req.snippet_size and !read_snippet())
+                return false;
+        }
+    }
+    return in.at_end();
+}
+
+inline std::string status_response(response_status status) {
+    std::string out;
+    write(out, (uint8_t)status);
+    write(out, (uint32_t)0);
+    return out;
+}
+
+// Appends the results of a compact response. The results are collected
+// in a buffer of the thread and copied to the response as they are.
+template<typename t_token, typename t_weight>
+uint32_t write_compact(std::string& out, const topk_index<t_token>& idx,
+                       typename topk_index<t_token>::iter& it,
+                       const typename topk_index<t_token>::intersect_query& query,
+                       const request<t_token>& req) {
+    static thread_local compact_result_set<t_weight> buf;
+    buf.clear();
+    uint32_t cnt = take_compact(it, req.k, buf);
+    write(out, (uint8_t)(std::is_integral<t_weight>::value ? FREQUENCY : SCORE));
+    out.append(reinterpret_cast<const char*>(buf.data()), cnt * sizeof(buf[0]));
+    if (req.snippet_size) {
+        auto pattern = it.pattern();
+        if (sdsl::empty(pattern.sa))
+            pattern = topk_index<t_token>::first_term(query);
+        compact_topk_view<t_token, t_weight> view({buf.data(), buf.data() + cnt}, &idx, pattern);
+        for (const auto& snippet : view.extract_snippets(req.snippet_size)) {
+            write(out, (uint32_t)snippet.size());
+            for (const auto& c : snippet)
+                write(out, c);
+        }
+    }
+    return cnt;
+}
+
+//! Answers an encoded request with the given index.
+/*!
+ * \tparam t_weight Weight type of compact responses, see compact_weight.
+ * \param default_timeout_us Timeout of requests which do not set one.
+ * \param default_max_steps  Step budget of requests which do not set one.
+ * \param arrival            Time the request arrived, the timeout counts
+ *                           from there.
+ */
+template<typename t_token, typename t_weight = uint32_t>
+std::string handle_request(topk_index<t_token>& idx, const char* data, size_t size,
+                           uint32_t default_timeout_us = 0,
+                           uint64_t default_max_steps = 0,
+                           query_budget::clock::time_point arrival = query_budget::clock::now()) {
+    std::string out;
+    request<t_token> req;
+    if (!decode_request(data, size, req))
+        return status_response(BAD_REQUEST);
+    if ((req.type == INTERSECT and !idx.supports_intersect())
+            or (req.type == UNION and !idx.supports_union())
+            or (!(req.flags & MULTI_OCC) and !idx.supports_singletons()))
+        return status_response(BAD_REQUEST);
+    query_budget budget(std::chrono::microseconds(
+                            req.timeout_us ? req.timeout_us : default_timeout_us),
+                        req.max_steps ? req.max_steps : default_max_steps, arrival);
+    if (budget.expired())
+        return status_response(OVERLOADED);
+    budget_scope scope(budget);
+    doc_filter filter(req.doc_lo, req.doc_hi);
+    std::unique_ptr<filter_scope> filtered;
+    if (req.flags & DOC_RANGE)
+        filtered.reset(new filter_scope(filter));
+    bool multi_occ = req.flags & MULTI_OCC;
+    bool only_match = req.flags & ONLY_MATCH;
+    typename topk_index<t_token>::intersect_query query;
+    for (const auto& term : req.terms)
+        query.emplace_back(term.data(), term.data() + term.size());
+
+    std::unique_ptr<typename topk_index<t_token>::iter> it;
+    if (req.type == TOPK)
+        it = idx.topk(req.k, query[0].first, query[0].second, multi_occ, only_match);
+    else if (req.type == INTERSECT)
+        it = idx.topk_intersect(req.k, query, multi_occ, only_match);
+    else
+        it = idx.topk_union(req.k, query, multi_occ, only_match);
+
+    std::string results;
+    uint32_t cnt = 0;
+    if (req.flags & COMPACT) {
+        cnt = write_compact<t_token, t_weight>(results, idx, *it, query, req);
+    } else {
+        while (cnt < req.k and !it->done()) {
+            auto res = it->get();
+            write(results, (uint64_t)res.first);
+            write(results, (double)res.second);
+            if (req.snippet_size) {
+                auto snippet = it->extract_snippet(req.snippet_size);
+                write(results, (uint32_t)snippet.size());
+                for (const auto& c : snippet)
+                    write(results, c);
+            }
+            if (++cnt < req.k)
+                it->next();
+        }
+    }
+    write(out, (uint8_t)(budget.truncated() ? TRUNCATED : OK));
+    write(out, cnt);
+    return out + results;
+}
+
+} // end namespace server_protocol
+} // end namespace surf
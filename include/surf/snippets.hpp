@@ -0,0 +1,318 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "sdsl/suffix_array_algorithm.hpp"
+#include "surf/backward_search_batch.hpp"
+#include "surf/csa_text.hpp"
+#include "surf/topk_interface.hpp"
+
+namespace surf {
+
+// Half-open text range [first, second).
+using text_range = std::pair<uint64_t, uint64_t>;
+
+// Marks documents without a known occurrence of the pattern.
+constexpr uint64_t no_occurrence = std::numeric_limits<uint64_t>::max();
+
+// SA entries probed per document to find an occurrence in it.
+constexpr uint64_t kwic_probes_per_doc = 16;
+// SA entries probed by an occurrence_sample, as many as for a batch of
+// 32 documents.
+constexpr uint64_t kwic_sample_probes = 32 * kwic_probes_per_doc;
+
+namespace snippets_internal {
+
+template<typename t_token, typename t_csa>
+std::vector<std::vector<t_token>>
+extract_ranges(const t_csa& csa, const std::vector<text_range>& ranges, sdsl::lf_tag) {
+    std::vector<std::vector<t_token>> res(ranges.size());
+    std::vector<size_t> order(ranges.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return ranges[a].second > ranges[b].second;
+    });
+    uint64_t pos = 0, isa = 0; // isa = ISA[pos] of the last LF walk
+    bool walking = false;
+    auto lf = [&]() { // steps from pos to pos-1, returns T[pos-1]
+        auto rc = csa.wavelet_tree.inverse_select(isa);
+        isa = csa.C[csa.char2comp[rc.second]] + rc.first;
+        --pos;
+        return rc.second;
+    };
+    for (size_t i : order) {
+        uint64_t begin = ranges[i].first, end = ranges[i].second;
+        if (begin >= end)
+            continue;
+        uint64_t last = end - 1;
+        if (walking and last < pos and pos - last <= t_csa::isa_sample_dens) {
+            while (pos > last)
+                lf();
+        } else {
+            isa = csa.isa[last];
+            pos = last;
+        }
+        walking = true;
+        auto& text = res[i];
+        text.resize(end - begin);
+        text[last - begin] = sdsl::first_row_symbol(isa, csa);
+        while (pos > begin) {
+            auto c = lf();
+            text[pos - begin] = c;
+        }
+    }
+    return res;
+}
+
+template<typename t_token, typename t_csa>
+std::vector<std::vector<t_token>>
+extract_ranges(const t_csa& csa, const std::vector<text_range>& ranges, sdsl::psi_tag) {
+    std::vector<std::vector<t_token>> res(ranges.size());
+    for (size_t i = 0; i < ranges.size(); ++i) {
+        if (ranges[i].first >= ranges[i].second)
+            continue;
+        auto text = sdsl::extract(csa, ranges[i].first, ranges[i].second - 1);
+        res[i].assign(text.begin(), text.end());
+    }
+    return res;
+}
+
+} // end namespace snippets_internal
+
+//! Extracts the text of each of the ranges.
+/*!
+ * For LF-based CSAs the ranges are walked from right to left. A range
+ * which ends at most isa_sample_dens positions before the position the
+ * last walk stopped at continues that walk instead of starting at an ISA
+ * sample, so nearby ranges, e.g. the snippets of neighbouring documents,
+ * share their ISA lookups.
+ */
+template<typename t_token, typename t_csa>
+std::vector<std::vector<t_token>>
+extract_ranges(const t_csa& csa, const std::vector<text_range>& ranges) {
+    return snippets_internal::extract_ranges<t_token>(
+               csa, ranges, typename t_csa::extract_category());
+}
+
+//! Extracts the text of each of the ranges from the copy of the text.
+template<typename t_token, typename t_csa, typename t_text>
+std::vector<std::vector<t_token>>
+extract_ranges(const csa_text<t_csa, t_text>& csa, const std::vector<text_range>& ranges) {
+    std::vector<std::vector<t_token>> res(ranges.size());
+    for (size_t i = 0; i < ranges.size(); ++i) {
+        if (ranges[i].first >= ranges[i].second)
+            continue;
+        res[i].resize(ranges[i].second - ranges[i].first);
+        csa.text().extract(ranges[i].first, ranges[i].second, res[i].begin());
+    }
+    return res;
+}
+
+//! Text range of doc.
+/*!
+ * Document doc ends with the 1 at border_select(doc + 1), which is not
+ * part of the range.
+ */
+template<typename t_select>
+text_range doc_span(const t_select& border_select, uint64_t doc) {
+    return {doc == 0 ? 0 : border_select(doc) + 1, border_select(doc + 1)};
+}
+
+//! Text range of k tokens of doc around the occurrence at pos of a
+//! pattern of length len.
+/*!
+ * The occurrence is centered in the window, which is moved to stay
+ * inside the document. If pos is no_occurrence the window is the
+ * prefix of the document.
+ */
+template<typename t_select>
+text_range kwic_range(const t_select& border_select, uint64_t doc,
+                      uint64_t pos, uint64_t len, size_t k) {
+    auto span = doc_span(border_select, doc);
+    if (pos < span.first or pos >= span.second) // also no_occurrence
+        return {span.first, std::min<uint64_t>(span.second, span.first + k)};
+    uint64_t lead = k > len ? (k - len) / 2 : 0;
+    uint64_t begin = pos - std::min(lead, pos - span.first);
+    uint64_t end = std::min<uint64_t>(span.second, begin + k);
+    if (end - begin < k)
+        begin = std::max<uint64_t>(span.first, end > k ? end - k : 0);
+    return {begin, end};
+}
+
+//! Text positions of an occurrence of a pattern in each of the documents.
+/*!
+ * Document restricted locate on the SA interval sa of the pattern: at
+ * most max_probes evenly spaced entries of the interval are located,
+ * so each costs one SA lookup. Documents whose occurrences were all
+ * missed get no_occurrence. The frequent documents which top the
+ * results are found after a few probes.
+ */
+template<typename t_csa, typename t_rank>
+std::vector<uint64_t> doc_occurrences(const t_csa& csa, const t_rank& border_rank,
+                                      range_type sa, const std::vector<uint64_t>& docs,
+                                      uint64_t max_probes) {
+    std::vector<uint64_t> res(docs.size(), no_occurrence);
+    if (empty(sa) or docs.empty())
+        return res;
+    std::unordered_map<uint64_t, std::vector<size_t>> missing;
+    for (size_t i = 0; i < docs.size(); ++i)
+        missing[docs[i]].push_back(i);
+    uint64_t n = sa[1] - sa[0] + 1;
+    uint64_t probes = std::min(n, max_probes);
+    for (uint64_t p = 0; p < probes and !missing.empty(); ++p) {
+        uint64_t pos = csa[sa[0] + (uint64_t)((unsigned __int128)p * n / probes)];
+        auto it = missing.find(border_rank(pos));
+        if (it == missing.end())
+            continue;
+        for (auto i : it->second)
+            res[i] = pos;
+        missing.erase(it);
+    }
+    return res;
+}
+
+//! Occurrences of a pattern sampled from its SA interval.
+/*!
+ * For iterators which report one document at a time. The first call of
+ * find() locates max_probes evenly spaced entries of the interval and
+ * remembers an occurrence of each document seen, so the cost is
+ * shared by all results of the iterator.
+ */
+class occurrence_sample {
+    std::unordered_map<uint64_t, uint64_t> m_occs; // doc -> text position
+    bool m_sampled = false;
+
+public:
+    template<typename t_csa, typename t_rank>
+    uint64_t find(const t_csa& csa, const t_rank& border_rank, range_type sa,
+                  uint64_t doc, uint64_t max_probes) {
+        if (!m_sampled and !empty(sa)) {
+            uint64_t n = sa[1] - sa[0] + 1;
+            uint64_t probes = std::min(n, max_probes);
+            for (uint64_t p = 0; p < probes; ++p) {
+                uint64_t pos = csa[sa[0] + (uint64_t)((unsigned __int128)p * n / probes)];
+                m_occs.emplace(border_rank(pos), pos);
+            }
+        }
+        m_sampled = true;
+        auto it = m_occs.find(doc);
+        return it == m_occs.end() ? no_occurrence : it->second;
+    }
+};
+
+//! Snippets of k tokens of the documents around the occurrences at
+//! occs of a pattern of length len, see kwic_range().
+template<typename t_token, typename t_csa, typename t_select>
+std::vector<std::vector<t_token>>
+extract_windows(const t_csa& csa, const t_select& border_select,
+                const std::vector<uint64_t>& docs, const std::vector<uint64_t>& occs,
+                uint64_t len, size_t k) {
+    std::vector<text_range> ranges;
+    for (size_t i = 0; i < docs.size(); ++i)
+        ranges.push_back(kwic_range(border_select, docs[i], occs[i], len, k));
+    return extract_ranges<t_token>(csa, ranges);
+}
+
+//! SA interval of the pattern in csa, {1, 0} if it is empty or does not occur.
+template<typename t_token, typename t_csa>
+range_type snippet_range(const t_csa& csa, const snippet_pattern<t_token>& pattern) {
+    if (!empty(pattern.sa) or pattern.tokens.empty())
+        return pattern.sa;
+    return sa_range(csa, pattern.tokens.begin(), pattern.tokens.end());
+}
+
+//! Keyword in context snippets of the documents.
+/*!
+ * Each snippet is a window of k tokens around one occurrence of the
+ * pattern in the document, found with doc_occurrences(). Documents
+ * without a found occurrence, and all documents if the pattern is
+ * empty, get their first k tokens.
+ */
+template<typename t_token, typename t_csa, typename t_rank, typename t_select>
+std::vector<std::vector<t_token>>
+extract_snippets(const t_csa& csa, const t_rank& border_rank, const t_select& border_select,
+                 const std::vector<uint64_t>& docs, size_t k,
+                 const snippet_pattern<t_token>& pattern) {
+    auto sa = snippet_range(csa, pattern);
+    auto occs = doc_occurrences(csa, border_rank, sa, docs,
+                                kwic_probes_per_doc * docs.size());
+    return extract_windows<t_token>(csa, border_select, docs, occs, pattern.len, k);
+}
+
+//! Offsets of at most max_positions occurrences of the pattern in each of
+//! the documents, relative to the start of the document and sorted.
+/*!
+ * Either the SA interval of the pattern is located, keeping the entries
+ * of the documents, or the documents are extracted and searched for the
+ * pattern, whichever is cheaper: a located entry costs up to
+ * sa_sample_dens LF or psi steps, an extracted token one. Locating stops
+ * as soon as every document has max_positions occurrences, so which of
+ * the occurrences of a document with more are returned depends on the
+ * choice.
+ */
+template<typename t_token, typename t_csa, typename t_rank, typename t_select>
+std::vector<std::vector<uint64_t>>
+doc_positions(const t_csa& csa, const t_rank& border_rank, const t_select& border_select,
+              const std::vector<uint64_t>& docs, size_t max_positions,
+              const snippet_pattern<t_token>& pattern) {
+    std::vector<std::vector<uint64_t>> res(docs.size());
+    auto sa = snippet_range(csa, pattern);
+    if (empty(sa) or docs.empty() or max_positions == 0 or pattern.len == 0)
+        return res;
+    std::unordered_map<uint64_t, std::vector<size_t>> index;
+    std::vector<text_range> spans;
+    uint64_t scan_cost = 0;
+    for (size_t i = 0; i < docs.size(); ++i) {
+        index[docs[i]].push_back(i);
+        spans.push_back(doc_span(border_select, docs[i]));
+        scan_cost += spans.back().second - spans.back().first;
+    }
+    uint64_t n = sa[1] - sa[0] + 1;
+    if (n * t_csa::sa_sample_dens <= scan_cost) {
+        std::unordered_map<uint64_t, std::vector<uint64_t>> found;
+        size_t full = 0;
+        for (uint64_t i = sa[0]; i <= sa[1] and full < index.size(); ++i) {
+            uint64_t pos = csa[i];
+            uint64_t doc = border_rank(pos);
+            auto it = index.find(doc);
+            if (it == index.end())
+                continue;
+            auto& positions = found[doc];
+            if (positions.size() == max_positions)
+                continue;
+            positions.push_back(pos - spans[it->second[0]].first);
+            if (positions.size() == max_positions)
+                ++full;
+        }
+        for (auto& f : found) {
+            std::sort(f.second.begin(), f.second.end());
+            for (auto i : index[f.first])
+                res[i] = f.second;
+        }
+        return res;
+    }
+    auto tokens = pattern.tokens;
+    if (tokens.empty()) {
+        uint64_t pos = csa[sa[0]];
+        tokens = extract_ranges<t_token>(csa, {{pos, pos + pattern.len}})[0];
+    }
+    auto texts = extract_ranges<t_token>(csa, spans);
+    for (size_t i = 0; i < docs.size(); ++i) {
+        const auto& text = texts[i];
+        for (auto it = text.begin(); res[i].size() < max_positions; ++it) {
+            it = std::search(it, text.end(), tokens.begin(), tokens.end());
+            if (it == text.end())
+                break;
+            res[i].push_back(it - text.begin());
+        }
+    }
+    return res;
+}
+
+} // end namespace surf
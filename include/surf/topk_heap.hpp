@@ -1,14 +1,39 @@
 #pragma once
+#include <algorithm>
 #include <map>
+#include <memory>
 #include <vector>
 
+#include "sdsl/int_vector.hpp"
+#include "surf/doc_filter.hpp"
+
 namespace surf {
 
+// True if doc is marked in excluded, see topk_index::set_excluded_docs().
+inline bool excluded_doc(const sdsl::bit_vector* excluded, uint64_t doc) {
+    return excluded != nullptr and doc < excluded->size() and (*excluded)[doc];
+}
+
+// Exclusions of the documents [begin, end) of excluded, renumbered from 0.
+inline std::shared_ptr<const sdsl::bit_vector>
+excluded_slice(const sdsl::bit_vector* excluded, uint64_t begin, uint64_t end) {
+    if (excluded == nullptr)
+        return nullptr;
+    begin = std::min<uint64_t>(begin, excluded->size());
+    end = std::max(begin, std::min<uint64_t>(end, excluded->size()));
+    auto slice = std::make_shared<sdsl::bit_vector>(end - begin, 0);
+    for (uint64_t d = begin; d < end; ++d)
+        (*slice)[d - begin] = (*excluded)[d];
+    return slice;
+}
+
 class topk_heap {
 private:
     size_t m_k, m_result_size;
     std::vector<std::pair<uint64_t, uint64_t>> m_result;
     std::map<uint64_t, size_t> m_pos;
+    const sdsl::bit_vector* m_excluded; // documents which are never inserted
+    const doc_filter* m_filter = doc_filter::current();
 
     const uint64_t inf = std::numeric_limits<uint64_t>::max();
 
@@ -64,14 +89,16 @@ private:
 public:
     uint64_t updates = 0, total = 0;
 
-    topk_heap(size_t k)
-        : m_k(k), m_result_size(), m_result(k + 1) {}
+    topk_heap(size_t k, const sdsl::bit_vector* excluded = nullptr)
+        : m_k(k), m_result_size(), m_result(k + 1), m_excluded(excluded) {}
 
     uint64_t lower_bound() const {
         return m_result_size == m_k ? m_result[0].first : 0;
     }
 
     void insert(uint64_t docid, uint64_t weight) {
+        if (excluded_doc(m_excluded, docid) or !doc_allowed(m_filter, docid))
+            return;
         if (m_result_size == m_k) {
             // replace min
             //m_pos.erase(m_result[0].second);
@@ -88,7 +115,8 @@ public:
     }
 
     void insert_or_update(uint64_t docid, uint64_t weight) {
-        if (weight < lower_bound())
+        if (weight < lower_bound() or excluded_doc(m_excluded, docid)
+                or !doc_allowed(m_filter, docid))
             return;
         total++;
         //*
@@ -135,6 +163,9 @@ private:
     size_t m_k, m_result_size;
     // (weight, docid)
     std::vector<std::pair<uint64_t, uint64_t>> m_result;
+    const sdsl::bit_vector* m_excluded; // documents which are never inserted
+    const doc_filter* m_filter = doc_filter::current();
+
     const uint64_t inf = std::numeric_limits<uint64_t>::max();
 
     struct cmp {
@@ -145,13 +176,16 @@ private:
     };
 
 public:
-    topk_heap2(size_t k) : m_k(k), m_result_size(0), m_result(k + 1) {}
+    topk_heap2(size_t k, const sdsl::bit_vector* excluded = nullptr)
+        : m_k(k), m_result_size(0), m_result(k + 1), m_excluded(excluded) {}
 
     uint64_t lower_bound() const {
         return m_result_size == m_k ? m_result[0].first : 0;
     }
 
     void insert(uint64_t docid, uint64_t weight) {
+        if (excluded_doc(m_excluded, docid) or !doc_allowed(m_filter, docid))
+            return;
         m_result[m_result_size] = {weight, docid};
         if (m_result_size == m_k)
             std::pop_heap(m_result.data(), m_result.data() + m_result_size + 1, cmp());
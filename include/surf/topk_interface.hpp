@@ -5,12 +5,41 @@
 #include <string>
 #include <vector>
 
+#include "surf/doc_filter.hpp"
+#include "surf/query_budget.hpp"
+#include "surf/sa_interval_cache.hpp"
+#include "surf/topk_heap.hpp"
+
 namespace surf {
 
 // (doc id, weight)
 using topk_result = std::pair<uint64_t, double>;
 using topk_result_set = std::vector<topk_result>;
 
+// A result of topk_with_positions(): the offsets of occurrences of the
+// pattern relative to the start of the document, in increasing order.
+struct topk_positions {
+    uint64_t doc;
+    double weight;
+    std::vector<uint64_t> positions;
+};
+
+// The pattern snippets are centered on. sa and len describe it in the
+// index which extracts the snippets, if it is known there; indexes made
+// of other indexes (shards, delta) pass the tokens on, each part looks
+// them up itself.
+template <typename t_token>
+struct snippet_pattern {
+    std::vector<t_token> tokens;
+    sdsl::range_type sa = {{1, 0}};
+    uint64_t len = 0;
+
+    snippet_pattern() = default;
+    snippet_pattern(const t_token* begin, const t_token* end)
+        : tokens(begin, end), len(end - begin) {}
+    snippet_pattern(sdsl::range_type sa, uint64_t len) : sa(sa), len(len) {}
+};
+
 
 template <typename t_token>
 struct topk_iterator {
@@ -22,14 +51,28 @@ struct topk_iterator {
     virtual bool done() const = 0;
     virtual void next() = 0;
     virtual snippet_type extract_snippet(const size_t k) const = 0;
+
+    // The pattern of the results with its SA interval, if the iterator
+    // knows it, so the interval of the top-k search can be reused.
+    virtual snippet_pattern<t_token> pattern() const {
+        return {};
+    }
 };
 
+template <typename t_token, typename t_results>
+class results_topk_iterator;
+
+template <typename t_token>
+using vector_topk_iterator = results_topk_iterator<t_token, topk_result_set>;
+
 template <typename t_token>
 struct topk_index {
     using token_type = t_token;
     using iter = topk_iterator<t_token>;
     using snippet_type = std::vector<token_type>;
     using intersect_query = std::vector<std::pair<const token_type*, const token_type*>>;
+    using batch_query = intersect_query;
+    using pattern_type = snippet_pattern<t_token>;
 
     virtual ~topk_index() {}
     virtual std::unique_ptr<iter> topk(
@@ -43,6 +86,102 @@ struct topk_index {
         abort();
     }
 
+    virtual std::unique_ptr<iter> topk_union(
+            size_t k, const intersect_query& query,
+            bool multi_occ = false, bool match_only = false) {
+        std::cerr << "union not implemented" << std::endl;
+        abort();
+    }
+
+    // True if the index implements topk_intersect() or topk_union();
+    // the defaults above abort. Callers which take queries from outside,
+    // e.g. surf_server, reject the others.
+    virtual bool supports_intersect() const {
+        return false;
+    }
+
+    virtual bool supports_union() const {
+        return false;
+    }
+
+    // False if the queries need multi_occ, i.e. the index can not report
+    // documents which contain the pattern once.
+    virtual bool supports_singletons() const {
+        return true;
+    }
+
+    // Answers topk() for each pattern of the batch. The result sets hold
+    // at most k items each.
+    virtual std::vector<topk_result_set> topk_batch(
+            size_t k, const batch_query& patterns,
+            bool multi_occ = false, bool match_only = false) {
+        std::vector<topk_result_set> res;
+        for (const auto& p : patterns)
+            res.push_back(take(*topk(k, p.first, p.second, multi_occ, match_only), k));
+        return res;
+    }
+
+    // Snippets of k tokens of each of the documents around an occurrence
+    // of pattern, or their first k tokens if the pattern is empty or no
+    // occurrence was found. Used for the results held in a
+    // vector_topk_iterator. Indexes which can not extract documents
+    // return empty snippets.
+    virtual std::vector<snippet_type> extract_docs(const std::vector<uint64_t>& docs,
+                                                   size_t k,
+                                                   const pattern_type& pattern) const {
+        return std::vector<snippet_type>(docs.size());
+    }
+
+    // Offsets of at most max_positions occurrences of pattern in each of
+    // the documents, see topk_positions. Used by topk_with_positions().
+    // Indexes which can not locate occurrences return empty lists.
+    virtual std::vector<std::vector<uint64_t>> locate_docs(const std::vector<uint64_t>& docs,
+                                                           size_t max_positions,
+                                                           const pattern_type& pattern) const {
+        return std::vector<std::vector<uint64_t>>(docs.size());
+    }
+
+    // The first k results of topk() with the offsets of at most
+    // max_positions_per_doc occurrences of the pattern in each document.
+    // Only the occurrences in the returned documents are located, in
+    // the SA interval of the top-k search if the iterator knows it.
+    std::vector<topk_positions> topk_with_positions(
+            size_t k, const token_type* begin, const token_type* end,
+            size_t max_positions_per_doc, bool multi_occ = false, bool match_only = false) {
+        auto it = topk(k, begin, end, multi_occ, match_only);
+        auto pattern = it->pattern();
+        if (sdsl::empty(pattern.sa))
+            pattern = pattern_type(begin, end);
+        std::vector<topk_positions> res;
+        std::vector<uint64_t> docs;
+        for (const auto& r : take(*it, k)) {
+            res.push_back({r.first, r.second, {}});
+            docs.push_back(r.first);
+        }
+        auto positions = locate_docs(docs, max_positions_per_doc, pattern);
+        for (size_t i = 0; i < res.size(); ++i)
+            res[i].positions = std::move(positions[i]);
+        return res;
+    }
+
+    // Snippets of multi term queries are centered on the first term.
+    static pattern_type first_term(const intersect_query& query) {
+        if (query.empty())
+            return pattern_type();
+        return pattern_type(query[0].first, query[0].second);
+    }
+
+    // The first k results of the iterator.
+    static topk_result_set take(iter& it, size_t k) {
+        topk_result_set res;
+        while (res.size() < k and !it.done()) {
+            res.push_back(it.get());
+            if (res.size() < k)
+                it.next();
+        }
+        return res;
+    }
+
     void set_debug_stream(std::ostream* debug_stream) {
         m_debug_stream = debug_stream;
     }
@@ -51,8 +190,52 @@ struct topk_index {
         return m_debug_stream;
     }
 
+    // Patterns are looked up in the cache before they are searched in
+    // the CSA. The cache may be shared by several instances of the same
+    // index type, e.g. one per thread. Indexes made of other indexes
+    // pass it on.
+    virtual void set_interval_cache(std::shared_ptr<sa_interval_cache<token_type>> cache) {
+        m_interval_cache = std::move(cache);
+    }
+
+    sa_interval_cache<token_type>* get_interval_cache() const {
+        return m_interval_cache.get();
+    }
+
+    // Documents marked in excluded are skipped while the top-k results
+    // are searched, so the queries still return k results if there are
+    // enough documents left. Ids beyond the end of excluded are not
+    // excluded. The bitvector must not change while it is set; pass a
+    // new one instead, or nullptr to exclude nothing.
+    virtual void set_excluded_docs(std::shared_ptr<const sdsl::bit_vector> excluded) {
+        m_excluded = std::move(excluded);
+    }
+
+    const sdsl::bit_vector* get_excluded_docs() const {
+        return m_excluded.get();
+    }
+
+    // True if doc is excluded or not allowed by the filter of the query.
+    bool is_excluded(uint64_t doc) const {
+        return excluded_doc(m_excluded.get(), doc) or !doc_allowed(doc);
+    }
+
+    // The first k results of topk() among the documents filter allows.
+    // Use a filter_scope instead to iterate lazily or to filter the other
+    // query types.
+    std::unique_ptr<iter> topk_filtered(
+            size_t k, const token_type* begin, const token_type* end,
+            const doc_filter& filter, bool multi_occ = false, bool match_only = false) {
+        filter_scope scope(filter);
+        auto res = take(*topk(k, begin, end, multi_occ, match_only), k);
+        return std::make_unique<vector_topk_iterator<token_type>>(
+                   std::move(res), this, pattern_type(begin, end));
+    }
+
 private:
     std::ostream* m_debug_stream = nullptr;
+    std::shared_ptr<sa_interval_cache<token_type>> m_interval_cache;
+    std::shared_ptr<const sdsl::bit_vector> m_excluded;
 };
 
 template <typename t_alphabet_category>
@@ -64,14 +247,25 @@ struct topk_index_by_alphabet {
             char>::type>;
 };
 
-template <typename t_token>
-class vector_topk_iterator : public topk_iterator<t_token> {
+// Iterator over precomputed results. The snippets are extracted by idx
+// in batches of snippet_batch results, so the extract calls of nearby
+// documents can share work. They are centered on pattern, if given.
+// t_results is a random access container of items convertible to
+// topk_result, a topk_result_set for vector_topk_iterator.
+template <typename t_token, typename t_results>
+class results_topk_iterator : public topk_iterator<t_token> {
 public:
-    vector_topk_iterator() = delete;
-    explicit vector_topk_iterator(const topk_result_set& results) : m_results(results) {}
+    using snippet_type = typename topk_iterator<t_token>::snippet_type;
+    static constexpr size_t snippet_batch = 32;
+
+    results_topk_iterator() = delete;
+    explicit results_topk_iterator(t_results results,
+                                   const topk_index<t_token>* idx = nullptr,
+                                   snippet_pattern<t_token> pattern = {})
+        : m_results(std::move(results)), m_idx(idx), m_pattern(std::move(pattern)) {}
 
     topk_result get() const {
-        return m_results[m_index];
+        return topk_result(m_results[m_index]);
     }
 
     bool done() const override {
@@ -82,28 +276,61 @@ public:
         m_index++;
     }
 
+    snippet_pattern<t_token> pattern() const override {
+        return m_pattern;
+    }
+
     std::vector<t_token> extract_snippet(const size_t k) const override {
-        // TODO implement
-        return {};
+        if (m_idx == nullptr)
+            return {};
+        if (m_snippet_size != k or m_index < m_snippets_begin
+                or m_index >= m_snippets_begin + m_snippets.size()) {
+            std::vector<uint64_t> docs;
+            for (size_t i = m_index; i < m_results.size() and docs.size() < snippet_batch; ++i)
+                docs.push_back(topk_result(m_results[i]).first);
+            m_snippets = m_idx->extract_docs(docs, k, m_pattern);
+            m_snippets_begin = m_index;
+            m_snippet_size = k;
+        }
+        return m_snippets[m_index - m_snippets_begin];
+    }
+
+    //! Snippets of all results, extracted in one batch.
+    std::vector<snippet_type> extract_snippets(const size_t k) const {
+        if (m_idx == nullptr)
+            return std::vector<snippet_type>(m_results.size());
+        std::vector<uint64_t> docs;
+        for (size_t i = 0; i < m_results.size(); ++i)
+            docs.push_back(topk_result(m_results[i]).first);
+        return m_idx->extract_docs(docs, k, m_pattern);
     }
 
 private:
     size_t m_index = 0;
-    const topk_result_set& m_results;
+    t_results m_results;
+    const topk_index<t_token>* m_idx;
+    snippet_pattern<t_token> m_pattern;
+    mutable std::vector<snippet_type> m_snippets; // of results m_snippets_begin...
+    mutable size_t m_snippets_begin = 0;
+    mutable size_t m_snippet_size = 0;
 };
 
+// Sorts the results by decreasing weight. idx, if given, extracts the
+// snippets of the results around pattern.
 template <typename t_token>
 std::unique_ptr<topk_iterator<t_token>>
-sort_topk_results(topk_result_set* results) {
-    std::sort(results->begin(), results->end(),
+sort_topk_results(topk_result_set results, const topk_index<t_token>* idx = nullptr,
+                  snippet_pattern<t_token> pattern = {}) {
+    std::sort(results.begin(), results.end(),
               [&](const topk_result& a, const topk_result& b) {
                   return std::make_pair(-a.second, a.first) <
                     std::make_pair(-b.second, b.first);
               });
     // remove negative weights (we use this as a workaround inside idx_d to
     // implement multi_occ=true)
-    while(!results->empty() && results->back().second < 0) results->pop_back();
-    return std::make_unique<vector_topk_iterator<t_token>>(*results);
+    while(!results.empty() && results.back().second < 0) results.pop_back();
+    return std::make_unique<vector_topk_iterator<t_token>>(std::move(results), idx,
+                                                           std::move(pattern));
 }
 
 }  // namespace surf
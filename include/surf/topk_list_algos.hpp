@@ -0,0 +1,279 @@
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+#include "surf/topk_interface.hpp"
+
+namespace surf {
+namespace topk_list_algos {
+
+// Algorithms combining several result lists, each of which reports
+// (doc, weight) pairs in non-increasing weight order, like the iterators
+// returned by topk_index::topk. The treap iterators of the idx_nn
+// indexes get there by following node max_v values. Only sorted access
+// is used (NRA): the weight of the last item taken from a list bounds the
+// weight of every document not yet seen in that list. If multi_occ is
+// set, a list ends at the first document with weight one.
+
+struct candidate {
+    double   score = 0;
+    uint64_t seen = 0;  // bit i is set if seen in list i (i < 64)
+    size_t   cnt = 0;
+};
+
+template <typename t_list>
+class list_set {
+private:
+    std::vector<std::unique_ptr<t_list>>& m_lists;
+    bool                m_multi_occ;
+    std::vector<double> m_bound;
+    double              m_bound_sum;
+    uint64_t            m_exhausted = 0; // mask of exhausted lists (i < 64)
+    size_t              m_exhausted_cnt = 0;
+
+    bool done(size_t i) const {
+        return m_lists[i]->done() or
+            (m_multi_occ and m_lists[i]->get().second < 2);
+    }
+
+    void set_bound(size_t i, double bound) {
+        m_bound[i] = bound;
+        m_bound_sum = 0;
+        for (double b : m_bound)
+            m_bound_sum += b;
+    }
+
+    void exhaust(size_t i) {
+        set_bound(i, 0);
+        if (i < 64)
+            m_exhausted |= 1ULL << i;
+        ++m_exhausted_cnt;
+    }
+
+public:
+    list_set(std::vector<std::unique_ptr<t_list>>& lists, bool multi_occ)
+        : m_lists(lists), m_multi_occ(multi_occ),
+          m_bound(lists.size(), std::numeric_limits<double>::infinity()),
+          m_bound_sum(std::numeric_limits<double>::infinity()) {
+        for (size_t i = 0; i < size(); ++i)
+            if (done(i))
+                exhaust(i);
+    }
+
+    size_t size() const { return m_lists.size(); }
+    size_t exhausted_cnt() const { return m_exhausted_cnt; }
+    uint64_t exhausted() const { return m_exhausted; }
+    double bound_sum() const { return m_bound_sum; }
+
+    // Weight bound of documents not seen in list i.
+    double bound(size_t i) const { return m_bound[i]; }
+
+    // Takes the next item of the list with the largest bound. Returns
+    // the index of the list, or size() if all lists are exhausted.
+    size_t next(topk_result& item) {
+        size_t cur = size();
+        for (size_t i = 0; i < size(); ++i)
+            if (m_bound[i] > 0 // exhausted lists have bound 0
+                    and (cur == size() or m_bound[i] > m_bound[cur]))
+                cur = i;
+        if (cur == size())
+            return cur;
+        item = m_lists[cur]->get();
+        m_lists[cur]->next();
+        set_bound(cur, item.second);
+        return cur;
+    }
+
+    // Marks list i as exhausted if it has no more items. Returns true
+    // if that is the case.
+    bool check_exhausted(size_t i) {
+        if (m_bound[i] > 0 and done(i)) {
+            exhaust(i);
+            return true;
+        }
+        return false;
+    }
+
+    double upper_bound(const candidate& c) const {
+        double ub = c.score;
+        for (size_t i = 0; i < size(); ++i)
+            if (i >= 64 || !((c.seen >> i) & 1))
+                ub += m_bound[i];
+        return ub;
+    }
+};
+
+struct result_cmp {
+    bool operator()(const topk_result& a, const topk_result& b) const {
+        return a.second > b.second;
+    }
+};
+
+// Conjunctive top-k: documents have to occur in all lists, the score of
+// a document is the sum of its weights.
+template <typename t_list>
+topk_result_set
+topk_intersect(size_t k, std::vector<std::unique_ptr<t_list>>& lists,
+               bool multi_occ = false) {
+    list_set<t_list> ls(lists, multi_occ);
+    const size_t n = ls.size();
+    if (n == 0 || k == 0 || ls.exhausted_cnt() > 0)
+        return {};
+
+    std::unordered_map<uint64_t, candidate> cands;
+    // min-heap of the k best documents seen in all lists
+    std::priority_queue<topk_result, std::vector<topk_result>, result_cmp> result;
+    // true, if no document which was not seen yet can make it into the
+    // result anymore
+    bool closed = false;
+
+    for (size_t step = 1; ; ++step) {
+        topk_result item;
+        size_t cur = ls.next(item);
+        if (cur == n)
+            break;
+
+        auto it = cands.find(item.first);
+        if (it == cands.end() and !closed)
+            it = cands.emplace(item.first, candidate()).first;
+        if (it != cands.end()) {
+            auto& c = it->second;
+            c.score += item.second;
+            c.cnt++;
+            if (cur < 64)
+                c.seen |= 1ULL << cur;
+            if (c.cnt == n) {
+                result.emplace(it->first, c.score);
+                if (result.size() > k)
+                    result.pop();
+                cands.erase(it);
+            }
+        }
+        if (ls.check_exhausted(cur))
+            closed = true; // new documents miss list cur
+
+        double kth = result.size() == k ? result.top().second : -1;
+        closed = closed or ls.bound_sum() <= kth;
+        // Prune candidates once per round, there is no point in doing so
+        // as long as unseen documents can still make it.
+        if (closed && step % n == 0) {
+            for (auto it = cands.begin(); it != cands.end();) {
+                const auto& c = it->second;
+                if ((ls.exhausted() & ~c.seen) || ls.upper_bound(c) <= kth)
+                    it = cands.erase(it);
+                else
+                    ++it;
+            }
+            if (cands.empty())
+                break;
+        }
+    }
+
+    topk_result_set res;
+    while (!result.empty()) {
+        res.push_back(result.top());
+        result.pop();
+    }
+    return res;
+}
+
+// Disjunctive top-k: the score of a document is the sum of its weights
+// in all lists it occurs in. A score is only known exactly once the
+// document was seen in every list or the remaining lists are exhausted.
+template <typename t_list>
+topk_result_set
+topk_union(size_t k, std::vector<std::unique_ptr<t_list>>& lists,
+           bool multi_occ = false) {
+    list_set<t_list> ls(lists, multi_occ);
+    const size_t n = ls.size();
+    if (n == 0 || k == 0)
+        return {};
+
+    using cand_ref = std::pair<uint64_t, candidate*>;
+    std::unordered_map<uint64_t, candidate> cands;
+    bool closed = false;
+    std::vector<cand_ref> order;
+
+    auto resolved = [&](const candidate& c) {
+        if (n <= 64) {
+            uint64_t all = (n == 64) ? ~0ULL : (1ULL << n) - 1;
+            return (c.seen | ls.exhausted()) == all;
+        }
+        return c.cnt == n or ls.exhausted_cnt() == n;
+    };
+
+    // Returns true if the k candidates with the largest scores are the
+    // top-k result and their scores are final. Prunes candidates which
+    // can not make it into the result anymore.
+    auto finished = [&]() {
+        if (cands.size() < k)
+            return false;
+        order.clear();
+        for (auto& c : cands)
+            order.emplace_back(c.first, &c.second);
+        std::nth_element(order.begin(), order.begin() + (k - 1), order.end(),
+                         [](const cand_ref& a, const cand_ref& b) {
+                             return a.second->score > b.second->score;
+                         });
+        double kth = order[k - 1].second->score;
+        closed = closed or ls.bound_sum() <= kth;
+        if (!closed)
+            return false;
+        bool done = true;
+        for (size_t i = 0; i < k; ++i)
+            done = done and resolved(*order[i].second);
+        for (size_t i = k; i < order.size(); ++i) {
+            if (ls.upper_bound(*order[i].second) <= kth)
+                cands.erase(order[i].first);
+            else
+                done = false;
+        }
+        return done;
+    };
+
+    size_t next_check = n;
+    for (size_t step = 1; ; ++step) {
+        topk_result item;
+        size_t cur = ls.next(item);
+        if (cur == n)
+            break;
+        auto it = cands.find(item.first);
+        if (it == cands.end() and !closed)
+            it = cands.emplace(item.first, candidate()).first;
+        if (it != cands.end()) {
+            auto& c = it->second;
+            c.score += item.second;
+            c.cnt++;
+            if (cur < 64)
+                c.seen |= 1ULL << cur;
+        }
+        ls.check_exhausted(cur);
+        // Checking costs time linear in the number of candidates, so we
+        // only do it after a number of steps proportional to it.
+        if (step >= next_check) {
+            if (finished())
+                break;
+            next_check = step + std::max(n, cands.size() / 4);
+        }
+    }
+
+    topk_result_set res;
+    for (const auto& c : cands)
+        res.emplace_back(c.first, c.second.score);
+    if (res.size() > k) {
+        std::nth_element(res.begin(), res.begin() + (k - 1), res.end(),
+                         [](const topk_result& a, const topk_result& b) {
+                             return a.second > b.second;
+                         });
+        res.resize(k);
+    }
+    return res;
+}
+
+} // end namespace topk_list_algos
+} // end namespace surf
@@ -0,0 +1,233 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include "surf/lru_cache.hpp"
+#include "surf/topk_interface.hpp"
+
+namespace surf {
+
+//! Concurrent, memory bounded cache of top-k results.
+/*!
+ * For each query only the result of the largest k asked so far is kept.
+ * Its prefix answers every smaller k, and if it holds fewer than k items
+ * it is the complete result and answers every k. Queries are keyed by
+ * their kind (single pattern, intersection, union), their flags and
+ * their terms, so one cache can be shared by all threads querying the
+ * same index.
+ *
+ * \tparam t_token Token type of the patterns.
+ */
+template<typename t_token>
+class topk_result_cache {
+public:
+    using key_type = std::vector<uint64_t>;
+    using query_type = typename topk_index<t_token>::intersect_query;
+    enum query_kind : uint64_t { SINGLE = 0, INTERSECT = 1, UNION = 2 };
+
+private:
+    struct entry {
+        uint64_t        k;
+        topk_result_set res;
+    };
+
+    lru_cache<key_type, entry, seq_hash<key_type>> m_cache;
+    std::atomic<uint64_t> m_hits{0};
+    std::atomic<uint64_t> m_misses{0};
+
+public:
+    //! Constructor
+    /*!
+     * \param capacity Approximate maximal size of the cached results in bytes.
+     * \param shards   Number of independently locked shards.
+     */
+    explicit topk_result_cache(size_t capacity, size_t shards = 16)
+        : m_cache(capacity, shards) {}
+
+    static key_type key(query_kind kind, const query_type& query,
+                        bool multi_occ, bool only_match) {
+        using utoken_type = typename std::make_unsigned<t_token>::type;
+        key_type res{kind | (multi_occ << 2) | (only_match << 3)};
+        for (const auto& q : query) {
+            res.push_back(q.second - q.first);
+            for (auto it = q.first; it != q.second; ++it)
+                res.push_back((utoken_type)*it);
+        }
+        return res;
+    }
+
+    //! Looks up the first k results of a query. Returns false if the
+    //! cached result, if any, is too short.
+    bool find(const key_type& key, size_t k, topk_result_set& res) {
+        entry e;
+        if (m_cache.find(key, e) and (k <= e.k or e.res.size() < e.k)) {
+            res.assign(e.res.begin(), e.res.begin() + std::min(k, e.res.size()));
+            ++m_hits;
+            return true;
+        }
+        ++m_misses;
+        return false;
+    }
+
+    //! Stores the first k results of a query.
+    void insert(const key_type& key, size_t k, const topk_result_set& res) {
+        entry e;
+        if (m_cache.find(key, e) and e.k >= k)
+            return;
+        size_t cost = sizeof(entry) + 64 + key.size() * sizeof(uint64_t)
+                      + res.size() * sizeof(topk_result);
+        m_cache.insert(key, entry{k, res}, cost);
+    }
+
+    void clear() { m_cache.clear(); }
+
+    uint64_t hits() const { return m_hits; }
+    uint64_t misses() const { return m_misses; }
+};
+
+//! Adds a topk_result_cache to any topk_index.
+/*!
+ * Results are taken from the wrapped index and stored in the cache, hits
+ * do not touch the index at all. The returned iterators hold the
+ * materialized results, their snippets are extracted by the wrapped index.
+ */
+template<typename t_token>
+class cached_topk_index : public topk_index<t_token> {
+public:
+    using topk_interface = topk_index<t_token>;
+    using cache_type = topk_result_cache<t_token>;
+    using token_type = t_token;
+
+private:
+    topk_interface*             m_idx;
+    std::shared_ptr<cache_type> m_cache;
+
+    // Partial results of queries which ran out of budget are not cached.
+    static bool truncated() {
+        auto budget = query_budget::current();
+        return budget != nullptr and budget->truncated();
+    }
+
+    template<typename t_compute>
+    std::unique_ptr<typename topk_interface::iter>
+    cached(size_t k, const typename cache_type::key_type& key, t_compute compute,
+           typename topk_interface::pattern_type pattern) {
+        // Filtered queries bypass the cache, their results depend on the filter.
+        if (doc_filter::current())
+            return compute();
+        topk_result_set results;
+        if (!m_cache->find(key, k, results)) {
+            auto it = compute();
+            results = topk_interface::take(*it, k);
+            if (!truncated())
+                m_cache->insert(key, k, results);
+        }
+        return std::make_unique<vector_topk_iterator<t_token>>(std::move(results), this,
+                                                               std::move(pattern));
+    }
+
+public:
+    cached_topk_index(topk_interface* idx, std::shared_ptr<cache_type> cache)
+        : m_idx(idx), m_cache(std::move(cache)) {}
+
+    // The cached results were computed with the old exclusions.
+    void set_excluded_docs(std::shared_ptr<const sdsl::bit_vector> excluded) override {
+        topk_interface::set_excluded_docs(excluded);
+        m_idx->set_excluded_docs(std::move(excluded));
+        m_cache->clear();
+    }
+
+    std::vector<typename topk_interface::snippet_type>
+    extract_docs(const std::vector<uint64_t>& docs, size_t k,
+                 const typename topk_interface::pattern_type& pattern) const override {
+        return m_idx->extract_docs(docs, k, pattern);
+    }
+
+    std::vector<std::vector<uint64_t>>
+    locate_docs(const std::vector<uint64_t>& docs, size_t max_positions,
+                const typename topk_interface::pattern_type& pattern) const override {
+        return m_idx->locate_docs(docs, max_positions, pattern);
+    }
+
+    std::unique_ptr<typename topk_interface::iter> topk(
+        size_t k, const token_type* begin, const token_type* end,
+        bool multi_occ = false, bool only_match = false) override {
+        auto key = cache_type::key(cache_type::SINGLE, {{begin, end}},
+                                   multi_occ, only_match);
+        return cached(k, key, [&]() {
+            return m_idx->topk(k, begin, end, multi_occ, only_match);
+        }, {begin, end});
+    }
+
+    std::unique_ptr<typename topk_interface::iter> topk_intersect(
+        size_t k, const typename topk_interface::intersect_query& query,
+        bool multi_occ = false, bool only_match = false) override {
+        auto key = cache_type::key(cache_type::INTERSECT, query,
+                                   multi_occ, only_match);
+        return cached(k, key, [&]() {
+            return m_idx->topk_intersect(k, query, multi_occ, only_match);
+        }, topk_interface::first_term(query));
+    }
+
+    std::unique_ptr<typename topk_interface::iter> topk_union(
+        size_t k, const typename topk_interface::intersect_query& query,
+        bool multi_occ = false, bool only_match = false) override {
+        auto key = cache_type::key(cache_type::UNION, query,
+                                   multi_occ, only_match);
+        return cached(k, key, [&]() {
+            return m_idx->topk_union(k, query, multi_occ, only_match);
+        }, topk_interface::first_term(query));
+    }
+
+    bool supports_intersect() const override {
+        return m_idx->supports_intersect();
+    }
+
+    bool supports_union() const override {
+        return m_idx->supports_union();
+    }
+
+    bool supports_singletons() const override {
+        return m_idx->supports_singletons();
+    }
+
+    // Only the misses are passed on to the batch call of the index.
+    // Filtered batches bypass the cache like filtered queries.
+    std::vector<topk_result_set> topk_batch(
+        size_t k, const typename topk_interface::batch_query& patterns,
+        bool multi_occ = false, bool only_match = false) override {
+        if (doc_filter::current())
+            return m_idx->topk_batch(k, patterns, multi_occ, only_match);
+        std::vector<topk_result_set> res(patterns.size());
+        std::vector<typename cache_type::key_type> keys;
+        std::vector<size_t> missed;
+        typename topk_interface::batch_query misses;
+        for (size_t i = 0; i < patterns.size(); ++i) {
+            keys.push_back(cache_type::key(cache_type::SINGLE, {patterns[i]},
+                                           multi_occ, only_match));
+            if (!m_cache->find(keys.back(), k, res[i])) {
+                missed.push_back(i);
+                misses.push_back(patterns[i]);
+            }
+        }
+        if (!misses.empty()) {
+            auto computed = m_idx->topk_batch(k, misses, multi_occ, only_match);
+            bool partial = truncated();
+            for (size_t j = 0; j < missed.size(); ++j) {
+                res[missed[j]] = std::move(computed[j]);
+                if (!partial)
+                    m_cache->insert(keys[missed[j]], k, res[missed[j]]);
+            }
+        }
+        return res;
+    }
+
+    cache_type* get_result_cache() const {
+        return m_cache.get();
+    }
+};
+
+} // end namespace surf
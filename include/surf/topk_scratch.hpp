@@ -0,0 +1,109 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace surf {
+
+//! Two sets of doc ids, e.g. the reported and the singleton documents of
+//! a query, which are cleared in constant time.
+/*!
+ * A document is in a set if its stamp carries the current epoch and the
+ * bit of the set. Clearing starts a new epoch, so the array is allocated
+ * once for the largest collection and reused across queries. Tests and
+ * inserts are a single array access instead of the tree walk and node
+ * allocation of a std::set.
+ */
+class doc_marks {
+    static constexpr uint32_t flag_bits = 2;
+
+    std::vector<uint32_t> m_stamps; // epoch << flag_bits | flags, per doc
+    uint32_t              m_epoch = 0;
+
+public:
+    enum flag : uint32_t {REPORTED = 1, SINGLETON = 2};
+
+    //! Empties both sets and makes room for the doc ids [0, docs).
+    void clear(uint64_t docs) {
+        if (m_stamps.size() < docs)
+            m_stamps.resize(docs, 0);
+        if (++m_epoch == (uint32_t(1) << (32 - flag_bits))) {
+            std::fill(m_stamps.begin(), m_stamps.end(), 0);
+            m_epoch = 1;
+        }
+    }
+
+    bool contains(uint64_t doc, flag f) const {
+        uint32_t stamp = m_stamps[doc];
+        return (stamp >> flag_bits) == m_epoch and (stamp & f);
+    }
+
+    //! Adds doc to the set f. Returns false if it was already in it.
+    bool insert(uint64_t doc, flag f) {
+        uint32_t& stamp = m_stamps[doc];
+        if ((stamp >> flag_bits) != m_epoch)
+            stamp = m_epoch << flag_bits;
+        if (stamp & f)
+            return false;
+        stamp |= f;
+        return true;
+    }
+};
+
+//! Working memory of the iterators of idx_nn, idx_nn_k2_daat and
+//! idx_nn_k3: the reported and singleton documents and the stack of SA
+//! intervals of the RMQ search for singletons.
+/*!
+ * An iterator takes a scratch from a pool of the current thread with
+ * acquire() and gives it back when it is destroyed, so queries reuse the
+ * memory of earlier ones. Iterators which are alive at the same time, like
+ * those of the terms of a union, get a scratch each.
+ */
+class topk_scratch {
+public:
+    using interval_type = std::array<uint64_t, 2>;
+
+    struct release {
+        void operator()(topk_scratch* scratch) const {
+            auto& free = pool();
+            if (free.size() < max_pooled)
+                free.emplace_back(scratch);
+            else
+                delete scratch;
+        }
+    };
+    using pointer = std::unique_ptr<topk_scratch, release>;
+
+    doc_marks                  docs;
+    std::vector<interval_type> states; // used as a stack
+
+    //! A scratch with empty sets for the doc ids [0, doc_cnt).
+    static pointer acquire(uint64_t doc_cnt) {
+        auto& free = pool();
+        pointer scratch;
+        if (free.empty()) {
+            scratch.reset(new topk_scratch());
+        } else {
+            scratch.reset(free.back().release());
+            free.pop_back();
+        }
+        scratch->docs.clear(doc_cnt);
+        scratch->states.clear();
+        return scratch;
+    }
+
+private:
+    // Number of scratches kept per thread; more are only alive at the
+    // same time for queries with many terms.
+    static constexpr size_t max_pooled = 8;
+
+    static std::vector<std::unique_ptr<topk_scratch>>& pool() {
+        static thread_local std::vector<std::unique_ptr<topk_scratch>> free;
+        return free;
+    }
+};
+
+} // end namespace surf
@@ -10,6 +10,7 @@
 #include <stdlib.h>
 #include <iostream>
 
+#include <ftw.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -60,6 +61,20 @@ create_directory(std::string dir)
     }
 }
 
+// Removes dir and everything in it. Symbolic links are removed, not
+// followed.
+void
+remove_directory(std::string dir)
+{
+    if (!directory_exists(dir))
+        return;
+    auto remove_entry = [](const char* path, const struct stat*, int, struct FTW*) {
+        return ::remove(path);
+    };
+    if (nftw(dir.c_str(), remove_entry, 16, FTW_DEPTH | FTW_PHYS) == -1)
+        perror("could not remove directory");
+}
+
 template<typename alphabet_tag = sdsl::int_alphabet_tag>
 bool
 valid_collection(std::string collection_dir)
@@ -141,6 +156,29 @@ parse_collection(std::string collection_dir)
     return config;
 }
 
+// Creates a collection in dir with the given text. Integer collections
+// share the dictionary dict_file of the collection they are derived from.
+template<typename alphabet_tag, typename t_text>
+void
+create_collection(std::string dir, const t_text& text, std::string dict_file)
+{
+    surf::create_directory(dir);
+    if (std::is_same<alphabet_tag, sdsl::int_alphabet_tag>::value) {
+        sdsl::store_to_file(text, dir + "/" + surf::TEXT_FILENAME);
+        std::string symlink_name = dir + "/" + surf::DICT_FILENAME;
+        if (! surf::symlink_exists(symlink_name)) {
+            char* dict_absolute = realpath(dict_file.c_str(), NULL);
+            if (dict_absolute == nullptr or symlink(dict_absolute, symlink_name.c_str()) != 0) {
+                perror("cannot create symlink to dictionary in collection directory");
+                exit(EXIT_FAILURE);
+            }
+            free(dict_absolute);
+        }
+    } else {
+        sdsl::store_to_file(text, dir + "/" + surf::TEXT_FILENAME_BYTE);
+    }
+}
+
 // Remove all elements from array marked with zero in add_to_output.
 template <typename BV>
 void filter(sdsl::int_vector<>& array, const BV& add_to_output) {
@@ -55,7 +55,8 @@ def print_side_by_side(a, b):
 if __name__ == '__main__':
     p = argparse.ArgumentParser()
     p.add_argument('targets', metavar='CONFIG', nargs='+',
-            help='Configs to test')
+            help='Configs to test. CONFIG@DIRECTORY runs the config on another '
+                 'collection, e.g. one with the same documents')
     p.add_argument('--clear', default=False, action='store_true',
             help='Delete indexes before testing')
     p.add_argument('-c', dest='collection', required=True, metavar='DIRECTORY',
@@ -65,7 +66,8 @@ if __name__ == '__main__':
     p.add_argument('-r', default=20, type=int, metavar='INT',
             help='Number of testing rounds')
     p.add_argument('-q', default=1, type=int, metavar='INT',
-            help='Number of queries per round. For q > 1, no verification is done')
+            help='Number of queries per round. For q > 1, no verification is done, '
+                 'except with --batch')
     p.add_argument('-k', default=20, type=int, metavar='INT',
             help='Retrieve top k documents')
     p.add_argument('-e', default=1e-6, type=float, metavar='FLOAT',
@@ -74,6 +76,15 @@ if __name__ == '__main__':
             help='Only use ngrams that occur at least once every X samples. Useful for intersection queries')
     p.add_argument('-i', dest='intersection', default=1, type=int, metavar='INT',
             help='Generate intersection queries with the given number of terms')
+    p.add_argument('-u', dest='union', default=False, action='store_true',
+            help='Run the multi-term queries generated by -i as union queries')
+    p.add_argument('--doc_range', metavar='LO:HI',
+            help='Only retrieve the documents LO to HI (surf_query -F)')
+    p.add_argument('--batch', default=False, action='store_true',
+            help='Answer the queries of a round with one batch call (surf_query -b)')
+    p.add_argument('--protocol', default=False, action='store_true',
+            help='Also answer the queries of each config through the protocol of '
+                 'surf_server, with plain and compact responses (surf_query -p)')
     p.add_argument('-m', dest='multi_occ', default=True, action='store_true',
             help='Find only multi-occurences')
     p.add_argument('--no_multi_occ', dest='multi_occ', action='store_false',
@@ -92,6 +103,8 @@ if __name__ == '__main__':
             help='Build collections in sequence, instead of parallel')
 
     args = p.parse_args()
+    if args.protocol and args.batch:
+        p.error('--protocol can not be combined with --batch')
     collection_type = get_collection_type(args.collection)
 
     if args.clear:
@@ -100,13 +113,18 @@ if __name__ == '__main__':
 
     print 'Using build dir = %s' % args.build_dir
 
+    def parse_target(target):
+        config, _, directory = target.partition('@')
+        return config, directory or args.collection
+
     threads = []
-    for config in args.targets:
-        def build(config):
-            print 'Building index for config %s' % config
+    for target in args.targets:
+        def build(target):
+            config, directory = parse_target(target)
+            print 'Building index for config %s' % target
             cmd = [
                 '%s/surf_index-%s' % (args.build_dir, config),
-                '-c', args.collection
+                '-c', directory
             ]
             print '    Running command: %s' % ' '.join(cmd)
             try:
@@ -114,7 +132,7 @@ if __name__ == '__main__':
             except Exception:
                 sys.exit(1)
 
-        t = threading.Thread(target=build, args=(config,))
+        t = threading.Thread(target=build, args=(target,))
         t.start()
         if args.sequential:
             t.join()
@@ -125,7 +143,9 @@ if __name__ == '__main__':
     for t in threads:
         t.join()
 
-    if args.q != 1:
+    # The queries of a batch are checked one by one.
+    verify = args.q == 1 or args.batch
+    if not verify:
         print 'WARNING: No correctness will be checked. Use -q 1 if you want to do that'
 
     seed = args.seed
@@ -151,21 +171,33 @@ if __name__ == '__main__':
             res.align[cols[0]] = 'l'
             for c in cols[1:]: res.align[c] = 'r'
 
+            runs = []
+            for target in args.targets:
+                runs.append((target, []))
+                if args.protocol:
+                    runs.append((target, ['-p', 'plain']))
+                    runs.append((target, ['-p', 'compact']))
+
             result_count = 0
-            for config in args.targets:
-                print '    Running with %s' % config
+            for target, extra in runs:
+                print '    Running with %s %s' % (target, ' '.join(extra))
+                config, directory = parse_target(target)
                 cmd = [
                     '%s/surf_query-%s' % (args.build_dir, config),
-                    '-c', args.collection,
+                    '-c', directory,
                     '-q', f.name,
                     '-k', str(args.k),
-                ]
-                if args.q == 1:
+                ] + extra
+                if verify:
                     cmd += ['-v']
                 if args.multi_occ:
                     cmd += ['-m']
                 if args.intersection > 1:
-                    cmd += ['-i']
+                    cmd += ['-u'] if args.union else ['-i']
+                elif args.batch:
+                    cmd += ['-b']
+                if args.doc_range:
+                    cmd += ['-F', args.doc_range]
 
                 try:
                     out = exe(cmd)
@@ -173,25 +205,26 @@ if __name__ == '__main__':
                     print 'FAIL: Query program crashed'
                     sys.exit(1)
 
-                if args.q == 1:
-                    # check correctness only for q = 1
-                    lines = out.strip().splitlines()
-                    parts = [l.split(';') for l in lines]
-                    result = [(int(docid), float(score))
-                                for _, _, docid, score in parts]
-                    result_count = max(result_count, len(result))
-
-                    if not result_makes_sense(result, args.e):
-                        print 'Queries:', repr(queries)
-                        print 'FAIL with seed %d: Result is not sorted:' % seed, result
-                        assert 0
-                    if (last_result is not None
-                            and not results_are_same(last_result, result,
-                                args.e, args.ignore_singletons)):
-                        print 'Queries:', repr(queries)
-                        print 'FAIL with seed %d: Different results:' % seed
-                        print_side_by_side(last_result, result)
-                        sys.exit(1)
+                if verify:
+                    # results of each query, lines are RESULT query;rank;docid;score
+                    result = [[] for _ in range(args.q)]
+                    for l in out.strip().splitlines():
+                        query, _, docid, score = l.split(';')
+                        result[int(query.split()[1]) - 1].append((int(docid), float(score)))
+
+                    for i, r in enumerate(result):
+                        result_count = max(result_count, len(r))
+                        if not result_makes_sense(r, args.e):
+                            print 'Queries:', repr(queries)
+                            print 'FAIL with seed %d: Result of query %d is not sorted:' % (seed, i + 1), r
+                            assert 0
+                        if (last_result is not None
+                                and not results_are_same(last_result[i], r,
+                                    args.e, args.ignore_singletons)):
+                            print 'Queries:', repr(queries)
+                            print 'FAIL with seed %d: Different results for query %d:' % (seed, i + 1)
+                            print_side_by_side(last_result[i], r)
+                            sys.exit(1)
                     last_result = result
                 else:
                     # otherwise print time
@@ -199,9 +232,9 @@ if __name__ == '__main__':
                     median = int(out.split('time_per_query_median = ')[1].split()[0])
                     maxi = int(out.split('time_per_query_max = ')[1].split()[0])
                     sigma = float(out.split('time_per_query_sigma = ')[1].split()[0])
-                    res.add_row([config,avg,median,maxi,sigma])
+                    res.add_row([' '.join([target] + extra),avg,median,maxi,sigma])
             print 'Results: %d' % result_count
-            if args.q != 1:
+            if not verify:
                 print 'Time per query (sorted by Avg)'
                 print res.get_string(sortby='Avg')
         seed = random.randrange(1000000)
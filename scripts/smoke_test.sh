@@ -1,24 +1,74 @@
 #!/bin/bash
 set -xe
-TXT_CONFIGS="BRUTE_TXT IDX_NN IDX_NN_DOCID_SMART IDX_NN_K3_DAAT"
+TXT_CONFIGS="BRUTE_TXT IDX_NN IDX_NN_DOCID_SMART IDX_NN_K3_DAAT IDX_NN_K3_DAAT_SAMPLED IDX_NN_LG_16_QGRAM IDX_PLANNER IDX_NN_LG_16_DELTA IDX_NN_LG_16_DOCSAMPLE IDX_NN_16_DOCBLOCKS"
 INT_CONFIGS="BRUTE_INT IDX_NN_INT IDX_NN_DOCID_SMART_INT IDX_NN_K3_DAAT_INT"
-INTERSECT_TXT_CONFIGS="BRUTE_TXT IDX_NN_K3_DAAT"
-INTERSECT_INT_CONFIGS="BRUTE_INT"
+INTERSECT_TXT_CONFIGS="BRUTE_TXT IDX_NN_K3_DAAT IDX_NN_K3_DAAT_SAMPLED IDX_NN_QUANTILE IDX_NN_QUANTILE_SHARDED_4 IDX_NN_QUANTILE_8_32_DOCBLOCKS"
+INTERSECT_INT_CONFIGS="BRUTE_INT IDX_NN_QUANTILE_INT IDX_HYBRID_INT"
+# Indexes which report singleton documents, tested with --no_multi_occ.
+SINGLETON_TXT_CONFIGS="BRUTE_TXT IDX_NN_K3_DAAT IDX_NN_K3_DAAT_SAMPLED IDX_NN_DOCID_SMART"
+UNION_TXT_CONFIGS="BRUTE_TXT IDX_NN IDX_NN_K3_DAAT IDX_NN_QUANTILE IDX_PLANNER IDX_NN_QUANTILE_SHARDED_4"
+UNION_INT_CONFIGS="BRUTE_INT IDX_NN_INT IDX_NN_QUANTILE_INT IDX_HYBRID_INT"
+# Tested with one-token patterns, which the impact lists and idx_invidx answer.
+TERM_INT_CONFIGS="BRUTE_INT IDX_INVIDX_INT IDX_HYBRID_INT"
+# Indexes with their own topk_batch(), tested with rounds of 50 patterns.
+BATCH_TXT_CONFIGS="BRUTE_TXT IDX_NN IDX_NN_DOCID_SMART IDX_NN_K3_DAAT"
+BATCH_INT_CONFIGS="BRUTE_INT IDX_NN_INT IDX_NN_K3_DAAT_INT"
+# Also answered through the request handling of surf_server.
+PROTOCOL_TXT_CONFIGS="BRUTE_TXT IDX_NN_K3_DAAT"
+PROTOCOL_INT_CONFIGS="BRUTE_INT IDX_NN_K3_DAAT_INT"
+# Built on the first documents, which surf_update extends by the others.
+DELTA_TXT_CONFIG="IDX_NN_LG_16_DELTA"
 
 test_txt() {
     coll="$1"
-    scripts/build_config.sh -d $TXT_CONFIGS $INTERSECT_TXT_CONFIGS
+    scripts/build_config.sh -d $TXT_CONFIGS $INTERSECT_TXT_CONFIGS $UNION_TXT_CONFIGS
     scripts/compare.py -c "$coll" $TXT_CONFIGS -b build/debug
+    scripts/compare.py -c "$coll" --doc_range 20:120 $TXT_CONFIGS -b build/debug
+    scripts/compare.py -c "$coll" --no_multi_occ $SINGLETON_TXT_CONFIGS -b build/debug
+    scripts/compare.py -c "$coll" --batch -q 50 -n 1-3 $BATCH_TXT_CONFIGS -b build/debug
+    scripts/compare.py -c "$coll" --batch -q 50 -n 1-3 --doc_range 20:120 $BATCH_TXT_CONFIGS -b build/debug
     scripts/compare.py -c "$coll" -i 2 $INTERSECT_TXT_CONFIGS -b build/debug
     scripts/compare.py -c "$coll" -i 3 $INTERSECT_TXT_CONFIGS -b build/debug
+    scripts/compare.py -c "$coll" -i 2 -u $UNION_TXT_CONFIGS -b build/debug
+    scripts/compare.py -c "$coll" --protocol $PROTOCOL_TXT_CONFIGS -b build/debug
+    scripts/compare.py -c "$coll" --protocol --doc_range 20:120 $PROTOCOL_TXT_CONFIGS -b build/debug
+    scripts/compare.py -c "$coll" --protocol -i 2 $PROTOCOL_TXT_CONFIGS -b build/debug
+    scripts/compare.py -c "$coll" --protocol -i 2 -u $PROTOCOL_TXT_CONFIGS -b build/debug
+}
+
+# Compares the delta index, after adding documents, deleting documents of
+# the base and of the delta and merging, with BRUTE on the combined
+# collection, in which the deleted documents are blanked out.
+test_delta() {
+    coll="$1"
+    dir=$(mktemp -d)
+    scripts/build_config.sh -d BRUTE_TXT $DELTA_TXT_CONFIG
+    scripts/build.sh -d surf_update-$DELTA_TXT_CONFIG
+    scripts/split_collection.py -c "$coll" -o "$dir" -s 150 -d 3 -d 170
+    build/debug/surf_index-$DELTA_TXT_CONFIG -c "$dir/base"
+    build/debug/surf_update-$DELTA_TXT_CONFIG -c "$dir/base" -a "$dir/added" -d 3 -d 170
+    scripts/compare.py -c "$coll" $DELTA_TXT_CONFIG@"$dir/base" BRUTE_TXT@"$dir/combined" -b build/debug
+    scripts/compare.py -c "$coll" --no_multi_occ $DELTA_TXT_CONFIG@"$dir/base" BRUTE_TXT@"$dir/combined" -b build/debug
+    build/debug/surf_update-$DELTA_TXT_CONFIG -c "$dir/base" -M
+    scripts/compare.py -c "$coll" $DELTA_TXT_CONFIG@"$dir/base" BRUTE_TXT@"$dir/combined" -b build/debug
+    scripts/compare.py -c "$coll" --doc_range 100:190 $DELTA_TXT_CONFIG@"$dir/base" BRUTE_TXT@"$dir/combined" -b build/debug
+    rm -r "$dir"
 }
 
 test_int() {
     coll="$1"
-    scripts/build_config.sh -d $INT_CONFIGS $INTERSECT_INT_CONFIGS
+    scripts/build_config.sh -d $INT_CONFIGS $INTERSECT_INT_CONFIGS $UNION_INT_CONFIGS $TERM_INT_CONFIGS
     scripts/compare.py -c "$coll" $INT_CONFIGS -b build/debug
+    scripts/compare.py -c "$coll" --doc_range 20:120 $INT_CONFIGS -b build/debug
+    scripts/compare.py -c "$coll" --batch -q 50 -n 1-2 $BATCH_INT_CONFIGS -b build/debug
     scripts/compare.py -c "$coll" -i 2 $INTERSECT_INT_CONFIGS -b build/debug
     scripts/compare.py -c "$coll" -i 3 $INTERSECT_INT_CONFIGS -b build/debug
+    scripts/compare.py -c "$coll" -i 2 -u $UNION_INT_CONFIGS -b build/debug
+    scripts/compare.py -c "$coll" -n 1 $TERM_INT_CONFIGS -b build/debug
+    scripts/compare.py -c "$coll" -n 1 -i 2 $TERM_INT_CONFIGS -b build/debug
+    scripts/compare.py -c "$coll" -n 1 -i 3 -u $TERM_INT_CONFIGS -b build/debug
+    scripts/compare.py -c "$coll" -n 1 --protocol $PROTOCOL_INT_CONFIGS -b build/debug
+    scripts/compare.py -c "$coll" -n 1 --protocol -i 2 $PROTOCOL_INT_CONFIGS -b build/debug
 }
 
 scripts/build.sh -d gen_patterns
@@ -28,11 +78,13 @@ if [[ $# > 0 ]]; then
     if [[ -e "$coll/text_SURF.sdsl" ]]; then
         echo "Testing character-based collection"
         test_txt "$coll"
+        test_delta "$coll"
     else
         echo "Testing integer collection"
         test_int "$coll"
     fi
 else
     test_txt collections/TEST_TXT
+    test_delta collections/TEST_TXT
     test_int collections/TEST_INT
 fi
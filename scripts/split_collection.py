@@ -0,0 +1,51 @@
+#!/usr/bin/env python2
+"""
+Splits a character-based collection into two for the tests of idx_delta:
+OUT/base holds the first documents and OUT/added the others. OUT/combined
+holds all documents again, with the deleted ones blanked out, so queries
+on it return what the base index should return after the added documents
+and the deletions.
+"""
+import argparse
+import os
+import struct
+
+TEXT_FILENAME = 'text_SURF.sdsl'
+BLANK = '\2'
+
+def load_text(directory):
+    """ The bytes of an int_vector<8> without the terminating 0. """
+    with open('%s/%s' % (directory, TEXT_FILENAME), 'rb') as f:
+        data = f.read()
+    bits, = struct.unpack('<Q', data[:8])
+    return data[8:8 + bits // 8].rstrip('\0')
+
+def store_text(directory, text):
+    """ Stores text and a terminating 0 as an int_vector<8>. """
+    if not os.path.exists(directory):
+        os.makedirs(directory)
+    text += '\0'
+    with open('%s/%s' % (directory, TEXT_FILENAME), 'wb') as f:
+        f.write(struct.pack('<Q', 8 * len(text)))
+        f.write(text + '\0' * (-len(text) % 8))
+
+if __name__ == '__main__':
+    p = argparse.ArgumentParser()
+    p.add_argument('-c', dest='collection', required=True, metavar='DIRECTORY',
+            help='Input collection')
+    p.add_argument('-o', dest='output', required=True, metavar='DIRECTORY',
+            help='Output directory')
+    p.add_argument('-s', dest='split', required=True, type=int, metavar='INT',
+            help='Number of documents of the base collection')
+    p.add_argument('-d', dest='deleted', default=[], type=int, action='append', metavar='INT',
+            help='Blank out the document in the combined collection')
+    args = p.parse_args()
+
+    # documents end with a 1
+    docs = [d + '\1' for d in load_text(args.collection).split('\1')[:-1]]
+    assert 0 < args.split < len(docs), 'Collection has only %d documents' % len(docs)
+    store_text(args.output + '/base', ''.join(docs[:args.split]))
+    store_text(args.output + '/added', ''.join(docs[args.split:]))
+    for d in args.deleted:
+        docs[d] = BLANK * (len(docs[d]) - 1) + '\1'
+    store_text(args.output + '/combined', ''.join(docs))
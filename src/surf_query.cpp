@@ -1,5 +1,7 @@
 #include "surf/config.hpp"
 #include "surf/indexes.hpp"
+#include "surf/server_protocol.hpp"
+#include "surf/topk_result_cache.hpp"
 #include <unistd.h>
 #include <stdlib.h>
 #include <iostream>
@@ -25,8 +27,21 @@ typedef struct cmdargs {
     bool multi_occ = false;
     bool match_only = false;
     bool intersection = false;
+    bool union_query = false;
+    bool batch = false;
+    std::string protocol = "";
+    uint64_t interval_cache_size = 0;
+    uint64_t result_cache_size = 0;
     uint64_t snippet_size = 0;
+    uint64_t max_positions = 0;
+    uint64_t timeout_us = 0;
+    uint64_t max_steps = 0;
     const char* debug_file = nullptr;
+    std::string excluded_file = "";
+    std::string allowed_file = "";
+    uint64_t doc_lo = 0;
+    uint64_t doc_hi = std::numeric_limits<uint64_t>::max();
+    bool filtered = false;
 } cmdargs_t;
 
 void
@@ -40,8 +55,20 @@ print_usage(char* program)
     fprintf(stdout, "  -v <verbose>      : verbose mode.\n");
     fprintf(stdout, "  -m <multi_occ>    : only retrieve documents which contain the term more than once.\n");
     fprintf(stdout, "  -o <only_match>   : only match pattern; no document retrieval.\n");
+    fprintf(stdout, "  -u <union>        : rank documents containing any of the query terms.\n");
+    fprintf(stdout, "  -b <batch>        : answer all queries with one batch call.\n");
+    fprintf(stdout, "  -p <format>       : answer the queries through the protocol of surf_server,\n");
+    fprintf(stdout, "                      with plain or compact responses.\n");
+    fprintf(stdout, "  -C <cache_size>   : cache the SA intervals of up to cache_size patterns.\n");
+    fprintf(stdout, "  -R <cache_bytes>  : cache top-k results in up to cache_bytes bytes.\n");
+    fprintf(stdout, "  -T <timeout>      : stop queries after timeout microseconds.\n");
+    fprintf(stdout, "  -B <max_steps>    : stop queries after max_steps steps.\n");
     fprintf(stdout, "  -s <snippet_size> : extract snippets of size snippet_size.\n");
+    fprintf(stdout, "  -P <max_positions>: locate up to max_positions occurrences in each result.\n");
     fprintf(stdout, "  -d <debug file>   : file for extra data or custom benchmark results.\n");
+    fprintf(stdout, "  -x <doc file>     : never retrieve the doc ids listed in doc file.\n");
+    fprintf(stdout, "  -A <doc file>     : only retrieve the doc ids listed in doc file.\n");
+    fprintf(stdout, "  -F <lo>:<hi>      : only retrieve the doc ids lo to hi.\n");
     fprintf(stdout, "  -t                : print times for each query individually.\n");
 };
 
@@ -53,7 +80,7 @@ parse_args(int argc, char* const argv[])
     args.collection_dir = "";
     args.query_file = "";
     args.k = 10;
-    while ((op = getopt(argc, argv, "c:q:k:vmos:id:t")) != -1) {
+    while ((op = getopt(argc, argv, "c:q:k:vmos:P:iubp:C:R:T:B:d:tx:A:F:")) != -1) {
         switch (op) {
             case 'c':
                 args.collection_dir = optarg;
@@ -79,12 +106,51 @@ parse_args(int argc, char* const argv[])
             case 's':
                 args.snippet_size = std::strtoul(optarg, NULL, 10);
                 break;
+            case 'P':
+                args.max_positions = std::strtoul(optarg, NULL, 10);
+                break;
             case 'i':
                 args.intersection = true;
                 break;
+            case 'u':
+                args.union_query = true;
+                break;
+            case 'b':
+                args.batch = true;
+                break;
+            case 'p':
+                args.protocol = optarg;
+                break;
+            case 'C':
+                args.interval_cache_size = std::strtoul(optarg, NULL, 10);
+                break;
+            case 'R':
+                args.result_cache_size = std::strtoul(optarg, NULL, 10);
+                break;
+            case 'T':
+                args.timeout_us = std::strtoul(optarg, NULL, 10);
+                break;
+            case 'B':
+                args.max_steps = std::strtoul(optarg, NULL, 10);
+                break;
             case 't':
                 args.verbose_timings = true;
                 break;
+            case 'x':
+                args.excluded_file = optarg;
+                break;
+            case 'A':
+                args.allowed_file = optarg;
+                args.filtered = true;
+                break;
+            case 'F': {
+                char* hi = nullptr;
+                args.doc_lo = std::strtoul(optarg, &hi, 10);
+                if (*hi == ':')
+                    args.doc_hi = std::strtoul(hi + 1, NULL, 10);
+                args.filtered = true;
+                break;
+            }
             case '?':
             default:
                 print_usage(argv[0]);
@@ -95,6 +161,15 @@ parse_args(int argc, char* const argv[])
         print_usage(argv[0]);
         exit(EXIT_FAILURE);
     }
+    if (args.protocol != "" and (args.protocol != "plain" and args.protocol != "compact")) {
+        std::cerr << "Unknown response format " << args.protocol << ".\n";
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (args.protocol != "" and (args.batch or args.max_positions or args.allowed_file != "")) {
+        std::cerr << "-p can not be combined with -b, -P or -A.\n";
+        exit(EXIT_FAILURE);
+    }
     return args;
 }
 
@@ -172,6 +247,61 @@ uint64_t get_input_size<sdsl::int_alphabet_tag>(string dir) {
     return size_in_bytes(text);
 }
 
+// Results of a surf_server response with the snippets it holds.
+template<typename t_token>
+class response_topk_iterator : public topk_iterator<t_token> {
+    server_protocol::response<t_token> m_res;
+    size_t m_i = 0;
+public:
+    explicit response_topk_iterator(server_protocol::response<t_token> res)
+        : m_res(std::move(res)) {}
+
+    topk_result get() const override { return m_res.results[m_i]; }
+    bool done() const override { return m_i >= m_res.results.size(); }
+    void next() override { ++m_i; }
+    std::vector<t_token> extract_snippet(const size_t) const override {
+        return m_i < m_res.snippets.size() ? m_res.snippets[m_i] : std::vector<t_token>();
+    }
+};
+
+// Answers a query like surf_server: the request is encoded, answered by
+// handle_request and the response is decoded again.
+template<typename t_token>
+std::unique_ptr<topk_iterator<t_token>>
+protocol_query(topk_index<t_token>& topk, const server_protocol::request<t_token>& req,
+               size_t& truncated)
+{
+    using weight_type = compact_weight<idx_type>::type;
+    auto data = server_protocol::encode_request(req);
+    auto out = server_protocol::handle_request<t_token, weight_type>(
+                   topk, data.data(), data.size());
+    server_protocol::response<t_token> res;
+    if (!server_protocol::decode_response(req, out.data(), out.size(), res)) {
+        cerr << "Malformed response" << endl;
+        exit(EXIT_FAILURE);
+    }
+    if (res.status == server_protocol::BAD_REQUEST)
+        cerr << "Request rejected" << endl;
+    truncated += res.status == server_protocol::TRUNCATED;
+    return make_unique<response_topk_iterator<t_token>>(std::move(res));
+}
+
+// Marks the doc ids listed in file.
+bool load_doc_set(const string& file, bit_vector& docs) {
+    ifstream in(file);
+    if (!in)
+        return false;
+    vector<uint64_t> ids;
+    uint64_t doc;
+    while (in >> doc)
+        ids.push_back(doc);
+    uint64_t n = ids.empty() ? 0 : *std::max_element(ids.begin(), ids.end()) + 1;
+    docs = bit_vector(n, 0);
+    for (auto d : ids)
+        docs[d] = 1;
+    return true;
+}
+
 int main(int argc, char* argv[])
 {
 
@@ -201,6 +331,41 @@ int main(int argc, char* argv[])
     idx_type::topk_interface* topk = &idx;
     if (debug_stream)
         topk->set_debug_stream(debug_stream);
+    using interval_cache_type = sa_interval_cache<idx_type::topk_interface::token_type>;
+    if (args.interval_cache_size)
+        topk->set_interval_cache(
+                std::make_shared<interval_cache_type>(args.interval_cache_size));
+    using cached_type = cached_topk_index<idx_type::topk_interface::token_type>;
+    std::unique_ptr<cached_type> cached;
+    if (args.result_cache_size) {
+        cached = std::make_unique<cached_type>(topk,
+                std::make_shared<cached_type::cache_type>(args.result_cache_size));
+        topk = cached.get();
+    }
+    if (args.excluded_file != "") {
+        auto excluded = std::make_shared<bit_vector>();
+        if (!load_doc_set(args.excluded_file, *excluded)) {
+            cerr << "Could not load excluded documents file" << endl;
+            return 1;
+        }
+        topk->set_excluded_docs(excluded);
+    }
+    // All queries of this thread are filtered.
+    doc_filter filter(args.doc_lo, args.doc_hi);
+    sd_vector<> allowed;
+    if (args.allowed_file != "") {
+        bit_vector allowed_bv;
+        if (!load_doc_set(args.allowed_file, allowed_bv)) {
+            cerr << "Could not load allowed documents file" << endl;
+            return 1;
+        }
+        allowed = sd_vector<>(allowed_bv);
+        filter = doc_filter(allowed, args.doc_lo, args.doc_hi);
+    }
+    // Requests of the protocol carry the doc range themselves.
+    std::unique_ptr<filter_scope> filtered;
+    if (args.filtered and args.protocol == "")
+        filtered = std::make_unique<filter_scope>(filter);
 
     if (!args.verbose) {
         cout << "# pattern_file = " << args.query_file << endl;
@@ -230,18 +395,78 @@ int main(int argc, char* argv[])
     size_t sum = 0;
     size_t sum_fdt = 0;
     size_t sum_chars_extracted = 0;
+    size_t sum_positions = 0;
     size_t q_len = 0;
     size_t q_cnt = 0;
-    for (int run = 0; run < 1; ++run) {
-        sum = 0;
-        sum_fdt = 0;
-        sum_chars_extracted = 0;
-        q_len = 0;
-        q_cnt = 0;
+    size_t truncated = 0;
+    auto timeout = chrono::microseconds(args.timeout_us);
+    if (args.batch) {
+        // The patterns share the backward search, so we can only time the
+        // whole batch.
+        using query_type = decltype(myline<idx_type::alphabet_category>::parse(""));
+        vector<query_type> parsed;
+        idx_type::topk_interface::batch_query batch_query;
+        for (const auto& q : queries)
+            parsed.push_back(myline<idx_type::alphabet_category>::parse(q));
+        for (const auto& q : parsed) {
+            batch_query.emplace_back(q.data(), q.data() + q.size());
+            q_len += q.size();
+        }
+        q_cnt = parsed.size();
+        start = timer::now();
+        query_budget budget(timeout, args.max_steps);
+        budget_scope scope(budget);
+        auto results = topk->topk_batch(args.k, batch_query,
+                                        args.multi_occ, args.match_only);
+        truncated += budget.truncated();
+        uint64_t msecs = chrono::duration_cast<chrono::microseconds>(
+                timer::now() - start).count();
+        for (size_t i = 0; i < results.size(); ++i) {
+            for (size_t x = 0; x < results[i].size(); ++x) {
+                sum_fdt += results[i][x].second;
+                if (args.verbose) {
+                    cout << "RESULT " << i + 1 << ";" << x + 1 << ";"
+                         << results[i][x].first << ";" << results[i][x].second << "\n";
+                }
+            }
+            sum += results[i].size();
+            timings.push_back(msecs / std::max<size_t>(1, q_cnt));
+        }
+    }
+    if (!args.batch) {
         for (size_t i = 0; i < queries.size(); ++i) {
+            query_budget budget(timeout, args.max_steps);
+            budget_scope scope(budget);
             std::unique_ptr<idx_type::topk_interface::iter> res_it;
+            std::vector<topk_positions> positions;
             idx_type::topk_interface::intersect_query intersect_query;
-            if (args.intersection) {
+            if (args.protocol != "") {
+                using namespace server_protocol;
+                request<idx_type::topk_interface::token_type> req;
+                req.type = args.union_query ? UNION : args.intersection ? INTERSECT : TOPK;
+                req.flags = (args.multi_occ ? MULTI_OCC : 0) | (args.match_only ? ONLY_MATCH : 0)
+                            | (args.protocol == "compact" ? COMPACT : 0)
+                            | (args.filtered ? DOC_RANGE : 0);
+                req.k = args.k;
+                req.snippet_size = args.snippet_size;
+                req.timeout_us = args.timeout_us;
+                req.max_steps = args.max_steps;
+                req.doc_lo = args.doc_lo;
+                req.doc_hi = args.doc_hi;
+                if (req.type == TOPK) {
+                    auto query = myline<idx_type::alphabet_category>::parse(queries[i].c_str());
+                    req.terms.emplace_back(query.begin(), query.end());
+                } else {
+                    for (const auto& term : myline<idx_type::alphabet_category>::parse_multi(
+                                queries[i].c_str()))
+                        req.terms.emplace_back(term.begin(), term.end());
+                }
+                for (const auto& term : req.terms)
+                    q_len += term.size();
+                ++q_cnt;
+                start = timer::now();
+                res_it = protocol_query(*topk, req, truncated);
+            } else if (args.intersection or args.union_query) {
                 auto terms = myline<idx_type::alphabet_category>::parse_multi(
                         queries[i].c_str());
                 for (const auto& term : terms) {
@@ -252,15 +477,32 @@ int main(int argc, char* argv[])
 
                 ++q_cnt;
                 start = timer::now();
-                res_it = topk->topk_intersect(args.k, intersect_query,
+                if (args.union_query)
+                    res_it = topk->topk_union(args.k, intersect_query,
                                               args.multi_occ, args.match_only);
+                else
+                    res_it = topk->topk_intersect(args.k, intersect_query,
+                                                  args.multi_occ, args.match_only);
             } else {
                 auto query = myline<idx_type::alphabet_category>::parse(queries[i].c_str());
                 q_len += query.size();
                 ++q_cnt;
                 start = timer::now();
-                res_it = topk->topk(args.k, query.data(), query.data() + query.size(),
-                                    args.multi_occ, args.match_only);
+                if (args.max_positions != 0) {
+                    positions = topk->topk_with_positions(
+                            args.k, query.data(), query.data() + query.size(),
+                            args.max_positions, args.multi_occ, args.match_only);
+                    topk_result_set results;
+                    for (const auto& r : positions)
+                        results.emplace_back(r.doc, r.weight);
+                    using iter_type = vector_topk_iterator<idx_type::topk_interface::token_type>;
+                    res_it = make_unique<iter_type>(std::move(results), topk,
+                            idx_type::topk_interface::pattern_type(
+                                query.data(), query.data() + query.size()));
+                } else {
+                    res_it = topk->topk(args.k, query.data(), query.data() + query.size(),
+                                        args.multi_occ, args.match_only);
+                }
             }
             size_t x = 0;
             while (x < args.k && !res_it->done()) {
@@ -270,6 +512,15 @@ int main(int argc, char* argv[])
                     cout << "RESULT " << q_cnt << ";" << x << ";" << res_it->get().first
                         << ";" << res_it->get().second << "\n";
                 }
+                if (x <= positions.size()) {
+                    sum_positions += positions[x - 1].positions.size();
+                    if (args.verbose) {
+                        cout << "POSITIONS";
+                        for (auto p : positions[x - 1].positions)
+                            cout << " " << p;
+                        cout << "\n";
+                    }
+                }
                 if (args.snippet_size != 0) {
                     auto snippet = res_it->extract_snippet(args.snippet_size);
                     sum_chars_extracted += snippet.size();
@@ -285,6 +536,7 @@ int main(int argc, char* argv[])
             uint64_t msecs = chrono::duration_cast<chrono::microseconds>(
                     timer::now() - start).count();
             timings.push_back(msecs);
+            truncated += budget.truncated();
             if (args.verbose_timings) {
                 cout << "TIME;" << msecs << ";" << x << "\n";
             }
@@ -323,5 +575,16 @@ int main(int argc, char* argv[])
         cout << "# input_size = " <<
              get_input_size<idx_type::alphabet_category>(args.collection_dir) << endl;
         cout << "# sum_chars_extracted = " << sum_chars_extracted << endl;
+        cout << "# sum_positions = " << sum_positions << endl;
+        if (args.timeout_us or args.max_steps)
+            cout << "# truncated_queries = " << truncated << endl;
+        if (idx.get_interval_cache()) {
+            cout << "# interval_cache_hits = " << idx.get_interval_cache()->hits() << endl;
+            cout << "# interval_cache_misses = " << idx.get_interval_cache()->misses() << endl;
+        }
+        if (cached) {
+            cout << "# result_cache_hits = " << cached->get_result_cache()->hits() << endl;
+            cout << "# result_cache_misses = " << cached->get_result_cache()->misses() << endl;
+        }
     }
 }
@@ -0,0 +1,268 @@
+#include "surf/config.hpp"
+#include "surf/indexes.hpp"
+#include "surf/server_protocol.hpp"
+#include "surf/topk_result_cache.hpp"
+#include <unistd.h>
+#include <stdlib.h>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <zmq.hpp>
+
+using namespace std;
+using namespace sdsl;
+using namespace surf;
+
+typedef struct cmdargs {
+    std::string collection_dir = "";
+    std::string endpoint = "ipc:///tmp/surf_server";
+    uint64_t threads = 0;
+    uint64_t queue_size = 64;
+    uint32_t timeout_us = 0;
+    uint64_t max_steps = 0;
+    uint64_t interval_cache_size = 0;
+    uint64_t result_cache_size = 0;
+} cmdargs_t;
+
+void
+print_usage(char* program)
+{
+    fprintf(stdout, "%s -c <collection directory> other options\n", program);
+    fprintf(stdout, "where\n");
+    fprintf(stdout, "  -c <collection directory> : the directory the collection is stored.\n");
+    fprintf(stdout, "  -e <endpoint>     : zeromq endpoint, e.g. tcp://*:5555 or ipc:///tmp/surf_server.\n");
+    fprintf(stdout, "  -w <threads>      : number of worker threads; default: number of cores.\n");
+    fprintf(stdout, "  -Q <queue_size>   : reject requests if more than queue_size wait for a worker.\n");
+    fprintf(stdout, "  -T <timeout>      : default timeout of a query in microseconds.\n");
+    fprintf(stdout, "  -B <max_steps>    : default step budget of a query.\n");
+    fprintf(stdout, "  -C <cache_size>   : cache the SA intervals of up to cache_size patterns.\n");
+    fprintf(stdout, "  -R <cache_bytes>  : cache top-k results in up to cache_bytes bytes.\n");
+};
+
+cmdargs_t
+parse_args(int argc, char* const argv[])
+{
+    cmdargs_t args;
+    int op;
+    while ((op = getopt(argc, argv, "c:e:w:Q:T:B:C:R:")) != -1) {
+        switch (op) {
+            case 'c':
+                args.collection_dir = optarg;
+                break;
+            case 'e':
+                args.endpoint = optarg;
+                break;
+            case 'w':
+                args.threads = std::strtoul(optarg, NULL, 10);
+                break;
+            case 'Q':
+                args.queue_size = std::strtoul(optarg, NULL, 10);
+                break;
+            case 'T':
+                args.timeout_us = std::strtoul(optarg, NULL, 10);
+                break;
+            case 'B':
+                args.max_steps = std::strtoul(optarg, NULL, 10);
+                break;
+            case 'C':
+                args.interval_cache_size = std::strtoul(optarg, NULL, 10);
+                break;
+            case 'R':
+                args.result_cache_size = std::strtoul(optarg, NULL, 10);
+                break;
+            case '?':
+            default:
+                print_usage(argv[0]);
+        }
+    }
+    if (args.collection_dir == "") {
+        std::cerr << "Missing command line parameters.\n";
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (args.threads == 0)
+        args.threads = std::max(1U, std::thread::hardware_concurrency());
+    return args;
+}
+
+using idx_type = INDEX_TYPE;
+using token_type = idx_type::topk_interface::token_type;
+using weight_type = compact_weight<idx_type>::type;
+
+const char* workers_endpoint = "inproc://workers";
+const char* ready_message = "READY";
+
+using clock_type = query_budget::clock;
+
+// The broker passes the arrival time of a request to the worker in a
+// part before the request.
+vector<char> encode_time(clock_type::time_point t)
+{
+    int64_t ticks = t.time_since_epoch().count();
+    return vector<char>((const char*)&ticks, (const char*)&ticks + sizeof(ticks));
+}
+
+clock_type::time_point decode_time(const vector<char>& part)
+{
+    int64_t ticks;
+    memcpy(&ticks, part.data(), sizeof(ticks));
+    return clock_type::time_point(clock_type::duration(ticks));
+}
+
+// Receives all parts of a multi-part message.
+vector<vector<char>> recv_parts(zmq::socket_t& socket)
+{
+    vector<vector<char>> parts;
+    int more = 1;
+    while (more) {
+        zmq::message_t part;
+        socket.recv(&part);
+        const char* data = (const char*)part.data();
+        parts.emplace_back(data, data + part.size());
+        size_t more_size = sizeof(more);
+        socket.getsockopt(ZMQ_RCVMORE, &more, &more_size);
+    }
+    return parts;
+}
+
+void send_parts(zmq::socket_t& socket, const vector<vector<char>>& parts)
+{
+    for (size_t i = 0; i < parts.size(); ++i) {
+        zmq::message_t part(parts[i].size());
+        memcpy(part.data(), parts[i].data(), parts[i].size());
+        socket.send(part, i + 1 < parts.size() ? ZMQ_SNDMORE : 0);
+    }
+}
+
+// Each worker answers one request at a time on its own REQ socket. It
+// announces itself with a READY message and then gets the envelope of a
+// client, the arrival time and the request, and sends the envelope back
+// with the response.
+// The index is loaded once and shared, queries do not modify it. A query
+// which throws, e.g. bad_alloc, is answered with BAD_REQUEST.
+void worker(zmq::context_t& context, idx_type::topk_interface* topk,
+            const cmdargs_t& args)
+{
+    zmq::socket_t socket(context, ZMQ_REQ);
+    try {
+        socket.connect(workers_endpoint);
+        send_parts(socket, {vector<char>(ready_message, ready_message + strlen(ready_message))});
+        while (true) {
+            auto parts = recv_parts(socket);
+            auto arrival = decode_time(parts[parts.size() - 2]);
+            parts.erase(parts.end() - 2);
+            std::string response;
+            try {
+                response = server_protocol::handle_request<token_type, weight_type>(
+                               *topk, parts.back().data(), parts.back().size(),
+                               args.timeout_us, args.max_steps, arrival);
+            } catch (const std::exception& e) {
+                cerr << "request failed: " << e.what() << endl;
+                response = server_protocol::status_response(server_protocol::BAD_REQUEST);
+            }
+            parts.back() = vector<char>(response.begin(), response.end());
+            send_parts(socket, parts);
+        }
+    } catch (const zmq::error_t&) {
+        return; // context terminated
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    cmdargs_t args = parse_args(argc, argv);
+    idx_type idx;
+
+    cout << "# collection_file = " << args.collection_dir << endl;
+    cout << "# index_name = " << IDXNAME << endl;
+    auto cc = parse_collection<idx_type::alphabet_category>(args.collection_dir);
+    idx.load(cc);
+    idx_type::topk_interface* topk = &idx;
+    using interval_cache_type = sa_interval_cache<token_type>;
+    if (args.interval_cache_size)
+        topk->set_interval_cache(
+                std::make_shared<interval_cache_type>(args.interval_cache_size));
+    using cached_type = cached_topk_index<token_type>;
+    std::unique_ptr<cached_type> cached;
+    if (args.result_cache_size) {
+        cached = std::make_unique<cached_type>(topk,
+                std::make_shared<cached_type::cache_type>(args.result_cache_size));
+        topk = cached.get();
+    }
+
+    // Requests arrive on a ROUTER socket and are passed to idle workers
+    // through a second ROUTER socket; the workers report when they are
+    // idle, so no request waits behind an expensive query of a busy worker.
+    zmq::context_t context(1);
+    zmq::socket_t clients(context, ZMQ_ROUTER);
+    clients.bind(args.endpoint);
+    zmq::socket_t workers(context, ZMQ_ROUTER);
+    workers.bind(workers_endpoint);
+
+    vector<thread> pool;
+    for (uint64_t i = 0; i < args.threads; ++i)
+        pool.emplace_back(worker, std::ref(context), topk, std::cref(args));
+    cout << "# endpoint = " << args.endpoint << endl;
+    cout << "# threads = " << args.threads << endl;
+    cout << "# queue_size = " << args.queue_size << endl;
+
+    // Admission control: if no worker is idle, at most queue_size requests
+    // wait in the broker, further requests are answered with OVERLOADED
+    // right away instead of queueing up behind expensive queries. The
+    // deadline of a request counts from its arrival at the broker, so the
+    // time it waits in the queue is part of it.
+    deque<vector<char>> idle;             // identities of idle workers
+    deque<vector<vector<char>>> pending;  // requests waiting for a worker
+    auto dispatch = [&](vector<char> worker_id, vector<vector<char>> request) {
+        request.insert(request.begin(), {std::move(worker_id), vector<char>()});
+        send_parts(workers, request);
+    };
+    zmq::pollitem_t items[] = {
+        {(void*)clients, 0, ZMQ_POLLIN, 0},
+        {(void*)workers, 0, ZMQ_POLLIN, 0}
+    };
+    while (true) {
+        try {
+            zmq::poll(items, 2, -1);
+        } catch (const zmq::error_t&) {
+            break;
+        }
+        if (items[1].revents & ZMQ_POLLIN) {
+            // worker identity, empty delimiter, then READY or the envelope
+            // of a client followed by the response
+            auto parts = recv_parts(workers);
+            vector<char> worker_id = std::move(parts[0]);
+            parts.erase(parts.begin(), parts.begin() + 2);
+            if (parts.size() > 1)
+                send_parts(clients, parts);
+            if (pending.empty()) {
+                idle.push_back(std::move(worker_id));
+            } else {
+                dispatch(std::move(worker_id), std::move(pending.front()));
+                pending.pop_front();
+            }
+        }
+        if (items[0].revents & ZMQ_POLLIN) {
+            auto parts = recv_parts(clients);
+            parts.insert(parts.end() - 1, encode_time(clock_type::now()));
+            if (!idle.empty()) {
+                dispatch(std::move(idle.front()), std::move(parts));
+                idle.pop_front();
+            } else if (pending.size() < args.queue_size) {
+                pending.push_back(std::move(parts));
+            } else { // envelope of the request, followed by the response
+                auto response = server_protocol::status_response(
+                                    server_protocol::OVERLOADED);
+                parts.erase(parts.end() - 2);
+                parts.back() = vector<char>(response.begin(), response.end());
+                send_parts(clients, parts);
+            }
+        }
+    }
+    for (auto& t : pool)
+        t.join();
+}
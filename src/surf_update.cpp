@@ -0,0 +1,107 @@
+#include "surf/config.hpp"
+#include "surf/indexes.hpp"
+#include "surf/util.hpp"
+#include <unistd.h>
+#include <stdlib.h>
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+using namespace sdsl;
+using namespace surf;
+
+typedef struct cmdargs {
+    std::string collection_dir = "";
+    std::vector<std::string> add_dirs;
+    std::vector<uint64_t> deleted_docs;
+    bool merge = false;
+} cmdargs_t;
+
+void
+print_usage(char* program)
+{
+    fprintf(stdout, "%s -c <collection directory> other options\n", program);
+    fprintf(stdout, "where\n");
+    fprintf(stdout, "  -c <collection directory> : the directory the collection is stored.\n");
+    fprintf(stdout, "  -a <collection directory> : add the documents of this collection.\n");
+    fprintf(stdout, "  -d <doc id>       : delete the document.\n");
+    fprintf(stdout, "  -M                : merge the new documents into the base index.\n");
+};
+
+cmdargs_t
+parse_args(int argc, char* const argv[])
+{
+    cmdargs_t args;
+    int op;
+    while ((op = getopt(argc, argv, "c:a:d:M")) != -1) {
+        switch (op) {
+            case 'c':
+                args.collection_dir = optarg;
+                break;
+            case 'a':
+                args.add_dirs.push_back(optarg);
+                break;
+            case 'd':
+                args.deleted_docs.push_back(std::strtoul(optarg, NULL, 10));
+                break;
+            case 'M':
+                args.merge = true;
+                break;
+            case '?':
+            default:
+                print_usage(argv[0]);
+        }
+    }
+    if (args.collection_dir == "") {
+        std::cerr << "Missing command line parameters.\n";
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    return args;
+}
+
+int main(int argc, char* argv[])
+{
+    using clock = std::chrono::high_resolution_clock;
+    using idx_type = INDEX_TYPE;
+    cmdargs_t args = parse_args(argc, argv);
+    idx_type idx;
+
+    cout << "# collection_file = " << args.collection_dir << endl;
+    cout << "# index_name = " << IDXNAME << endl;
+    auto cc = parse_collection<idx_type::alphabet_category>(args.collection_dir);
+    idx.load(cc);
+
+    for (const auto& dir : args.add_dirs) {
+        if (!valid_collection<idx_type::alphabet_category>(dir))
+            return EXIT_FAILURE;
+        idx_type::text_type text;
+        load_from_file(text, dir + "/" + (idx_type::int_alphabet ? TEXT_FILENAME : TEXT_FILENAME_BYTE));
+        auto start = clock::now();
+        uint64_t first = idx.add_documents(text);
+        auto stop = clock::now();
+        cout << "# added " << dir << " as documents " << first << " to "
+             << idx.num_docs() - 1 << " in "
+             << std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count()
+             << " ms" << endl;
+    }
+    for (auto doc : args.deleted_docs) {
+        if (!idx.remove_document(doc))
+            cerr << "document " << doc << " does not exist" << endl;
+    }
+    if (args.merge) {
+        // Queries could continue on idx while the merge runs.
+        auto start = clock::now();
+        auto merged = idx.merge_async();
+        if (merged.get()) {
+            auto stop = clock::now();
+            cout << "# merged in "
+                 << std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count()
+                 << " ms" << endl;
+        }
+    }
+    cout << "# generation = " << idx.generation() << endl;
+    cout << "# num_docs = " << idx.num_docs() << endl;
+    return EXIT_SUCCESS;
+}
@@ -15,12 +15,18 @@
 #include "failure.h"
 #include "sdsl/sd_vector.hpp"
 
+// The index is chosen by the config the Makefile turns into
+// susi_config.h, see SUSI_CONFIG. Without one it is IDX_NN.
+#include "susi_config.h"
+
+#ifndef INDEX_TYPE
 #define NAME IDX_NN
 #define CSA_TYPE sdsl::csa_wt<sdsl::wt_huff<sdsl::hyb_vector<>>,32,32, sdsl::text_order_sa_sampling<>, sdsl::text_order_isa_sampling_support<>>
-#define DF_TYPE surf::df_sada<sdsl::rrr_vector<63>,sdsl::rrr_vector<63>::select_1_type, sdsl::byte_alphabet_tag>
+#define DF_TYPE surf::df_sada<CSA_TYPE,sdsl::rrr_vector<63>,sdsl::rrr_vector<63>::select_1_type, false>
 #define WTD_TYPE sdsl::wt_int<sdsl::bit_vector, sdsl::rank_support_v5<>, sdsl::select_support_scan<1>, sdsl::select_support_scan<0>>
 #define KTWOTREAP_TYPE sdsl::k2_treap<2,sdsl::rrr_vector<63>>
-#define INDEX_TYPE surf::idx_nn<CSA_TYPE,char,KTWOTREAP_TYPE>
+#define INDEX_TYPE surf::idx_nn<CSA_TYPE,KTWOTREAP_TYPE>
+#endif
 
 // do we really need 3 levels here? https://gcc.gnu.org/onlinedocs/cpp/Stringification.html
 #define XSTR(s) STR(s)
@@ -28,7 +34,7 @@
 #define NAME_STR XSTR(NAME)
 
 #include "surf/config.hpp"
-#include "surf/idx_nn.hpp"
+#include "surf/indexes.hpp"
 
 using std::pair;
 using std::set;